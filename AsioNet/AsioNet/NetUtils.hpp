@@ -5,6 +5,7 @@
 #include "async_job.h"
 #include "error_code.hpp"
 #include "reusabel_buffer.hpp"
+#include "slab_buffer.hpp"
 
 #define LITTLE_ENDIAN 1
 
@@ -14,19 +15,42 @@
 #define TINY_ONCE_BUFFER_SIZE 16 // although _mm128
 #define TOTAL_CACHE_SIZE 1024 * 1024 * 10
 
-typedef std::shared_ptr<reusabel_buffer<TINY_ONCE_BUFFER_SIZE>> tiny_buffer_sptr;
-typedef std::shared_ptr<reusabel_buffer<ONCE_BUFFER_SIZE>> once_buffer_sptr;
+#define SEND_GATHER_MAX 64 // asio never hands more than 64 iovecs to one writev
+#define SEND_QUEUE_CAP 1024 * 1024 * 4
+
+#define RECV_INITIAL_SIZE 1024 // receive buffers start small, grow per frame and shrink back when idle
+#define RECV_SHRINK_READS 64 // reads observed before a receive buffer may shrink
+
+// intrusive handles, acquiring or copying a buffer never allocates a control block
+typedef parallel_core::PoolHandle<reusabel_buffer<TINY_ONCE_BUFFER_SIZE>> tiny_buffer_sptr;
+typedef parallel_core::PoolHandle<slab_buffer> once_buffer_sptr;
 typedef std::shared_ptr<parallel_core::RingBuffer<unsigned char>> lockfree_buffer_sptr;
 
 #define RING_BUFFER_POOL parallel_core::ThreadSafeObjectPool<parallel_core::RingBuffer<unsigned char>>::instance()
-#define TEMP_BUFFER_POOL parallel_core::ThreadSafeObjectPool<reusabel_buffer<ONCE_BUFFER_SIZE>>::instance()
+#define TEMP_BUFFER_POOL parallel_core::ThreadSafeObjectPool<slab_buffer>::instance()
 #define TINY_BUFFER_POOL parallel_core::ThreadSafeObjectPool<reusabel_buffer<TINY_ONCE_BUFFER_SIZE>>::instance()
 
 #define LOCK_FREE_BUFFER(name) name = RING_BUFFER_POOL->get_shared(TOTAL_CACHE_SIZE); \
 name->clear()
 
-#define TEMP_BUFFER TEMP_BUFFER_POOL->get_shared()->reset()
-#define TINY_BUFFER TINY_BUFFER_POOL->get_shared()->reset()
+#define TEMP_BUFFER acquire_temp_buffer(ONCE_BUFFER_SIZE)
+#define TEMP_BUFFER_OF(need) acquire_temp_buffer(need)
+#define TINY_BUFFER acquire_tiny_buffer()
+
+// reset in place, a handle returned from reset() would cost an extra add_ref/drop_ref per buffer
+inline once_buffer_sptr acquire_temp_buffer(size_t need)
+{
+	once_buffer_sptr buffer = TEMP_BUFFER_POOL->get_handle();
+	buffer->reset(need);
+	return buffer;
+}
+
+inline tiny_buffer_sptr acquire_tiny_buffer()
+{
+	tiny_buffer_sptr buffer = TINY_BUFFER_POOL->get_handle();
+	buffer->reset();
+	return buffer;
+}
 
 #define STRING_BUFFER parallel_core::ThreadSafeObjectPool<std::string>::instance()->get_shared()
 
@@ -89,6 +113,31 @@ inline int64_t read_uint64(unsigned char* block)
 	return ret;
 }
 
+// little endian, the order protocol_head has always used on the wire
+inline void write_uint16_le(unsigned char* block, uint16_t val)
+{
+	block[0] = (val & 0x00ffu);
+	block[1] = (val & 0xff00u) >> 8;
+}
+
+inline constexpr uint16_t read_uint16_le(const unsigned char* block)
+{
+	return (uint16_t)((uint16_t)block[0] | ((uint16_t)block[1] << 8));
+}
+
+inline void write_uint32_le(unsigned char* block, uint32_t val)
+{
+	block[0] =  val & 0x000000ffu;
+	block[1] = (val & 0x0000ff00u) >> 8;
+	block[2] = (val & 0x00ff0000u) >> 16;
+	block[3] = (val & 0xff000000u) >> 24;
+}
+
+inline constexpr uint32_t read_uint32_le(const unsigned char* block)
+{
+	return (uint32_t)block[0] | ((uint32_t)block[1] << 8) | ((uint32_t)block[2] << 16) | ((uint32_t)block[3] << 24);
+}
+
 #pragma warning(pop)
 
 typedef uint64_t server_id;
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "NetUtils.hpp"
+
+// uid(4) | x(4) | y(4) of a Commands_AoiUpdate entry, coordinates are int32 in the game server's units
+#define AOI_POSITION_SIZE 12
+
+namespace net_middleware
+{
+    struct aoi_position
+    {
+        session_uid uid;
+        int32_t x;
+        int32_t y;
+    };
+
+    // area of interest index, a uniform grid of cell_size squares that only holds the cells in use.
+    // a radius query walks the cells its bounding square touches and checks the exact distance,
+    // so cell_size near the common query radius keeps that to 9 cells or so.
+    // not thread safe, the owning server session touches it in its strand only
+    template <typename Value>
+    class aoi_grid
+    {
+    public:
+        explicit aoi_grid(int32_t cell_size = 1) :
+            _cell_size(cell_size > 0 ? cell_size : 1)
+        {
+        }
+
+        // drops every entity, the cell size may only change while empty
+        void reset(int32_t cell_size)
+        {
+            _cell_size = cell_size > 0 ? cell_size : 1;
+            _entities.clear();
+            _index.clear();
+            _cells.clear();
+        }
+
+        inline size_t size() const { return _entities.size(); }
+
+        inline bool contains(session_uid uid) const { return _index.count(uid) > 0; }
+
+        // @return false if uid isn't in the grid yet, it takes insert with a value
+        bool move(session_uid uid, int32_t x, int32_t y)
+        {
+            auto iter = _index.find(uid);
+            if (iter == _index.end())
+            {
+                return false;
+            }
+
+            entity& e = _entities[iter->second];
+            uint64_t key = cell_of(x, y);
+            if (key == e.cell)
+            {
+                cell_entry& entry = _cells[key][e.slot];
+                entry.x = x;
+                entry.y = y;
+                return true;
+            }
+
+            leave_cell(e);
+            enter_cell(iter->second, key, x, y);
+            return true;
+        }
+
+        // moves uid if it is there already, the value is kept then
+        void insert(session_uid uid, int32_t x, int32_t y, const Value& value)
+        {
+            if (move(uid, x, y))
+            {
+                return;
+            }
+
+            uint32_t idx = (uint32_t)_entities.size();
+            entity e = { uid, 0, 0, value };
+            _entities.push_back(e);
+            _index.insert(std::make_pair(uid, idx));
+            enter_cell(idx, cell_of(x, y), x, y);
+        }
+
+        bool erase(session_uid uid)
+        {
+            auto iter = _index.find(uid);
+            if (iter == _index.end())
+            {
+                return false;
+            }
+
+            uint32_t idx = iter->second;
+            _index.erase(iter);
+            leave_cell(_entities[idx]);
+
+            // the last entity fills the hole, its cell entry follows
+            uint32_t last = (uint32_t)_entities.size() - 1;
+            if (idx != last)
+            {
+                _entities[idx] = _entities[last];
+                entity& moved = _entities[idx];
+                _cells[moved.cell][moved.slot].idx = idx;
+                _index[moved.uid] = idx;
+            }
+            _entities.pop_back();
+
+            return true;
+        }
+
+        // visit(uid, value) for every entity within radius of (x, y), border included
+        template <typename Visitor>
+        void query(int32_t x, int32_t y, uint32_t radius, Visitor visit)
+        {
+            int64_t r = radius;
+            int64_t r2 = r * r;
+
+            int64_t cx0 = cell_coord(x - r), cx1 = cell_coord(x + r);
+            int64_t cy0 = cell_coord(y - r), cy1 = cell_coord(y + r);
+
+            // a radius wider than the populated world, walking what is there beats probing empty cells
+            uint64_t w = (uint64_t)(cx1 - cx0 + 1), h = (uint64_t)(cy1 - cy0 + 1);
+            if (w > _cells.size() || h > _cells.size() || w * h > _cells.size())
+            {
+                for (auto& cell : _cells)
+                {
+                    visit_cell(cell.second, x, y, r2, visit);
+                }
+                return;
+            }
+
+            for (int64_t cx = cx0; cx <= cx1; ++cx)
+            {
+                for (int64_t cy = cy0; cy <= cy1; ++cy)
+                {
+                    auto iter = _cells.find(cell_key(cx, cy));
+                    if (iter != _cells.end())
+                    {
+                        visit_cell(iter->second, x, y, r2, visit);
+                    }
+                }
+            }
+        }
+
+    private:
+        // positions are kept in the cell, a query reads one array per cell and touches an entity on a hit only
+        struct cell_entry
+        {
+            int32_t x;
+            int32_t y;
+            uint32_t idx;
+        };
+
+        struct entity
+        {
+            session_uid uid;
+            uint64_t cell;
+            uint32_t slot;
+            Value value;
+        };
+
+        template <typename Visitor>
+        inline void visit_cell(const std::vector<cell_entry>& cell, int32_t x, int32_t y, int64_t r2, Visitor& visit)
+        {
+            for (auto& entry : cell)
+            {
+                int64_t dx = (int64_t)entry.x - x;
+                int64_t dy = (int64_t)entry.y - y;
+                if (dx * dx + dy * dy <= r2)
+                {
+                    entity& e = _entities[entry.idx];
+                    visit(e.uid, e.value);
+                }
+            }
+        }
+
+        // floor division, -1 is in the cell left of 0
+        inline int64_t cell_coord(int64_t v) const
+        {
+            return v >= 0 ? v / _cell_size : -((-v - 1) / _cell_size) - 1;
+        }
+
+        static inline uint64_t cell_key(int64_t cx, int64_t cy)
+        {
+            return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+        }
+
+        inline uint64_t cell_of(int32_t x, int32_t y) const
+        {
+            return cell_key(cell_coord(x), cell_coord(y));
+        }
+
+        void enter_cell(uint32_t idx, uint64_t key, int32_t x, int32_t y)
+        {
+            std::vector<cell_entry>& cell = _cells[key];
+            entity& e = _entities[idx];
+            e.cell = key;
+            e.slot = (uint32_t)cell.size();
+
+            cell_entry entry = { x, y, idx };
+            cell.push_back(entry);
+        }
+
+        // swap with the cell's last entry, an emptied cell goes away
+        void leave_cell(const entity& e)
+        {
+            auto iter = _cells.find(e.cell);
+            std::vector<cell_entry>& cell = iter->second;
+
+            if (e.slot != cell.size() - 1)
+            {
+                cell[e.slot] = cell.back();
+                _entities[cell[e.slot].idx].slot = e.slot;
+            }
+            cell.pop_back();
+
+            if (cell.empty())
+            {
+                _cells.erase(iter);
+            }
+        }
+
+    private:
+        int32_t _cell_size;
+        std::vector<entity> _entities;
+        std::unordered_map<session_uid, uint32_t> _index;
+        std::unordered_map<uint64_t, std::vector<cell_entry>> _cells;
+    };
+}
@@ -1,5 +1,6 @@
 #include "async_job.h"
 #include "NetUtils.hpp"
+#include "parallel_core/ThreadWrapper.h"
 
 net_middleware::async_job_executor::async_job_executor(size_t n):
 	_strand_num(n),
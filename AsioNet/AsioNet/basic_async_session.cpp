@@ -7,13 +7,23 @@ net_middleware::basic_async_session::basic_async_session(std::shared_ptr<async_j
     _job_agent(JOB_AGENT(job_excutor)),
     _state(StateSocket::INIT),
     _sock(_job_agent->strand_to_run()),
+    _recv_donated(false),
+    _recv_size_hint(RECV_INITIAL_SIZE),
+    _recv_reads(0),
+    _recv_high_water(0),
     _timer(_job_agent->strand_to_run()),
     _tick_timer(_job_agent->strand_to_run()),
-    _uuid(0)
+    _uuid(0),
+    _send_queue_bytes(0),
+    _send_queue_cap(SEND_QUEUE_CAP),
+    _send_in_flight(false),
+    _cork_timer(_job_agent->strand_to_run()),
+    _cork_timer_armed(false),
+    _cork_threshold(0),
+    _cork_delay(0)
 {
     update_recv_time();
     update_send_time();
-    generate_uuid();
 }
 
 net_middleware::basic_async_session::~basic_async_session()
@@ -21,11 +31,6 @@ net_middleware::basic_async_session::~basic_async_session()
     clear_all_timer();
 }
 
-void net_middleware::basic_async_session::generate_uuid()
-{
-    _uuid = (uint32_t)clock();
-}
-
 void net_middleware::basic_async_session::init_options()
 {
     if (_sock.is_open())
@@ -104,7 +109,11 @@ void net_middleware::basic_async_session::async_recv_loop()
     // last time received is not a entire protocol
     if (!_recv_not_entire)
     {
-        _recv_not_entire = TEMP_BUFFER;
+        _recv_not_entire = TEMP_BUFFER_OF(_recv_size_hint);
+    }
+    else if (UNLIKELY(!fit_recv_buffer()))
+    {
+        return;
     }
 
     _sock.async_read_some(asio::buffer(_recv_not_entire->buffer(_recv_not_entire->length), _recv_not_entire->available_capacity() - _recv_not_entire->length),
@@ -120,6 +129,9 @@ void net_middleware::basic_async_session::async_recv_loop()
 
             _recv_not_entire->length += length;
 
+            ++_recv_reads;
+            _recv_high_water = _recv_not_entire->length > _recv_high_water ? _recv_not_entire->length : _recv_high_water;
+
             pick_entire_msgs();
         }
     );
@@ -127,32 +139,124 @@ void net_middleware::basic_async_session::async_recv_loop()
 
 void net_middleware::basic_async_session::async_send(once_buffer_sptr tmp_buffer, std::function<void()> cb)
 {
-    if (UNLIKELY(_state != StateSocket::CONNECTING))
-    {
-        LOG("state is not CONNECTING, %d", (int)_state);
-        return;
-    }
+    // logic state and the send queue belong to this session's strand
+    auto self(shared_from_this());
+    _job_agent->strand_to_run().dispatch([this, self, tmp_buffer, cb]() {
+        if (UNLIKELY(_state != StateSocket::CONNECTING))
+        {
+            LOG("state is not CONNECTING, %d", (int)_state);
+            return;
+        }
 
-    update_send_time();
+        update_send_time();
 
-    auto mutable_buffer = tmp_buffer;
-    _logic->wrap_to_send_data(mutable_buffer);
+        auto mutable_buffer = tmp_buffer;
+        _logic->wrap_to_send_data(mutable_buffer);
 
+        if (UNLIKELY(!reserve_send_queue(mutable_buffer->length)))
+        {
+            return;
+        }
+
+        enqueue_segment(mutable_buffer, mutable_buffer->buffer(), mutable_buffer->length, cb);
+        schedule_send_queue(mutable_buffer->buffer());
+    });
+}
+
+void net_middleware::basic_async_session::async_send_state(once_buffer_sptr tmp_buffer)
+{
+    // the channel bases belong to the logic, so the delta is taken in the strand as well
     auto self(shared_from_this());
-    _sock.async_write_some(asio::buffer(mutable_buffer->buffer(), mutable_buffer->length), [this, self, cb](asio::error_code ec, size_t length) {
-        if (UNLIKELY(ec))
+    _job_agent->strand_to_run().dispatch([this, self, tmp_buffer]() {
+        if (UNLIKELY(_state != StateSocket::CONNECTING))
         {
-            LOG("fatal send, %s", ec.message().c_str());
-            close(false);
+            LOG("state is not CONNECTING, %d", (int)_state);
             return;
         }
 
-        if (cb)
-            cb();
+        update_send_time();
+
+        auto mutable_buffer = tmp_buffer;
+        _logic->wrap_state_data(mutable_buffer);
+
+        if (UNLIKELY(!reserve_send_queue(mutable_buffer->length)))
+        {
+            return;
+        }
+
+        enqueue_segment(mutable_buffer, mutable_buffer->buffer(), mutable_buffer->length, nullptr);
+        schedule_send_queue(mutable_buffer->buffer());
     });
 }
 
 void net_middleware::basic_async_session::async_send_multi(tiny_buffer_sptr head, once_buffer_sptr msg, std::function<void()> cb)
+{
+    auto self(shared_from_this());
+    _job_agent->strand_to_run().dispatch([this, self, head, msg, cb]() {
+        if (UNLIKELY(_state != StateSocket::CONNECTING))
+        {
+            LOG("state is not CONNECTING, %d", (int)_state);
+            return;
+        }
+
+        update_send_time();
+
+        size_t head_len = head ? head->length : 0;
+        size_t msg_len = msg ? msg->length : 0;
+        if (UNLIKELY(!reserve_send_queue(head_len + msg_len)))
+        {
+            return;
+        }
+
+        unsigned char* frame = nullptr;
+        if (nullptr == msg)
+        {
+            frame = head->buffer();
+            enqueue_segment(head, frame, head_len, cb);
+        }
+        else if (nullptr == head)
+        {
+            frame = msg->buffer();
+            enqueue_segment(msg, frame, msg_len, cb);
+        }
+        else
+        {
+            frame = head->buffer();
+            enqueue_segment(head, frame, head_len, nullptr);
+            enqueue_segment(msg, msg->buffer(), msg_len, cb);
+        }
+
+        schedule_send_queue(frame);
+    });
+}
+
+void net_middleware::basic_async_session::async_send_cut_through(tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len)
+{
+    auto self(shared_from_this());
+    _job_agent->strand_to_run().dispatch([this, self, head, holder, payload, len]() {
+        if (UNLIKELY(_state != StateSocket::CONNECTING))
+        {
+            LOG("state is not CONNECTING, %d", (int)_state);
+            return;
+        }
+
+        update_send_time();
+
+        auto head_block = head;
+        _logic->wrap_cut_through(head_block, payload, len);
+
+        if (UNLIKELY(!reserve_send_queue(head_block->length + len)))
+        {
+            return;
+        }
+
+        enqueue_segment(head_block, head_block->buffer(), head_block->length, nullptr);
+        enqueue_segment(holder, payload, len, nullptr);
+        schedule_send_queue(head_block->buffer());
+    });
+}
+
+void net_middleware::basic_async_session::send_encrypted(once_buffer_sptr tmp_buffer, bool compressed)
 {
     if (UNLIKELY(_state != StateSocket::CONNECTING))
     {
@@ -162,30 +266,100 @@ void net_middleware::basic_async_session::async_send_multi(tiny_buffer_sptr head
 
     update_send_time();
 
-    std::initializer_list<asio::mutable_buffers_1> buffer_arr;
-    if (nullptr == msg)
+    _logic->wrap_encrypted_data(tmp_buffer, compressed);
+
+    if (UNLIKELY(!reserve_send_queue(tmp_buffer->length)))
     {
-        buffer_arr = {
-            asio::mutable_buffers_1(head->buffer(), head->length)
-        };
+        return;
     }
-    else if (nullptr == head)
+
+    enqueue_segment(tmp_buffer, tmp_buffer->buffer(), tmp_buffer->length, nullptr);
+    schedule_send_queue(tmp_buffer->buffer());
+}
+
+bool net_middleware::basic_async_session::reserve_send_queue(size_t length)
+{
+    if (UNLIKELY(_send_queue_bytes + length > _send_queue_cap))
     {
-        buffer_arr = {
-            asio::mutable_buffers_1(msg->buffer(), msg->length)
-        };
+        LOG("send queue overflow, uid: %u, queued: %llu, cap: %llu", _uuid, (unsigned long long)_send_queue_bytes, (unsigned long long)_send_queue_cap);
+        close(false);
+        return false;
     }
-    else
+
+    return true;
+}
+
+void net_middleware::basic_async_session::enqueue_segment(parallel_core::AnyPoolHandle holder, unsigned char* data, size_t length, std::function<void()> cb)
+{
+    send_segment seg;
+    seg.holder = std::move(holder);
+    seg.data = data;
+    seg.length = length;
+    seg.cb = std::move(cb);
+
+    _send_queue_bytes += length;
+    _send_queue.push_back(std::move(seg));
+}
+
+void net_middleware::basic_async_session::schedule_send_queue(unsigned char* frame)
+{
+    if (_cork_delay.count() == 0 ||
+        _send_queue_bytes >= _cork_threshold ||
+        protocol_head::is_latency_critical(frame))
     {
-        buffer_arr = {
-            asio::mutable_buffers_1(head->buffer(), head->length),
-            asio::mutable_buffers_1(msg->buffer(), msg->length),
-        };
+        flush_send_queue();
+        return;
     }
 
+    if (_cork_timer_armed)
+    {
+        return;
+    }
+
+    // the deadline is never pushed back, so no frame waits longer than _cork_delay
+    _cork_timer_armed = true;
+    _cork_timer.expires_from_now(_cork_delay);
+
+    auto self(shared_from_this());
+    _cork_timer.async_wait(asio::bind_executor(_job_agent->strand_to_run(), [this, self](asio::error_code ec) {
+        _cork_timer_armed = false;
+
+        if (UNLIKELY(ec))
+        {
+            return;
+        }
+
+        flush_send_queue();
+    }));
+}
+
+void net_middleware::basic_async_session::flush_send_queue()
+{
+    if (_send_in_flight || _send_queue.empty())
+    {
+        return;
+    }
+
+    if (UNLIKELY(_state != StateSocket::CONNECTING))
+    {
+        return;
+    }
+
+    _send_gather.clear();
+    for (auto& seg : _send_queue)
+    {
+        if (_send_gather.size() >= SEND_GATHER_MAX)
+            break;
+
+        _send_gather.emplace_back(seg.data, seg.length);
+    }
+
+    _send_in_flight = true;
+
+    auto self(shared_from_this());
+    _sock.async_write_some(_send_gather, asio::bind_executor(_job_agent->strand_to_run(), [this, self](asio::error_code ec, size_t length) {
+        _send_in_flight = false;
 
-    auto self1(shared_from_this());
-    _sock.async_write_some(buffer_arr, [this, self1, cb](asio::error_code ec, size_t length) {
         if (UNLIKELY(ec))
         {
             LOG("fatal send, %s", ec.message().c_str());
@@ -193,9 +367,33 @@ void net_middleware::basic_async_session::async_send_multi(tiny_buffer_sptr head
             return;
         }
 
+        consume_send_queue(length);
+        flush_send_queue();
+    }));
+}
+
+void net_middleware::basic_async_session::consume_send_queue(size_t length)
+{
+    _send_queue_bytes -= length;
+
+    while (!_send_queue.empty())
+    {
+        auto& seg = _send_queue.front();
+        if (length < seg.length)
+        {
+            // partially written, resume from here next time
+            seg.data += length;
+            seg.length -= length;
+            return;
+        }
+
+        length -= seg.length;
+        auto cb = std::move(seg.cb);
+        _send_queue.pop_front();
+
         if (cb)
             cb();
-    });
+    }
 }
 
 uint32_t net_middleware::basic_async_session::get_remote_ip()
@@ -216,28 +414,38 @@ void net_middleware::basic_async_session::close(bool elegantly)
 
         clear_all_timer();
 
-        if (_sock.is_open())
+        asio::error_code ec;
+        if (elegantly && _sock.is_open())
         {
-            asio::error_code ec;
-            if (elegantly)
+            _state = StateSocket::TO_CLOSE;
+            _sock.shutdown(asio::socket_base::shutdown_send, ec);
+            if (UNLIKELY(ec))
             {
-                _state = StateSocket::TO_CLOSE;
-                _sock.shutdown(asio::socket_base::shutdown_send, ec);
-                if (UNLIKELY(ec))
-                {
-                    LOG("fatal shutdown socket, %s", ec.message().c_str());
-                }
+                LOG("fatal shutdown socket, %s", ec.message().c_str());
             }
-            else
+            return;
+        }
+
+        // a socket closed already still has to reach CLOSE_DONE, or nobody would ever unregister it
+        _state = StateSocket::CLOSE_DONE;
+        _send_queue.clear();
+        _send_queue_bytes = 0;
+        if (_sock.is_open())
+        {
+            _sock.close(ec);
+            if (UNLIKELY(ec))
             {
-                _state = StateSocket::CLOSE_DONE;
-                _sock.close(ec);
-                if (UNLIKELY(ec))
-                {
-                    LOG("fatal close socket, %s", ec.message().c_str());
-                }
+                LOG("fatal close socket, %s", ec.message().c_str());
             }
         }
+
+        // moved out first, whatever it captured goes with it
+        std::function<void(const std::shared_ptr<basic_async_session>&)> handler;
+        handler.swap(_close_handler);
+        if (handler)
+        {
+            handler(self);
+        }
     });
 }
 
@@ -294,7 +502,7 @@ void net_middleware::basic_async_session::tick_alive()
     duration = now_time - _last_send_time;
     if (std::chrono::duration_cast<std::chrono::milliseconds>(duration) > (_keep_alive_timeout - std::chrono::milliseconds(NET_PREDICTION_DELAY_MS_MAX)))
     {
-        auto empty_buffer = TEMP_BUFFER;
+        auto empty_buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE);
         empty_buffer->offset = PROTO_HEAD_SIZE;
         empty_buffer->length = 0;
         async_send(empty_buffer);
@@ -320,70 +528,96 @@ void net_middleware::basic_async_session::clear_all_timer()
     _timer.cancel(ec);
     
     _tick_timer.cancel(ec);
+
+    _cork_timer.cancel(ec);
 }
 
-bool net_middleware::basic_async_session::pick_a_entire_msg(protocol_head::head_sptr head, once_buffer_sptr data_block)
+bool net_middleware::basic_async_session::pick_a_entire_msg(once_buffer_sptr data_block)
 {
     size_t already_read = 0;
 
     // when recv a 0 content, which means no data but merely a head, > should be >=
     if (_recv_not_entire && _recv_not_entire->length >= PROTO_HEAD_SIZE)
     {
-        protocol_head::unpack_head(head, _recv_not_entire->buffer());
+        protocol_head head = protocol_head::decode(_recv_not_entire->buffer());
 
-        if (_recv_not_entire->length - PROTO_HEAD_SIZE < head->len)
+        if (_recv_not_entire->length - PROTO_HEAD_SIZE < head.len)
         {
             return false;
         }
         already_read += PROTO_HEAD_SIZE;
 
-        protocol_head::unpack_msg(data_block->buffer(), _recv_not_entire->buffer(already_read), head->len);
-        data_block->length = head->len;
+        if (_logic->try_cut_through(_recv_not_entire, _recv_not_entire->buffer(already_read), head))
+        {
+            _recv_donated = true;
+            already_read += head.len;
+        }
+        else
+        {
+            data_block->reserve(head.len);
+            protocol_head::unpack_msg(data_block->buffer(), _recv_not_entire->buffer(already_read), head.len);
+            data_block->length = head.len;
 
-        already_read += head->len;
+            already_read += head.len;
 
-        do
-        {
-            once_buffer_sptr unwrap_data = TEMP_BUFFER;
-            // 提前预留空间填充包头
-            // avoid coping
-            unwrap_data->offset = _logic->prefix_size();
-            if (UNLIKELY(!_logic->unwrap_received_data(data_block, head, unwrap_data)))
+            do
             {
-                // cannot kick here
-                break;
-            }
+                // the head fit the receive buffer, a longer prefix may still not fit the largest block
+                if (UNLIKELY(_logic->prefix_size() + head.len > slab_buffer::class_capacity(SLAB_CLASS_NUM - 1)))
+                {
+                    LOG("frame too large to unwrap, uid: %u, len: %u", _uuid, (unsigned)head.len);
+                    close(false);
+                    return false;
+                }
 
-            // logic may be modified
+                once_buffer_sptr unwrap_data = TEMP_BUFFER_OF(_logic->prefix_size() + head.len);
+                // 提前预留空间填充包头
+                // avoid coping
+                unwrap_data->offset = _logic->prefix_size();
+                if (UNLIKELY(!_logic->unwrap_received_data(data_block, head, unwrap_data)))
+                {
+                    // cannot kick here
+                    break;
+                }
 
-            if (UNLIKELY(!_logic->try_copy_to_storage(unwrap_data, head)))
-            {
-                auto self(shared_from_this());
-                _timer.expires_from_now(std::chrono::milliseconds(100));
-                _timer.async_wait([this, self](asio::error_code ec) {
-                    if (UNLIKELY(ec))
-                    {
-                        LOG("timer error occurred %s", ec.message().c_str());
-                        close(false);
-                        return;
-                    }
-
-                    pick_entire_msgs();
-                });
-
-                return false;
-            }
-        } while (false);
-        
+                // logic may be modified
 
-        _recv_not_entire->length -= already_read;
-        if (_recv_not_entire->length != 0)
-        {
-            std::memmove(_recv_not_entire->buffer(), _recv_not_entire->buffer(already_read), _recv_not_entire->length);
+                if (UNLIKELY(!_logic->try_copy_to_storage(unwrap_data, head)))
+                {
+                    auto self(shared_from_this());
+                    _timer.expires_from_now(std::chrono::milliseconds(100));
+                    _timer.async_wait([this, self](asio::error_code ec) {
+                        if (UNLIKELY(ec))
+                        {
+                            LOG("timer error occurred %s", ec.message().c_str());
+                            close(false);
+                            return;
+                        }
+
+                        pick_entire_msgs();
+                    });
+
+                    return false;
+                }
+            } while (false);
         }
-        else
+
+        // parse in place by advancing the cursor, compaction waits until the tail runs out of room
+        _recv_not_entire->length -= already_read;
+        _recv_not_entire->offset += already_read;
+
+        if (_recv_not_entire->length == 0)
         {
-            _recv_not_entire.reset();
+            if (_recv_donated)
+            {
+                // forwarded payloads keep the old one alive
+                _recv_not_entire.reset();
+                _recv_donated = false;
+            }
+            else
+            {
+                _recv_not_entire->offset = 0;
+            }
         }
 
         return true;
@@ -394,11 +628,80 @@ bool net_middleware::basic_async_session::pick_a_entire_msg(protocol_head::head_
 
 void net_middleware::basic_async_session::pick_entire_msgs()
 {
-    protocol_head::head_sptr head = HEAD_FROM_POOL;
-    once_buffer_sptr tmp_buffer = TEMP_BUFFER;
+    once_buffer_sptr tmp_buffer = TEMP_BUFFER_OF(0); // grows to the largest frame of this read
 
-    while (pick_a_entire_msg(head, tmp_buffer))
+    while (pick_a_entire_msg(tmp_buffer))
     { }
 
     async_recv_loop();
 }
+
+bool net_middleware::basic_async_session::fit_recv_buffer()
+{
+    size_t length = _recv_not_entire->length;
+
+    // bytes still missing before the pending frame is complete
+    size_t pending_left = PROTO_HEAD_SIZE - length;
+    if (length >= PROTO_HEAD_SIZE)
+    {
+        protocol_head pending = protocol_head::decode(_recv_not_entire->buffer());
+        pending_left = PROTO_HEAD_SIZE + pending.len - length;
+    }
+
+    size_t need = length + pending_left;
+    if (UNLIKELY(need > slab_buffer::class_capacity(SLAB_CLASS_NUM - 1)))
+    {
+        LOG("frame larger than any receive buffer, need: %llu", (unsigned long long)need);
+        close(false);
+        return false;
+    }
+
+    // mostly small frames lately, let the next drained buffer drop to a smaller class
+    if (_recv_reads >= RECV_SHRINK_READS)
+    {
+        size_t fit = _recv_high_water * 2 > RECV_INITIAL_SIZE ? _recv_high_water * 2 : RECV_INITIAL_SIZE;
+        _recv_size_hint = fit < _recv_size_hint ? fit : _recv_size_hint;
+        _recv_reads = 0;
+        _recv_high_water = 0;
+    }
+
+    if (length == 0 && !_recv_donated && _recv_size_hint < _recv_not_entire->capacity())
+    {
+        _recv_not_entire->reset(_recv_size_hint);
+        return true;
+    }
+
+    size_t capacity = _recv_not_entire->capacity();
+    size_t room = _recv_not_entire->available_capacity() - length;
+    if (room >= pending_left && room >= capacity / 4)
+    {
+        return true;
+    }
+
+    // only the unparsed tail moves, at most one partial frame
+    if (_recv_donated)
+    {
+        // forwarded payloads still point into the parsed part
+        once_buffer_sptr fresh = TEMP_BUFFER_OF(need > _recv_size_hint ? need : _recv_size_hint);
+        std::memcpy(fresh->buffer(), _recv_not_entire->buffer(), length);
+        fresh->length = length;
+
+        _recv_not_entire = fresh;
+        _recv_donated = false;
+    }
+    else
+    {
+        if (_recv_not_entire->offset != 0)
+        {
+            std::memmove(_recv_not_entire->origin_buffer(), _recv_not_entire->buffer(), length);
+            _recv_not_entire->offset = 0;
+        }
+
+        // a frame larger than the current class
+        _recv_not_entire->reserve(need);
+    }
+
+    _recv_size_hint = _recv_not_entire->capacity() > _recv_size_hint ? _recv_not_entire->capacity() : _recv_size_hint;
+
+    return true;
+}
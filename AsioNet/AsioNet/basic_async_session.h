@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <thread>
+#include <deque>
+#include <vector>
 #include <asio.hpp>
 
 #include "async_job.h"
@@ -27,7 +29,7 @@ namespace net_middleware
 
             TO_CLOSE, // actively called shutdown send to close
 
-            CLOSE_DONE, // recv RST || recv FD_CLOSED || timeout , then call close, after which managers will destroy this session
+            CLOSE_DONE, // recv RST || recv FD_CLOSED || timeout , then call close, the close handler tells the manager
         };
 #pragma endregion
         
@@ -59,11 +61,28 @@ namespace net_middleware
 
         inline session_uid get_uuid() { return _uuid; }
 
+        // handed out by the proxy's session_registry, 0 until then
+        inline void set_uuid(session_uid uid) { _uuid = uid; }
+
+        // runs once in strand when the session reaches CLOSE_DONE, set it before the session starts
+        inline void set_close_handler(std::function<void(const std::shared_ptr<basic_async_session>&)> handler) { _close_handler = std::move(handler); }
+
         inline StateSocket get_state() { return _state; }
 
-#pragma endregion
-        void generate_uuid();
+        // sessions sharing a strand share its thread, work posted there is serialized with theirs
+        inline asio::io_context::strand& strand_to_run() { return _job_agent->strand_to_run(); }
+
+        // bytes allowed to wait in the outbound queue before the peer is treated as too slow
+        inline void set_send_queue_cap(size_t cap) { _send_queue_cap = cap; }
+
+        // hold small frames until threshold bytes are queued or max_delay passed, zero delay disables it
+        inline void set_send_cork(size_t threshold, const std::chrono::milliseconds& max_delay)
+        {
+            _cork_threshold = threshold;
+            _cork_delay = max_delay;
+        }
 
+#pragma endregion
         void init_options();
 
         void async_connect(const tcp::endpoint& ep, std::function<void()> cb = nullptr);
@@ -72,8 +91,18 @@ namespace net_middleware
 
         void async_send(once_buffer_sptr tmp_buffer, std::function<void()> cb = nullptr);
 
+        // tmp_buffer is a state snapshot behind its channel, the logic may send a delta instead
+        void async_send_state(once_buffer_sptr tmp_buffer);
+
         void async_send_multi(tiny_buffer_sptr head, once_buffer_sptr msg, std::function<void()> cb = nullptr);
 
+        // payload lives in holder (another session's receive buffer), sealed by this session's logic
+        void async_send_cut_through(tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len);
+
+        // tmp_buffer was already compressed and encrypted for this session, only the head is left to write.
+        // must be called in strand
+        void send_encrypted(once_buffer_sptr tmp_buffer, bool compressed);
+
         uint32_t get_remote_ip();
 
         // @param elegantly: wait remote confirm to close
@@ -88,13 +117,40 @@ namespace net_middleware
         void start_tick(const std::chrono::milliseconds& interval, const std::chrono::milliseconds& timeout);
 
     private:
+        // one piece of an outbound frame, holder keeps the memory alive until written
+        struct send_segment
+        {
+            parallel_core::AnyPoolHandle holder;
+            unsigned char* data;
+            size_t length;
+            std::function<void()> cb; // only set on the last segment of a frame
+        };
+
+        // must be called in strand
+        bool reserve_send_queue(size_t length);
+
+        void enqueue_segment(parallel_core::AnyPoolHandle holder, unsigned char* data, size_t length, std::function<void()> cb);
+
+        // flush now or leave the frame corked, frame points to the head just queued
+        void schedule_send_queue(unsigned char* frame);
+
+        // keep one write in flight, gather everything queued into it
+        void flush_send_queue();
+
+        // pop written segments, resume a partial one
+        void consume_send_queue(size_t length);
+
         void fixed_tick();
 
         // tcp application layer protocol
-        bool pick_a_entire_msg(protocol_head::head_sptr head, once_buffer_sptr data_block);
+        bool pick_a_entire_msg(once_buffer_sptr data_block);
 
         void pick_entire_msgs();
 
+        // compact, grow or shrink the receive buffer before the next read
+        // @return false if the pending frame can never fit
+        bool fit_recv_buffer();
+
         void tick_alive();
 
         void update_recv_time();
@@ -119,6 +175,10 @@ namespace net_middleware
         StateSocket _state;
 
         once_buffer_sptr _recv_not_entire;
+        bool _recv_donated; // _recv_not_entire is shared with cut-through sends, never write over parsed bytes
+        size_t _recv_size_hint; // size class the next receive buffer starts with
+        size_t _recv_reads;
+        size_t _recv_high_water; // most bytes pending after a read since the last shrink check
 
         asio::steady_timer _timer;
 
@@ -133,5 +193,18 @@ namespace net_middleware
         std::shared_ptr<session_logic_interface> _logic;
 
         uint32_t _uuid;
+
+        std::function<void(const std::shared_ptr<basic_async_session>&)> _close_handler;
+
+        std::deque<send_segment> _send_queue;
+        std::vector<asio::const_buffer> _send_gather;
+        size_t _send_queue_bytes;
+        size_t _send_queue_cap;
+        bool _send_in_flight;
+
+        asio::steady_timer _cork_timer;
+        bool _cork_timer_armed;
+        size_t _cork_threshold;
+        std::chrono::milliseconds _cork_delay;
     };
 }
\ No newline at end of file
@@ -31,18 +31,18 @@ namespace net_middleware
 			while (_read_offset > PROTO_HEAD_SIZE)
 			{
 				// check head structure
-				auto head = protocol_head::unpack_head(_recv_buffer->buffer);
-				if (head->len > (_read_offset - PROTO_HEAD_SIZE))
+				protocol_head head = protocol_head::decode(_recv_buffer->buffer);
+				if (head.len > (_read_offset - PROTO_HEAD_SIZE))
 				{
 					// things left in net link
 					break;
 				}
 				else
 				{
-					cb(&(_recv_buffer->buffer[PROTO_HEAD_SIZE]), head->len);
+					cb(&(_recv_buffer->buffer[PROTO_HEAD_SIZE]), head.len);
 
-					size_t unpack_left = _read_offset - (head->len + PROTO_HEAD_SIZE);
-					std::memmove(_recv_buffer->buffer, &(_recv_buffer->buffer[(head->len + PROTO_HEAD_SIZE)]), unpack_left);
+					size_t unpack_left = _read_offset - (head.len + PROTO_HEAD_SIZE);
+					std::memmove(_recv_buffer->buffer, &(_recv_buffer->buffer[(head.len + PROTO_HEAD_SIZE)]), unpack_left);
 
 					_read_offset = unpack_left;
 				}
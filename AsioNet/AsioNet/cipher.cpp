@@ -0,0 +1,531 @@
+#include "cipher.hpp"
+#include "NetUtils.hpp"
+#include <cstring>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CIPHER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define CIPHER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CIPHER_TARGET(isa)
+#endif
+
+namespace
+{
+    struct cpu_features
+    {
+        bool sse2;
+        bool avx2;
+        bool aes;
+
+        cpu_features() :
+            sse2(false),
+            avx2(false),
+            aes(false)
+        {
+#ifdef CIPHER_X86
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            int max_leaf = info[0];
+
+            __cpuid(info, 1);
+            sse2 = (info[3] & (1 << 26)) != 0;
+            aes = (info[2] & (1 << 25)) != 0;
+            bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+            if (max_leaf >= 7 && os_avx)
+            {
+                __cpuidex(info, 7, 0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+            }
+#else
+            unsigned int eax, ebx, ecx, edx;
+            if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            {
+                sse2 = (edx & bit_SSE2) != 0;
+                aes = (ecx & bit_AES) != 0;
+            }
+
+            __builtin_cpu_init();
+            avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+#endif
+        }
+    };
+
+    const cpu_features& cpu()
+    {
+        static cpu_features features;
+        return features;
+    }
+
+#pragma region chacha20
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_QUARTER(a, b, c, d) \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 16); \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 12); \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 8); \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 7);
+
+    void chacha20_block(const uint32_t* state, unsigned char* out)
+    {
+        uint32_t x[16];
+        std::memcpy(x, state, sizeof(x));
+
+        for (int i = 0; i < 10; ++i)
+        {
+            CHACHA_QUARTER(x[0], x[4], x[8], x[12]);
+            CHACHA_QUARTER(x[1], x[5], x[9], x[13]);
+            CHACHA_QUARTER(x[2], x[6], x[10], x[14]);
+            CHACHA_QUARTER(x[3], x[7], x[11], x[15]);
+            CHACHA_QUARTER(x[0], x[5], x[10], x[15]);
+            CHACHA_QUARTER(x[1], x[6], x[11], x[12]);
+            CHACHA_QUARTER(x[2], x[7], x[8], x[13]);
+            CHACHA_QUARTER(x[3], x[4], x[9], x[14]);
+        }
+
+        for (int i = 0; i < 16; ++i)
+            write_uint32_le(out + i * 4, x[i] + state[i]);
+    }
+
+#ifdef CIPHER_X86
+    // vertical layout: vector i holds state word i of every block, lane j belongs to block j
+#define CHACHA_VQUARTER(a, b, c, d, ADD, XOR, ROTL) \
+    a = ADD(a, b); d = XOR(d, a); d = ROTL(d, 16); \
+    c = ADD(c, d); b = XOR(b, c); b = ROTL(b, 12); \
+    a = ADD(a, b); d = XOR(d, a); d = ROTL(d, 8); \
+    c = ADD(c, d); b = XOR(b, c); b = ROTL(b, 7);
+
+#define CHACHA_VROUNDS(x, ADD, XOR, ROTL) \
+    for (int r = 0; r < 10; ++r) \
+    { \
+        CHACHA_VQUARTER(x[0], x[4], x[8], x[12], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[1], x[5], x[9], x[13], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[2], x[6], x[10], x[14], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[3], x[7], x[11], x[15], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[0], x[5], x[10], x[15], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[1], x[6], x[11], x[12], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[2], x[7], x[8], x[13], ADD, XOR, ROTL); \
+        CHACHA_VQUARTER(x[3], x[4], x[9], x[14], ADD, XOR, ROTL); \
+    }
+
+#define SSE_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+// 16 and 8 bit rotations are byte shuffles on avx2
+#define AVX_ROTL(v, n) ((n) == 16 ? _mm256_shuffle_epi8(v, rot16) : (n) == 8 ? _mm256_shuffle_epi8(v, rot8) : \
+    _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n))))
+
+    // 4 blocks, counter must not wrap inside the batch
+    CIPHER_TARGET("sse2")
+    void chacha20_blocks_sse2(const uint32_t* state, unsigned char* out)
+    {
+        const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+
+        // the input words are rebuilt from state at the end, keeping them would spill x
+        __m128i x[16];
+        for (int i = 0; i < 16; ++i)
+            x[i] = _mm_set1_epi32((int)state[i]);
+        x[12] = _mm_add_epi32(x[12], lanes);
+
+        CHACHA_VROUNDS(x, _mm_add_epi32, _mm_xor_si128, SSE_ROTL);
+        x[12] = _mm_add_epi32(x[12], lanes);
+
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128i a = _mm_add_epi32(x[i], _mm_set1_epi32((int)state[i]));
+            __m128i b = _mm_add_epi32(x[i + 1], _mm_set1_epi32((int)state[i + 1]));
+            __m128i c = _mm_add_epi32(x[i + 2], _mm_set1_epi32((int)state[i + 2]));
+            __m128i d = _mm_add_epi32(x[i + 3], _mm_set1_epi32((int)state[i + 3]));
+
+            // 4x4 transpose, row j becomes words i..i+3 of block j
+            __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+            __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+            __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+            __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+
+            _mm_storeu_si128((__m128i*)(out + 0 * 64 + i * 4), _mm_unpacklo_epi64(ab_lo, cd_lo));
+            _mm_storeu_si128((__m128i*)(out + 1 * 64 + i * 4), _mm_unpackhi_epi64(ab_lo, cd_lo));
+            _mm_storeu_si128((__m128i*)(out + 2 * 64 + i * 4), _mm_unpacklo_epi64(ab_hi, cd_hi));
+            _mm_storeu_si128((__m128i*)(out + 3 * 64 + i * 4), _mm_unpackhi_epi64(ab_hi, cd_hi));
+        }
+    }
+
+    // 8 blocks, counter must not wrap inside the batch
+    CIPHER_TARGET("avx2")
+    void chacha20_blocks_avx2(const uint32_t* state, unsigned char* out)
+    {
+        const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+            13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+        const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+            14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+
+        const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+        // the input words are rebuilt from state at the end, keeping them would spill x
+        __m256i x[16];
+        for (int i = 0; i < 16; ++i)
+            x[i] = _mm256_set1_epi32((int)state[i]);
+        x[12] = _mm256_add_epi32(x[12], lanes);
+
+        CHACHA_VROUNDS(x, _mm256_add_epi32, _mm256_xor_si256, AVX_ROTL);
+        x[12] = _mm256_add_epi32(x[12], lanes);
+
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m256i a = _mm256_add_epi32(x[i], _mm256_set1_epi32((int)state[i]));
+            __m256i b = _mm256_add_epi32(x[i + 1], _mm256_set1_epi32((int)state[i + 1]));
+            __m256i c = _mm256_add_epi32(x[i + 2], _mm256_set1_epi32((int)state[i + 2]));
+            __m256i d = _mm256_add_epi32(x[i + 3], _mm256_set1_epi32((int)state[i + 3]));
+
+            // unpacks stay inside 128 bit halves: the low half transposes blocks 0..3, the high one 4..7
+            __m256i ab_lo = _mm256_unpacklo_epi32(a, b);
+            __m256i ab_hi = _mm256_unpackhi_epi32(a, b);
+            __m256i cd_lo = _mm256_unpacklo_epi32(c, d);
+            __m256i cd_hi = _mm256_unpackhi_epi32(c, d);
+
+            __m256i rows[4] = {
+                _mm256_unpacklo_epi64(ab_lo, cd_lo),
+                _mm256_unpackhi_epi64(ab_lo, cd_lo),
+                _mm256_unpacklo_epi64(ab_hi, cd_hi),
+                _mm256_unpackhi_epi64(ab_hi, cd_hi)
+            };
+
+            for (int j = 0; j < 4; ++j)
+            {
+                _mm_storeu_si128((__m128i*)(out + j * 64 + i * 4), _mm256_castsi256_si128(rows[j]));
+                _mm_storeu_si128((__m128i*)(out + (j + 4) * 64 + i * 4), _mm256_extracti128_si256(rows[j], 1));
+            }
+        }
+    }
+#endif
+#pragma endregion
+
+#pragma region aes
+#ifdef CIPHER_X86
+#define AES_EXPAND(rk, i, rcon) \
+    { \
+        __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], rcon), 0xff); \
+        __m128i key = rk[i - 1]; \
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4)); \
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4)); \
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4)); \
+        rk[i] = _mm_xor_si128(key, assist); \
+    }
+
+    CIPHER_TARGET("aes,sse2")
+    void aes128_expand(const unsigned char* key, unsigned char* round_keys)
+    {
+        __m128i rk[11];
+        rk[0] = _mm_loadu_si128((const __m128i*)key);
+        AES_EXPAND(rk, 1, 0x01);
+        AES_EXPAND(rk, 2, 0x02);
+        AES_EXPAND(rk, 3, 0x04);
+        AES_EXPAND(rk, 4, 0x08);
+        AES_EXPAND(rk, 5, 0x10);
+        AES_EXPAND(rk, 6, 0x20);
+        AES_EXPAND(rk, 7, 0x40);
+        AES_EXPAND(rk, 8, 0x80);
+        AES_EXPAND(rk, 9, 0x1b);
+        AES_EXPAND(rk, 10, 0x36);
+
+        for (int i = 0; i < 11; ++i)
+            _mm_storeu_si128((__m128i*)(round_keys + i * 16), rk[i]);
+    }
+
+    inline uint64_t byte_swap_64(uint64_t v)
+    {
+        v = ((v & 0x00ff00ff00ff00ffull) << 8) | ((v >> 8) & 0x00ff00ff00ff00ffull);
+        v = ((v & 0x0000ffff0000ffffull) << 16) | ((v >> 16) & 0x0000ffff0000ffffull);
+        return (v << 32) | (v >> 32);
+    }
+
+    // count counter blocks, nonce(8) | big endian counter(8), encrypted into out,
+    // 8 at a time to keep the aesenc pipeline full
+    CIPHER_TARGET("aes,sse2")
+    void aes128_ctr_blocks(const unsigned char* round_keys, const unsigned char* nonce, uint64_t counter, unsigned char* out, size_t count)
+    {
+        __m128i rk[11];
+        for (int i = 0; i < 11; ++i)
+            rk[i] = _mm_loadu_si128((const __m128i*)(round_keys + i * 16));
+
+        uint64_t nonce_word;
+        std::memcpy(&nonce_word, nonce, sizeof(nonce_word));
+
+        for (size_t n = 0; n + 8 <= count; n += 8)
+        {
+            // spelled out so the 8 blocks stay in registers
+#define AES_CTR_BLOCK(j) _mm_xor_si128(_mm_set_epi64x((long long)byte_swap_64(counter + n + j), (long long)nonce_word), rk[0])
+            __m128i b0 = AES_CTR_BLOCK(0), b1 = AES_CTR_BLOCK(1), b2 = AES_CTR_BLOCK(2), b3 = AES_CTR_BLOCK(3);
+            __m128i b4 = AES_CTR_BLOCK(4), b5 = AES_CTR_BLOCK(5), b6 = AES_CTR_BLOCK(6), b7 = AES_CTR_BLOCK(7);
+#undef AES_CTR_BLOCK
+
+            for (int r = 1; r < 10; ++r)
+            {
+                b0 = _mm_aesenc_si128(b0, rk[r]);
+                b1 = _mm_aesenc_si128(b1, rk[r]);
+                b2 = _mm_aesenc_si128(b2, rk[r]);
+                b3 = _mm_aesenc_si128(b3, rk[r]);
+                b4 = _mm_aesenc_si128(b4, rk[r]);
+                b5 = _mm_aesenc_si128(b5, rk[r]);
+                b6 = _mm_aesenc_si128(b6, rk[r]);
+                b7 = _mm_aesenc_si128(b7, rk[r]);
+            }
+
+            _mm_storeu_si128((__m128i*)(out + (n + 0) * 16), _mm_aesenclast_si128(b0, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 1) * 16), _mm_aesenclast_si128(b1, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 2) * 16), _mm_aesenclast_si128(b2, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 3) * 16), _mm_aesenclast_si128(b3, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 4) * 16), _mm_aesenclast_si128(b4, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 5) * 16), _mm_aesenclast_si128(b5, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 6) * 16), _mm_aesenclast_si128(b6, rk[10]));
+            _mm_storeu_si128((__m128i*)(out + (n + 7) * 16), _mm_aesenclast_si128(b7, rk[10]));
+        }
+    }
+#endif
+#pragma endregion
+}
+
+void net_middleware::stream_cipher::crypt(unsigned char* data, size_t len)
+{
+    while (len > 0)
+    {
+        if (UNLIKELY(_stream_pos == CIPHER_STREAM_BATCH))
+        {
+            refill();
+            _stream_pos = 0;
+        }
+
+        size_t n = CIPHER_STREAM_BATCH - _stream_pos;
+        if (n > len)
+            n = len;
+
+        // word at a time, data has no alignment to speak of
+        const unsigned char* ks = _stream + _stream_pos;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            uint64_t d, k;
+            std::memcpy(&d, data + i, 8);
+            std::memcpy(&k, ks + i, 8);
+            d ^= k;
+            std::memcpy(data + i, &d, 8);
+        }
+
+        for (; i < n; ++i)
+            data[i] ^= ks[i];
+
+        data += n;
+        len -= n;
+        _stream_pos += n;
+    }
+}
+
+net_middleware::chacha20_cipher::chacha20_cipher(const unsigned char* key, CipherDirection direction)
+{
+    // "expand 32-byte k"
+    _state[0] = 0x61707865;
+    _state[1] = 0x3320646e;
+    _state[2] = 0x79622d32;
+    _state[3] = 0x6b206574;
+
+    for (int i = 0; i < 8; ++i)
+        _state[4 + i] = read_uint32_le(key + i * 4);
+
+    // block counter, then the nonce: direction and the high word of the counter
+    _state[12] = 0;
+    _state[13] = (uint32_t)direction;
+    _state[14] = 0;
+    _state[15] = 0;
+}
+
+void net_middleware::chacha20_cipher::seek(uint64_t block)
+{
+    _state[12] = (uint32_t)block;
+    _state[14] = (uint32_t)(block >> 32);
+    _stream_pos = CIPHER_STREAM_BATCH;
+}
+
+void net_middleware::chacha20_cipher::refill()
+{
+    const size_t blocks = CIPHER_STREAM_BATCH / 64;
+
+#ifdef CIPHER_X86
+    // the vector kernels add lane numbers to word 12 only, leave a wrapping batch to the scalar one
+    if (LIKELY(_state[12] <= 0xFFFFFFFFu - blocks))
+    {
+        if (cpu().avx2)
+        {
+            for (size_t i = 0; i < blocks; i += 8)
+            {
+                chacha20_blocks_avx2(_state, _stream + i * 64);
+                _state[12] += 8;
+            }
+
+            return;
+        }
+
+        if (cpu().sse2)
+        {
+            for (size_t i = 0; i < blocks; i += 4)
+            {
+                chacha20_blocks_sse2(_state, _stream + i * 64);
+                _state[12] += 4;
+            }
+
+            return;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        chacha20_block(_state, _stream + i * 64);
+        if (++_state[12] == 0)
+            ++_state[14];
+    }
+}
+
+net_middleware::aes128_ctr_cipher::aes128_ctr_cipher(const unsigned char* key, CipherDirection direction) :
+    _counter(0)
+{
+    std::memset(_nonce, 0, sizeof(_nonce));
+    _nonce[0] = (unsigned char)direction;
+
+#ifdef CIPHER_X86
+    if (cpu().aes)
+    {
+        aes128_expand(key, _round_keys);
+        return;
+    }
+#endif
+
+    assert(false && "aes-ni is required, cipher_factory should not have chosen AES_128_CTR");
+    std::memset(_round_keys, 0, sizeof(_round_keys));
+}
+
+void net_middleware::aes128_ctr_cipher::refill()
+{
+    const size_t blocks = CIPHER_STREAM_BATCH / 16;
+
+#ifdef CIPHER_X86
+    if (LIKELY(cpu().aes))
+    {
+        aes128_ctr_blocks(_round_keys, _nonce, _counter, _stream, blocks);
+        _counter += blocks;
+        return;
+    }
+#endif
+
+    // never reached through cipher_factory, fail closed rather than send the counters in clear
+    abort();
+}
+
+bool net_middleware::cipher_kernels::has_sse2()
+{
+    return cpu().sse2;
+}
+
+bool net_middleware::cipher_kernels::has_avx2()
+{
+    return cpu().avx2;
+}
+
+bool net_middleware::cipher_kernels::has_aes()
+{
+    return cpu().aes;
+}
+
+void net_middleware::cipher_kernels::chacha20_block(const uint32_t* state, unsigned char* out)
+{
+    ::chacha20_block(state, out);
+}
+
+void net_middleware::cipher_kernels::chacha20_blocks_sse2(const uint32_t* state, unsigned char* out)
+{
+#ifdef CIPHER_X86
+    assert(cpu().sse2);
+    ::chacha20_blocks_sse2(state, out);
+#else
+    assert(false && "no sse2 kernel in this build");
+#endif
+}
+
+void net_middleware::cipher_kernels::chacha20_blocks_avx2(const uint32_t* state, unsigned char* out)
+{
+#ifdef CIPHER_X86
+    assert(cpu().avx2);
+    ::chacha20_blocks_avx2(state, out);
+#else
+    assert(false && "no avx2 kernel in this build");
+#endif
+}
+
+void net_middleware::cipher_kernels::aes128_expand(const unsigned char* key, unsigned char* round_keys)
+{
+#ifdef CIPHER_X86
+    assert(cpu().aes);
+    ::aes128_expand(key, round_keys);
+#else
+    assert(false && "no aes-ni kernel in this build");
+#endif
+}
+
+void net_middleware::cipher_kernels::aes128_ctr_blocks(const unsigned char* round_keys, const unsigned char* nonce, uint64_t counter, unsigned char* out, size_t count)
+{
+#ifdef CIPHER_X86
+    assert(cpu().aes && count % 8 == 0);
+    ::aes128_ctr_blocks(round_keys, nonce, counter, out, count);
+#else
+    assert(false && "no aes-ni kernel in this build");
+#endif
+}
+
+unsigned char net_middleware::cipher_factory::supported_suites()
+{
+    unsigned char suites = CIPHER_SUITE_BIT(CipherSuite::RC4) | CIPHER_SUITE_BIT(CipherSuite::CHACHA20);
+    if (cpu().aes)
+        suites |= CIPHER_SUITE_BIT(CipherSuite::AES_128_CTR);
+
+    return suites;
+}
+
+net_middleware::CipherSuite net_middleware::cipher_factory::choose(unsigned char offered)
+{
+    unsigned char common = offered & supported_suites();
+
+    // aes-ni beats chacha20 wherever both exist, chacha20 beats rc4 everywhere
+    if (common & CIPHER_SUITE_BIT(CipherSuite::AES_128_CTR))
+        return CipherSuite::AES_128_CTR;
+
+    if (common & CIPHER_SUITE_BIT(CipherSuite::CHACHA20))
+        return CipherSuite::CHACHA20;
+
+    return CipherSuite::RC4;
+}
+
+std::unique_ptr<net_middleware::cipher_interface> net_middleware::cipher_factory::create(CipherSuite suite, CipherDirection direction, int E,
+    int rc4_mod, unsigned char* rc4_key, size_t rc4_keylen, int rc4_subtract, rc4_context::Mode rc4_mode,
+    const unsigned char* key)
+{
+    switch (suite)
+    {
+    case CipherSuite::CHACHA20:
+        return std::unique_ptr<cipher_interface>(new chacha20_cipher(key, direction));
+    case CipherSuite::AES_128_CTR:
+        return std::unique_ptr<cipher_interface>(new aes128_ctr_cipher(key, direction));
+    default:
+        return std::unique_ptr<cipher_interface>(new rc4_cipher(rc4_mod, rc4_key, rc4_keylen, rc4_subtract, E, rc4_mode));
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "rc4.hpp"
+
+// key bytes handed to the client along with the rc4 key when a newer suite is negotiated
+#define CIPHER_KEY_LEN 32
+// keystream bytes generated in one go, 8 chacha20 blocks or 32 aes blocks
+#define CIPHER_STREAM_BATCH 512
+
+namespace net_middleware
+{
+    // negotiated in the aaa exchange, values are on the wire
+    enum class CipherSuite : unsigned char
+    {
+        RC4 = 0,
+        CHACHA20 = 1,
+        AES_128_CTR = 2,
+    };
+
+#define CIPHER_SUITE_BIT(suite) ((unsigned char)(1u << (unsigned)(suite)))
+
+    // which way a keystream runs, keeps the two directions of one key apart
+    enum class CipherDirection : unsigned char
+    {
+        CLIENT_TO_PROXY = 0,
+        PROXY_TO_CLIENT = 1,
+    };
+
+    class cipher_interface
+    {
+    public:
+        virtual ~cipher_interface() {}
+
+        virtual CipherSuite get_suite() const = 0;
+
+        // en/decrypt in place
+        virtual void crypt(unsigned char* data, size_t len) = 0;
+    };
+
+    // the legacy suite, every old client speaks it
+    class rc4_cipher : public cipher_interface
+    {
+    public:
+        rc4_cipher(int mod, unsigned char* key, size_t keylen, int subtract, int E, rc4_context::Mode mode)
+        {
+            _ctx.init(mod, key, keylen, subtract, E, mode);
+        }
+
+        virtual CipherSuite get_suite() const final { return CipherSuite::RC4; }
+
+        virtual void crypt(unsigned char* data, size_t len) final { _ctx.crypt(data, len); }
+
+        inline const rc4_context& context() const { return _ctx; }
+
+    private:
+        rc4_context _ctx;
+    };
+
+    // xor stream ciphers, the keystream carries on across messages like rc4 stream mode,
+    // so both ends must see every message of a direction in order
+    class stream_cipher : public cipher_interface
+    {
+    public:
+        stream_cipher() :
+            _stream_pos(CIPHER_STREAM_BATCH)
+        {
+        }
+
+        virtual void crypt(unsigned char* data, size_t len) final;
+
+    protected:
+        // fill _stream with the next CIPHER_STREAM_BATCH keystream bytes
+        virtual void refill() = 0;
+
+    protected:
+        unsigned char _stream[CIPHER_STREAM_BATCH];
+        size_t _stream_pos;
+    };
+
+    // RFC 7539 block function, 4 or 8 blocks at once with SSE2/AVX2
+    class chacha20_cipher : public stream_cipher
+    {
+    public:
+        chacha20_cipher(const unsigned char* key, CipherDirection direction);
+
+        virtual CipherSuite get_suite() const final { return CipherSuite::CHACHA20; }
+
+        // the next byte crypted is the first of 64 byte block `block`, the counter spans words 12 and 14
+        void seek(uint64_t block);
+
+    protected:
+        virtual void refill() final;
+
+    private:
+        uint32_t _state[16];
+    };
+
+    // AES-128 in counter mode on AES-NI, the frame mask already covers integrity so no GCM tag
+    class aes128_ctr_cipher : public stream_cipher
+    {
+    public:
+        aes128_ctr_cipher(const unsigned char* key, CipherDirection direction);
+
+        virtual CipherSuite get_suite() const final { return CipherSuite::AES_128_CTR; }
+
+    protected:
+        virtual void refill() final;
+
+    private:
+        unsigned char _round_keys[11 * 16];
+        unsigned char _nonce[8];
+        uint64_t _counter;
+    };
+
+    // the kernels behind the suites on their own, so each can be held against the published vectors
+    // and the vector ones against chacha20_block
+    class cipher_kernels
+    {
+    public:
+        static bool has_sse2();
+
+        static bool has_avx2();
+
+        static bool has_aes();
+
+        // one block of state, the counter is not advanced
+        static void chacha20_block(const uint32_t* state, unsigned char* out);
+
+        // 4 or 8 blocks from counter state[12] on, it must not wrap inside them. only if has_sse2 / has_avx2
+        static void chacha20_blocks_sse2(const uint32_t* state, unsigned char* out);
+
+        static void chacha20_blocks_avx2(const uint32_t* state, unsigned char* out);
+
+        // only if has_aes, count a multiple of 8
+        static void aes128_expand(const unsigned char* key, unsigned char* round_keys);
+
+        static void aes128_ctr_blocks(const unsigned char* round_keys, const unsigned char* nonce, uint64_t counter, unsigned char* out, size_t count);
+    };
+
+    class cipher_factory
+    {
+    public:
+        // suites this build can run on this cpu, as CIPHER_SUITE_BIT flags
+        static unsigned char supported_suites();
+
+        // the fastest suite both ends support, RC4 if the client offered nothing
+        static CipherSuite choose(unsigned char offered);
+
+        // @param rc4_* only used by CipherSuite::RC4
+        // @param key CIPHER_KEY_LEN bytes, only used by the other suites
+        static std::unique_ptr<cipher_interface> create(CipherSuite suite, CipherDirection direction, int E,
+            int rc4_mod, unsigned char* rc4_key, size_t rc4_keylen, int rc4_subtract, rc4_context::Mode rc4_mode,
+            const unsigned char* key);
+    };
+}
@@ -3,8 +3,10 @@
 #include "proto_mask.hpp"
 #include "protocol.hpp"
 #include "rc4.hpp"
-#include "compression/decompress.hpp"
-#include "compression/compress.hpp"
+#include "compression/zlib_context.hpp"
+#include "compression/lz_codec.h"
+#include "compression/xor_delta.h"
+#include "compress_policy.h"
 #include "basic_async_session.h"
 #include "proxy_manager.h"
 
@@ -13,111 +15,273 @@ void net_middleware::client_session_logic::apply_session(std::weak_ptr<basic_asy
     _session_holder = session_holder;
 }
 
-bool net_middleware::client_session_logic::unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block)
+void net_middleware::client_session_logic::close_session()
+{
+    auto session = _session_holder.lock();
+    if (session)
+    {
+        session->close(false);
+    }
+}
+
+bool net_middleware::client_session_logic::unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block)
 {
     // check seq
-    if (UNLIKELY(head->seq != ++_seq))
+    if (UNLIKELY(head.seq != ++_seq))
     {
-        LOG("seq error, maybe it's hacked; remote is %d, mine is %d", head->seq, _seq);
+        LOG("seq error, maybe it's hacked; remote is %d, mine is %d", head.seq, _seq);
+        if (is_keystream_continuous())
+        {
+            close_session();
+        }
 
         return false;
     }
 
     // check mask
-    if (UNLIKELY(0 != net_middleware::proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len)))
+    if (UNLIKELY(0 != head.mask_of(buffer->buffer(), head.len)))
     {
         LOG("check mask failed, maybe it's hacked");
+        if (is_keystream_continuous())
+        {
+            close_session();
+        }
 
         return false;
     }
 
-    if (head->len == 0)
+    if (head.len == 0)
     {
         return true;
     }
 
     // decrypt
-    rc4::rc4_crypt(
-        _rc4_info.rc4_modvt_,
-        _rc4_info.rc4_key_,
-        RC4_KEY_LEN,
-        buffer->buffer(),
-        head->len,
-        _rc4_info.rc4_subtract_,
-        0
-    );
+    _decryptor->crypt(buffer->buffer(), head.len);
 
     // decompress
-    if (UNLIKELY(head->get_compressed()))
+    if (UNLIKELY(head.get_compressed()))
     {
-        gzip::Decompressor gzip_decompressor;
+        bool inflated = false;
         try
         {
-            gzip_decompressor.decompress(*ret_block, (char*)buffer->buffer(), head->len);
+            if (_inflate_stream)
+            {
+                inflated = _inflate_stream->decompress_flush(*ret_block, buffer->buffer(), head.len);
+            }
+            else if (_rc4_info.compress_format_ == CompressFormat::LZ_BLOCK)
+            {
+                size_t raw_len = lz_codec::frame_raw_length(buffer->buffer(), head.len);
+                ret_block->reserve(ret_block->offset + raw_len);
+                inflated = raw_len > 0 && lz_codec::decompress(buffer->buffer(), head.len, ret_block->buffer());
+                ret_block->length = raw_len;
+            }
+            else
+            {
+                inflated = inflate_context::local(_rc4_info.compress_format_).decompress(*ret_block, buffer->buffer(), head.len, get_dictionary());
+            }
+
+            if (UNLIKELY(!inflated))
+            {
+                LOG("inflate failed, corrupt or truncated payload");
+            }
         }
         catch (std::exception e)
         {
-            LOG("gzip decompress failed %s", e.what());
+            LOG("inflate failed %s", e.what());
+            inflated = false;
+        }
+
+        if (UNLIKELY(!inflated))
+        {
+            // raw deflate has no checksum, a stream out of step would inflate later frames into garbage
+            if (_inflate_stream)
+            {
+                close_session();
+            }
             return false;
         }
     }
+    else
+    {
+        std::memcpy(ret_block->buffer(), buffer->buffer(), head.len);
+        ret_block->length = head.len;
+    }
 
     return true;
 }
 
 void net_middleware::client_session_logic::wrap_to_send_data(once_buffer_sptr& buffer)
 {
-    // compress
-    bool compressed = false;
-    if (buffer->length > K_SIZE_COMPRESS)
-    {
-        auto compress_ret = TEMP_BUFFER;
-        gzip::Compressor gzip_compressor;
-        try
-        {
-            gzip_compressor.compress(*compress_ret, (char*)buffer->buffer(), buffer->length);
+    wrap_payload(buffer, protocol_cmd::Commands_RoutingTransparent);
+}
 
-            if (UNLIKELY(compress_ret->length == 0))
-            {
-                return;
-            }
+void net_middleware::client_session_logic::wrap_encrypted_data(once_buffer_sptr& buffer, bool compressed)
+{
+    seal(buffer, compressed, protocol_cmd::Commands_RoutingTransparent);
+}
 
-            if (LIKELY(compress_ret->length < buffer->length))
-            {
-                buffer = compress_ret;
-                compressed = true;
-            }
-        }
-        catch (std::exception e)
-        {
-            LOG("gzip compress failed %s", e.what());
-            return;
-        }
+void net_middleware::client_session_logic::wrap_state_data(once_buffer_sptr& buffer)
+{
+    if (_rc4_info.delta_)
+    {
+        protocol_cmd cmd = encode_state(buffer);
+        wrap_payload(buffer, cmd);
+        return;
     }
 
-    // encrypt
-    rc4::rc4_crypt(
-        _rc4_info.rc4_modvt_,
-        _rc4_info.rc4_key_,
-        RC4_KEY_LEN,
-        buffer->buffer(),
-        buffer->length,
-        _rc4_info.rc4_subtract_,
-        1
-    );
+    // the client knows no channels, the snapshot moves over them into place behind the head
+    std::memmove(buffer->buffer(), buffer->buffer(sizeof(uint16_t)), buffer->length - sizeof(uint16_t));
+    buffer->length -= sizeof(uint16_t);
+
+    wrap_payload(buffer, protocol_cmd::Commands_RoutingTransparent);
+}
+
+void net_middleware::client_session_logic::wrap_payload(once_buffer_sptr& buffer, protocol_cmd cmd)
+{
+    bool compressed = _deflate_stream ? compress_to_stream(buffer) : compress_to_send(buffer, _rc4_info.compress_format_, get_dictionary(), cmd);
 
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, compressed, _seq);
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), buffer->length);
-    head->mask = inverse_mask;
+    encrypt(buffer->buffer(), buffer->length);
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    seal(buffer, compressed, cmd);
+}
+
+void net_middleware::client_session_logic::seal(once_buffer_sptr& buffer, bool compressed, protocol_cmd cmd)
+{
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)cmd, compressed, _seq);
+    uint16_t inverse_mask = head.mask_of(buffer->buffer(), buffer->length);
+    head.mask = inverse_mask;
+
+    head.encode(buffer->origin_buffer());
     buffer->offset -= PROTO_HEAD_SIZE;
     buffer->length += PROTO_HEAD_SIZE;
 
     assert(buffer->offset == 0 && "offset align error");
 }
 
-bool net_middleware::client_session_logic::try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head)
+net_middleware::protocol_cmd net_middleware::client_session_logic::encode_state(once_buffer_sptr& buffer)
+{
+    uint16_t channel = read_uint16_le(buffer->buffer());
+    const unsigned char* snapshot = buffer->buffer(sizeof(uint16_t));
+    size_t len = buffer->length - sizeof(uint16_t);
+
+    auto iter = _state_bases.find(channel);
+    if (len > K_SIZE_DELTA_BASE_MAX || (iter == _state_bases.end() && _state_bases.size() >= K_DELTA_CHANNELS_MAX))
+    {
+        // sent whole and not kept, the next snapshot on the channel starts over with a RoutingState
+        if (iter != _state_bases.end())
+        {
+            _state_bases.erase(iter);
+        }
+        return protocol_cmd::Commands_RoutingState;
+    }
+
+    if (iter == _state_bases.end())
+    {
+        _state_bases[channel].assign(snapshot, snapshot + len);
+        return protocol_cmd::Commands_RoutingState;
+    }
+
+    // only as much room as would still be a gain over the snapshot
+    std::vector<unsigned char>& base = iter->second;
+    auto delta = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(uint16_t) + len);
+    delta->offset = PROTO_HEAD_SIZE;
+    size_t delta_len = len < 2 ? 0 : xor_delta::encode(base.data(), base.size(), snapshot, len, delta->buffer(sizeof(uint16_t)), len - 1);
+
+    base.assign(snapshot, snapshot + len);
+    if (delta_len == 0)
+    {
+        return protocol_cmd::Commands_RoutingState;
+    }
+
+    write_uint16_le(delta->buffer(), channel);
+    delta->length = sizeof(uint16_t) + delta_len;
+    buffer = delta;
+
+    return protocol_cmd::Commands_RoutingDelta;
+}
+
+const net_middleware::rc4_context* net_middleware::client_session_logic::shared_encryptor() const
+{
+    if (!_encryptor || _encryptor->get_suite() != CipherSuite::RC4)
+    {
+        return NULL;
+    }
+
+    const rc4_context& ctx = static_cast<const rc4_cipher*>(_encryptor.get())->context();
+    return ctx.is_shareable() ? &ctx : NULL;
+}
+
+bool net_middleware::client_session_logic::compress_to_send(once_buffer_sptr& buffer, CompressFormat format, const compress_dictionary* dictionary, protocol_cmd cmd)
+{
+    if (buffer->length <= (dictionary != nullptr ? K_SIZE_COMPRESS_DICT : K_SIZE_COMPRESS))
+    {
+        return false;
+    }
+
+    // already compressed or encrypted blobs, deflate would only burn cpu on them
+    if (!COMPRESS_POLICY->should_compress((uint16_t)cmd, buffer->length))
+    {
+        return false;
+    }
+
+    // deflate writes behind the head's room, and only gets as much room as would still be a gain
+    auto compress_ret = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + buffer->length);
+    compress_ret->offset = PROTO_HEAD_SIZE;
+
+    size_t room = std::min(buffer->length - 1, compress_ret->available_capacity());
+    size_t len = 0;
+    if (format == CompressFormat::LZ_BLOCK)
+    {
+        len = lz_codec::compress(buffer->buffer(), buffer->length, compress_ret->buffer(), room);
+    }
+    else
+    {
+        deflate_context& deflater = deflate_context::local(format);
+        deflater.set_level(COMPRESS_POLICY->level());
+        len = deflater.compress(buffer->buffer(), buffer->length, compress_ret->buffer(), room, dictionary);
+    }
+
+    COMPRESS_POLICY->record((uint16_t)cmd, buffer->length, len);
+    if (len == 0)
+    {
+        return false;
+    }
+
+    compress_ret->length = len;
+    buffer = compress_ret;
+    return true;
+}
+
+bool net_middleware::client_session_logic::compress_to_stream(once_buffer_sptr& buffer)
+{
+    // heartbeats carry nothing, and frames the stream skips never touch the history on either side
+    if (buffer->length == 0 || buffer->length > K_SIZE_STREAM_MAX)
+    {
+        return false;
+    }
+
+    size_t bound = _deflate_stream->flush_bound(buffer->length);
+    auto compress_ret = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + bound);
+    compress_ret->offset = PROTO_HEAD_SIZE;
+
+    size_t len = _deflate_stream->compress_flush(buffer->buffer(), buffer->length, compress_ret->buffer(), bound);
+    if (UNLIKELY(len == 0))
+    {
+        // the peer can't follow the stream any more
+        LOG("deflate stream broken, payload length %d", (int)buffer->length);
+        if (!_session_holder.expired())
+        {
+            _session_holder.lock()->kick();
+        }
+        return false;
+    }
+
+    compress_ret->length = len;
+    buffer = compress_ret;
+    return true;
+}
+
+bool net_middleware::client_session_logic::try_copy_to_storage(once_buffer_sptr data, const protocol_head& /*head*/)
 {
     if (UNLIKELY(_session_holder.expired()))
     {
@@ -133,10 +297,69 @@ bool net_middleware::client_session_logic::try_copy_to_storage(once_buffer_sptr
     return true;
 }
 
+bool net_middleware::client_session_logic::try_cut_through(once_buffer_sptr recv_block, unsigned char* payload, const protocol_head& head)
+{
+    // compressed frames and heartbeats still need the copying path
+    if (!PROXY_MGR->is_cut_through() || head.len == 0 || head.get_compressed())
+    {
+        return false;
+    }
+
+    if (UNLIKELY(head.seq != ++_seq))
+    {
+        LOG("seq error, maybe it's hacked; remote is %d, mine is %d", head.seq, _seq);
+        if (is_keystream_continuous())
+        {
+            close_session();
+        }
+        return true;
+    }
+
+    if (UNLIKELY(0 != head.mask_of(payload, head.len)))
+    {
+        LOG("check mask failed, maybe it's hacked");
+        if (is_keystream_continuous())
+        {
+            close_session();
+        }
+        return true;
+    }
+
+    if (UNLIKELY(_session_holder.expired()))
+    {
+        LOG("unexpected session expired");
+        return true;
+    }
+
+    // decrypt in place, the server session seals the very same bytes
+    _decryptor->crypt(payload, head.len);
+
+    // no headroom in front of the payload for head + uid, send them from a tiny buffer
+    auto head_buffer = TINY_BUFFER;
+    write_uint32(head_buffer->origin_buffer(PROTO_HEAD_SIZE), _session_holder.lock()->get_uuid());
+    head_buffer->length = PROTO_HEAD_SIZE + sizeof(session_uid);
+
+    PROXY_MGR->forward_to_server(_target_uid, head_buffer, recv_block, payload, head.len);
+
+    return true;
+}
+
+void net_middleware::client_session_logic::wrap_cut_through(tiny_buffer_sptr& head_block, unsigned char* payload, size_t len)
+{
+    // never compress here, it would bring the copy back
+    _encryptor->crypt(payload, len);
+
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)len, 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, false, _seq);
+    head.mask = head.mask_of(payload, len);
+
+    head.encode(head_block->origin_buffer());
+    head_block->length = PROTO_HEAD_SIZE;
+}
+
 void net_middleware::client_session_logic::kick_peer()
 {
     auto head_buffer = TINY_BUFFER;
-    auto data_block = TEMP_BUFFER;
+    auto data_block = TEMP_BUFFER_OF(sizeof(session_uid));
 
     if (UNLIKELY(_session_holder.expired()))
     {
@@ -147,11 +370,12 @@ void net_middleware::client_session_logic::kick_peer()
     write_uint32(data_block->buffer() ,_session_holder.lock()->get_uuid());
     data_block->length = sizeof(session_uid);
 
-    auto head = protocol_head::get_a_head(FRAME_KEY, 0, 0, (uint16_t)net_middleware::protocol_cmd::Commands_Kick, false, _seq);
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, data_block->buffer(), data_block->length);
-    head->mask = inverse_mask;
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, 0, 0, (uint16_t)net_middleware::protocol_cmd::Commands_Kick, false, _seq);
+    uint16_t inverse_mask = head.mask_of(data_block->buffer(), data_block->length);
+    head.mask = inverse_mask;
 
-    std::memcpy(head_buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(head_buffer->origin_buffer());
+    head_buffer->length = PROTO_HEAD_SIZE;
 
     PROXY_MGR->send_to_server_multi(_target_uid, head_buffer, data_block);
 }
@@ -159,6 +383,26 @@ void net_middleware::client_session_logic::kick_peer()
 void net_middleware::client_session_logic::inherit_logic(rc4_info rc4_info_, uint32_t seq_, server_info server_info_, session_uid target_uid)
 {
     _rc4_info = rc4_info_;
+
+    // run the key schedules here instead of once per message
+    _decryptor = cipher_factory::create(_rc4_info.cipher_suite_, CipherDirection::CLIENT_TO_PROXY, 0,
+        _rc4_info.rc4_modvt_, _rc4_info.rc4_key_, RC4_KEY_LEN, _rc4_info.rc4_subtract_, _rc4_info.rc4_mode_, _rc4_info.cipher_key_);
+    _encryptor = cipher_factory::create(_rc4_info.cipher_suite_, CipherDirection::PROXY_TO_CLIENT, 1,
+        _rc4_info.rc4_modvt_, _rc4_info.rc4_key_, RC4_KEY_LEN, _rc4_info.rc4_subtract_, _rc4_info.rc4_mode_, _rc4_info.cipher_key_);
+
+    // the logic comes out of a pool, streams and bases of the last client must not carry over
+    if (_rc4_info.compress_format_ == CompressFormat::DEFLATE_STREAM)
+    {
+        _deflate_stream.reset(new deflate_context(CompressFormat::DEFLATE_STREAM, COMPRESS_POLICY->level()));
+        _inflate_stream.reset(new inflate_context(CompressFormat::DEFLATE_STREAM));
+    }
+    else
+    {
+        _deflate_stream.reset();
+        _inflate_stream.reset();
+    }
+    _state_bases.clear();
+
     _seq = seq_;
     _server_info = server_info_;
     _target_uid = target_uid;
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <unordered_map>
+#include <vector>
+
 #include "parallel_core/ThreadSafeObjectPool.h"
 #include "session_logic.h"
 
@@ -15,24 +18,83 @@ namespace net_middleware
 
         virtual SessionType get_session_type() final { return SessionType::CLIENT_PROXY; }
 
-        virtual bool unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block) final;
+        virtual bool unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block) final;
 
         virtual void wrap_to_send_data(once_buffer_sptr& buffer) final;
 
-        virtual bool try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head) final;
+        virtual bool try_copy_to_storage(once_buffer_sptr data, const protocol_head& head) final;
 
         virtual size_t prefix_size() final { return PROTO_HEAD_SIZE + sizeof(session_uid); }
 
         inline SessionType get_target_server_type() { return (SessionType)_server_info.link_type_; }
 
+        inline session_uid get_target_uid() const { return _target_uid; }
+
         virtual void kick_peer() final;
 
+        virtual bool try_cut_through(once_buffer_sptr recv_block, unsigned char* payload, const protocol_head& head) final;
+
+        virtual void wrap_cut_through(tiny_buffer_sptr& head_block, unsigned char* payload, size_t len) final;
+
+        virtual void wrap_encrypted_data(once_buffer_sptr& buffer, bool compressed) final;
+
+        virtual void wrap_state_data(once_buffer_sptr& buffer) final;
+
 #pragma endregion
 
         void inherit_logic(rc4_info rc4_info_, uint32_t seq_, server_info server_info_, session_uid target_uid);
 
+        // the outbound rc4 state if it may be used from other threads, see rc4_context::crypt_multi
+        // @return NULL for stream mode and the other suites
+        const rc4_context* shared_encryptor() const;
+
+        // the encryption step of wrap_to_send_data, must be called in strand unless shared_encryptor() is set
+        inline void encrypt(unsigned char* data, size_t len) { _encryptor->crypt(data, len); }
+
+        inline CompressFormat get_compress_format() const { return _rc4_info.compress_format_; }
+
+        inline const compress_dictionary* get_dictionary() const { return _rc4_info.dictionary_.get(); }
+
+        // the compression step of wrap_to_send_data, buffer is swapped for a compressed copy with
+        // PROTO_HEAD_SIZE headroom if it comes out smaller
+        // @return whether buffer was swapped
+        // @param cmd what compress_policy learns the ratio under
+        static bool compress_to_send(once_buffer_sptr& buffer, CompressFormat format, const compress_dictionary* dictionary, protocol_cmd cmd);
+
+    private:
+        // the stream state can't be trusted any more, the connection has to go
+        void close_session();
+
+        // rc4 stream mode and every other suite carry the keystream on across messages,
+        // a frame dropped before decryption leaves the two ends out of step for good
+        inline bool is_keystream_continuous() const
+        {
+            return _rc4_info.cipher_suite_ != CipherSuite::RC4 || _rc4_info.rc4_mode_ == rc4_context::Mode::STREAM;
+        }
+
+        // compress, encrypt and seal as cmd
+        void wrap_payload(once_buffer_sptr& buffer, protocol_cmd cmd);
+
+        void seal(once_buffer_sptr& buffer, bool compressed, protocol_cmd cmd);
+
+        // buffer is channel(2) | snapshot, swapped for a delta against the channel's base if that is smaller
+        // @return the cmd the frame goes out as
+        protocol_cmd encode_state(once_buffer_sptr& buffer);
+
+        // DEFLATE_STREAM, every frame up to K_SIZE_STREAM_MAX goes through _deflate_stream even if it grows,
+        // the peer's history has to see it
+        bool compress_to_stream(once_buffer_sptr& buffer);
+
     private:
         rc4_info _rc4_info;
+        // client to proxy, proxy to client
+        std::unique_ptr<cipher_interface> _decryptor;
+        std::unique_ptr<cipher_interface> _encryptor;
+        // DEFLATE_STREAM only, outbound and inbound history of the connection
+        std::unique_ptr<deflate_context> _deflate_stream;
+        std::unique_ptr<inflate_context> _inflate_stream;
+        // AAA_OFFER_DELTA only, the last snapshot sent per state channel
+        std::unordered_map<uint16_t, std::vector<unsigned char>> _state_bases;
         uint32_t _seq;
         server_info _server_info;
         session_uid _target_uid;
@@ -0,0 +1,164 @@
+#include "compress_policy.h"
+#include "LogUtils.hpp"
+#include "protocol.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+net_middleware::compress_policy::compress_policy() :
+    _tried(0),
+    _gained(0),
+    _wasted(0),
+    _skipped(0),
+    _probed(0),
+    _bytes_in(0),
+    _bytes_out(0),
+    _fast_level(0),
+    _level_drops(0),
+    _fast(false),
+    _cpu_load(0),
+    _cpu_threshold(0),
+    _session_threads(1),
+    _last_cpu_us(process_cpu_us()),
+    _last_sample(std::chrono::steady_clock::now())
+{
+    for (auto& c : _classes)
+    {
+        c.ratio.store(1024, std::memory_order_relaxed);
+        c.skips.store(0, std::memory_order_relaxed);
+    }
+}
+
+void net_middleware::compress_policy::configure(uint32_t cpu_threshold, uint16_t session_threads)
+{
+    _cpu_threshold = cpu_threshold;
+    _session_threads = session_threads > 0 ? session_threads : 1;
+}
+
+bool net_middleware::compress_policy::should_compress(uint16_t cmd, size_t len)
+{
+    class_stats& c = _classes[class_of(cmd, len)];
+    if (LIKELY(c.ratio.load(std::memory_order_relaxed) < COMPRESS_SKIP_RATIO))
+    {
+        return true;
+    }
+
+    if (c.skips.fetch_add(1, std::memory_order_relaxed) % COMPRESS_PROBE_PERIOD == COMPRESS_PROBE_PERIOD - 1)
+    {
+        _probed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    _skipped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void net_middleware::compress_policy::record(uint16_t cmd, size_t len, size_t compressed_len)
+{
+    size_t out = compressed_len == 0 ? len : compressed_len;
+
+    _tried.fetch_add(1, std::memory_order_relaxed);
+    (compressed_len == 0 ? _wasted : _gained).fetch_add(1, std::memory_order_relaxed);
+    _bytes_in.fetch_add(len, std::memory_order_relaxed);
+    _bytes_out.fetch_add(out, std::memory_order_relaxed);
+    if (_fast.load(std::memory_order_relaxed))
+        _fast_level.fetch_add(1, std::memory_order_relaxed);
+
+    class_stats& c = _classes[class_of(cmd, len)];
+    int32_t sample = (int32_t)((out << 10) / len);
+    int32_t ratio = (int32_t)c.ratio.load(std::memory_order_relaxed);
+    ratio += (sample - ratio) >> COMPRESS_EWMA_SHIFT;
+    c.ratio.store((uint32_t)ratio, std::memory_order_relaxed);
+}
+
+void net_middleware::compress_policy::update_cpu_load()
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t cpu_us = process_cpu_us();
+
+    uint64_t wall_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - _last_sample).count();
+    if (wall_us == 0)
+    {
+        return;
+    }
+
+    uint32_t load = (uint32_t)((cpu_us - _last_cpu_us) * 100 / (wall_us * _session_threads));
+    _cpu_load.store(load, std::memory_order_relaxed);
+    _last_cpu_us = cpu_us;
+    _last_sample = now;
+
+    if (_cpu_threshold == 0)
+    {
+        return;
+    }
+
+    // back to the default level only well below the threshold, or the level would flap
+    bool fast = _fast.load(std::memory_order_relaxed);
+    if (!fast && load > _cpu_threshold)
+    {
+        _fast.store(true, std::memory_order_relaxed);
+        _level_drops.fetch_add(1, std::memory_order_relaxed);
+        LOG("cpu load %u%% above %u%%, compressing at the fastest level", load, _cpu_threshold);
+    }
+    else if (fast && load * 5 < _cpu_threshold * 4)
+    {
+        _fast.store(false, std::memory_order_relaxed);
+        LOG("cpu load %u%% back under %u%%, compressing at the default level", load, _cpu_threshold);
+    }
+}
+
+net_middleware::compress_counters net_middleware::compress_policy::counters() const
+{
+    compress_counters ret;
+    ret.tried = _tried.load(std::memory_order_relaxed);
+    ret.gained = _gained.load(std::memory_order_relaxed);
+    ret.wasted = _wasted.load(std::memory_order_relaxed);
+    ret.skipped = _skipped.load(std::memory_order_relaxed);
+    ret.probed = _probed.load(std::memory_order_relaxed);
+    ret.bytes_in = _bytes_in.load(std::memory_order_relaxed);
+    ret.bytes_out = _bytes_out.load(std::memory_order_relaxed);
+    ret.fast_level = _fast_level.load(std::memory_order_relaxed);
+    ret.level_drops = _level_drops.load(std::memory_order_relaxed);
+    return ret;
+}
+
+uint32_t net_middleware::compress_policy::class_ratio(uint16_t cmd, size_t len) const
+{
+    return _classes[class_of(cmd, len)].ratio.load(std::memory_order_relaxed);
+}
+
+size_t net_middleware::compress_policy::class_of(uint16_t cmd, size_t len)
+{
+    size_t slot = (size_t)(cmd - (uint16_t)protocol_cmd::Commands_LCriticalSI);
+    if (slot >= COMPRESS_CMD_SLOTS)
+        slot = 0;
+
+    size_t bucket = 0;
+    for (size_t bound = 128; bound <= len && bucket < COMPRESS_SIZE_BUCKETS - 1; bound <<= 1)
+        ++bucket;
+
+    return slot * COMPRESS_SIZE_BUCKETS + bucket;
+}
+
+uint64_t net_middleware::compress_policy::process_cpu_us()
+{
+#ifdef _WIN32
+    FILETIME creation_time, exit_time, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel, &user))
+        return 0;
+
+    // 100ns ticks
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
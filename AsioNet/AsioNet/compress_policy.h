@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "compression/config.hpp"
+#include <zlib.h>
+#include "parallel_core/SafeSingleton.h"
+
+// payload size buckets, up to 127 | 128-255 | ... | 16K and up
+#define COMPRESS_SIZE_BUCKETS 9
+// command slots, the protocol_cmd values above Commands_LCriticalSI and one for anything else
+#define COMPRESS_CMD_SLOTS 16
+// a class that keeps more than this of its size, in 1/1024, isn't compressed any more
+#define COMPRESS_SKIP_RATIO 972 // 95%
+// a skipped class is still tried once in this many messages, in case its traffic changes
+#define COMPRESS_PROBE_PERIOD 64
+// weight of a new sample in the rolling ratio, 1 / (1 << shift)
+#define COMPRESS_EWMA_SHIFT 3
+
+namespace net_middleware
+{
+    // what the policy decided, monotonic since start
+    struct compress_counters
+    {
+        uint64_t tried;         // deflate ran
+        uint64_t gained;        // and the result was smaller
+        uint64_t wasted;        // and it was thrown away
+        uint64_t skipped;       // the class doesn't compress, deflate never ran
+        uint64_t probed;        // of tried, re-checks of a skipped class
+        uint64_t bytes_in;      // payload bytes of the tried messages
+        uint64_t bytes_out;     // what went on the wire for them
+        uint64_t fast_level;    // tries at the lowered level
+        uint64_t level_drops;   // times the cpu threshold was crossed
+    };
+
+    // learns per protocol_cmd and size bucket whether deflate pays off, and drops the level to
+    // Z_BEST_SPEED while the session threads are busier than the configured threshold.
+    // called from every session thread, all state is relaxed atomics, a lost update only delays learning
+    class compress_policy : public parallel_core::SafeSingleton<compress_policy>
+    {
+    public:
+        compress_policy();
+
+        // @param cpu_threshold percent of the session threads' time, 0 never lowers the level
+        // @param session_threads threads the load is measured against
+        void configure(uint32_t cpu_threshold, uint16_t session_threads);
+
+        // @return false if deflate should be skipped for this message
+        bool should_compress(uint16_t cmd, size_t len);
+
+        // @param compressed_len 0 if the result was not smaller
+        void record(uint16_t cmd, size_t len, size_t compressed_len);
+
+        // zlib level for the next message
+        inline int level() const { return _fast.load(std::memory_order_relaxed) ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION; }
+
+        // samples the process cpu time, called periodically from one thread
+        void update_cpu_load();
+
+        // percent of the session threads' time at the last update
+        inline uint32_t cpu_load() const { return _cpu_load.load(std::memory_order_relaxed); }
+
+        compress_counters counters() const;
+
+        // rolling ratio of a class in 1/1024, 1024 if nothing was learned yet
+        uint32_t class_ratio(uint16_t cmd, size_t len) const;
+
+    private:
+        static size_t class_of(uint16_t cmd, size_t len);
+
+        static uint64_t process_cpu_us();
+
+    private:
+        struct class_stats
+        {
+            std::atomic<uint32_t> ratio;    // compressed / raw in 1/1024, ewma
+            std::atomic<uint32_t> skips;
+        };
+
+        class_stats _classes[COMPRESS_CMD_SLOTS * COMPRESS_SIZE_BUCKETS];
+
+        std::atomic<uint64_t> _tried;
+        std::atomic<uint64_t> _gained;
+        std::atomic<uint64_t> _wasted;
+        std::atomic<uint64_t> _skipped;
+        std::atomic<uint64_t> _probed;
+        std::atomic<uint64_t> _bytes_in;
+        std::atomic<uint64_t> _bytes_out;
+        std::atomic<uint64_t> _fast_level;
+        std::atomic<uint64_t> _level_drops;
+
+        std::atomic<bool> _fast;
+        std::atomic<uint32_t> _cpu_load;
+
+        // only touched by update_cpu_load
+        uint32_t _cpu_threshold;
+        uint16_t _session_threads;
+        uint64_t _last_cpu_us;
+        std::chrono::steady_clock::time_point _last_sample;
+    };
+
+#define COMPRESS_POLICY net_middleware::compress_policy::instance()
+}
@@ -0,0 +1,328 @@
+#include "lz_codec.h"
+
+#include <cstring>
+
+// the block format's own limits, the decoder relies on them
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5  // the block ends with at least this many literals
+#define LZ_MF_LIMIT 12      // no match starts this close to the end
+#define LZ_MAX_OFFSET 65535
+
+#define LZ_HASH_LOG_MAX 12
+#define LZ_HASH_LOG_MIN 8
+// after this many misses in a row the probe step grows, incompressible data passes quickly
+#define LZ_SKIP_TRIGGER 6
+
+namespace
+{
+    inline uint32_t read32(const unsigned char* p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline uint64_t read64(const unsigned char* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline void write64(unsigned char* p, uint64_t v)
+    {
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    inline uint32_t hash32(uint32_t v, int hash_log)
+    {
+        return (v * 2654435761u) >> (32 - hash_log);
+    }
+
+    inline unsigned trailing_zero_bytes(uint64_t diff)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward64(&idx, diff);
+        return (unsigned)(idx >> 3);
+#else
+        return (unsigned)(__builtin_ctzll(diff) >> 3);
+#endif
+    }
+
+    // common prefix of p and ref, p stops at limit
+    inline size_t match_length(const unsigned char* p, const unsigned char* ref, const unsigned char* limit)
+    {
+        const unsigned char* start = p;
+        while (p + 8 <= limit)
+        {
+            uint64_t diff = read64(p) ^ read64(ref);
+            if (diff != 0)
+                return (size_t)(p - start) + trailing_zero_bytes(diff);
+
+            p += 8;
+            ref += 8;
+        }
+
+        while (p < limit && *p == *ref)
+        {
+            ++p;
+            ++ref;
+        }
+
+        return (size_t)(p - start);
+    }
+
+    // 255 per extension byte, plus the remainder
+    inline unsigned char* write_length(unsigned char* op, size_t len)
+    {
+        while (len >= 255)
+        {
+            *op++ = 255;
+            len -= 255;
+        }
+
+        *op++ = (unsigned char)len;
+        return op;
+    }
+}
+
+size_t net_middleware::lz_codec::compress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    // positions are 16 bit, a table sized to the input keeps the memset cheap for small packets
+    uint16_t table[1 << LZ_HASH_LOG_MAX];
+    int hash_log = LZ_HASH_LOG_MIN;
+    while (hash_log < LZ_HASH_LOG_MAX && ((size_t)1 << hash_log) < len)
+        ++hash_log;
+
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src;
+    const unsigned char* const iend = src + len;
+    const unsigned char* const mflimit = iend - (len >= LZ_MF_LIMIT ? LZ_MF_LIMIT : len);
+    const unsigned char* const match_limit = iend - (len >= LZ_LAST_LITERALS ? LZ_LAST_LITERALS : len);
+    unsigned char* op = dst;
+    unsigned char* const oend = dst + cap;
+
+    if (len > 65536 || len < LZ_MF_LIMIT + 1)
+        goto last_literals;
+
+    std::memset(table, 0, sizeof(uint16_t) << hash_log);
+    ++ip;
+
+    while (true)
+    {
+        const unsigned char* ref;
+
+        // find a match
+        {
+            size_t misses = 1u << LZ_SKIP_TRIGGER;
+            while (true)
+            {
+                size_t step = misses++ >> LZ_SKIP_TRIGGER;
+                if (ip + step > mflimit)
+                    goto last_literals;
+
+                uint32_t seq = read32(ip);
+                uint32_t h = hash32(seq, hash_log);
+                ref = src + table[h];
+                table[h] = (uint16_t)(ip - src);
+
+                if (ref < ip && (size_t)(ip - ref) <= LZ_MAX_OFFSET && read32(ref) == seq)
+                    break;
+
+                ip += step;
+            }
+        }
+
+        // a match often starts a little earlier than the probe that found it
+        while (ip > anchor && ref > src && ip[-1] == ref[-1])
+        {
+            --ip;
+            --ref;
+        }
+
+        size_t literals = (size_t)(ip - anchor);
+        size_t matched = LZ_MIN_MATCH + match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, match_limit);
+
+        // token, literal run, offset, match extension, and the last literals' token
+        if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals + 2 + matched / 255 + 1 + 1)
+            return 0;
+
+        unsigned char* token = op++;
+        if (literals >= 15)
+        {
+            *token = 15 << 4;
+            op = write_length(op, literals - 15);
+        }
+        else
+        {
+            *token = (unsigned char)(literals << 4);
+        }
+
+        std::memcpy(op, anchor, literals);
+        op += literals;
+
+        uint16_t offset = (uint16_t)(ip - ref);
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+
+        size_t extra = matched - LZ_MIN_MATCH;
+        if (extra >= 15)
+        {
+            *token |= 15;
+            op = write_length(op, extra - 15);
+        }
+        else
+        {
+            *token |= (unsigned char)extra;
+        }
+
+        ip += matched;
+        anchor = ip;
+
+        if (ip >= mflimit)
+            break;
+
+        // the position two back is the likeliest start of the next repeat
+        table[hash32(read32(ip - 2), hash_log)] = (uint16_t)(ip - 2 - src);
+    }
+
+last_literals:
+    {
+        size_t literals = (size_t)(iend - anchor);
+        if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals)
+            return 0;
+
+        if (literals >= 15)
+        {
+            *op++ = 15 << 4;
+            op = write_length(op, literals - 15);
+        }
+        else
+        {
+            *op++ = (unsigned char)(literals << 4);
+        }
+
+        if (literals > 0)
+            std::memcpy(op, anchor, literals);
+        op += literals;
+    }
+
+    return (size_t)(op - dst);
+}
+
+bool net_middleware::lz_codec::decompress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t raw_len)
+{
+    const unsigned char* ip = src;
+    const unsigned char* const iend = src + len;
+    unsigned char* op = dst;
+    unsigned char* const oend = dst + raw_len;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+
+        // literals
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            unsigned char s;
+            do
+            {
+                if (ip >= iend)
+                    return false;
+                s = *ip++;
+                literals += s;
+            } while (s == 255);
+        }
+
+        if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals)
+            return false;
+
+        std::memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+
+        size_t matched = token & 15;
+        if (matched == 15)
+        {
+            unsigned char s;
+            do
+            {
+                if (ip >= iend)
+                    return false;
+                s = *ip++;
+                matched += s;
+            } while (s == 255);
+        }
+        matched += LZ_MIN_MATCH;
+
+        if ((size_t)(oend - op) < matched)
+            return false;
+
+        const unsigned char* ref = op - offset;
+        unsigned char* const mend = op + matched;
+        if (offset >= 8 && (size_t)(oend - mend) >= 8)
+        {
+            // 8 bytes at a time may run past the match end, there is room for it
+            while (op < mend)
+            {
+                write64(op, read64(ref));
+                op += 8;
+                ref += 8;
+            }
+            op = mend;
+        }
+        else
+        {
+            // overlapping copy repeats the last offset bytes
+            while (op < mend)
+                *op++ = *ref++;
+        }
+    }
+
+    return op == oend;
+}
+
+size_t net_middleware::lz_codec::compress(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    if (len > 0xFFFF || cap <= LZ_FRAME_PREFIX)
+        return 0;
+
+    size_t block = compress_block(src, len, dst + LZ_FRAME_PREFIX, cap - LZ_FRAME_PREFIX);
+    if (block == 0)
+        return 0;
+
+    dst[0] = (unsigned char)len;
+    dst[1] = (unsigned char)(len >> 8);
+    return LZ_FRAME_PREFIX + block;
+}
+
+size_t net_middleware::lz_codec::frame_raw_length(const unsigned char* src, size_t len)
+{
+    if (len <= LZ_FRAME_PREFIX)
+        return 0;
+
+    return src[0] | ((size_t)src[1] << 8);
+}
+
+bool net_middleware::lz_codec::decompress(const unsigned char* src, size_t len, unsigned char* dst)
+{
+    size_t raw_len = frame_raw_length(src, len);
+    if (raw_len == 0)
+        return false;
+
+    return decompress_block(src + LZ_FRAME_PREFIX, len - LZ_FRAME_PREFIX, dst, raw_len);
+}
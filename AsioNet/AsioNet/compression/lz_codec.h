@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// frame of a CompressFormat::LZ_BLOCK payload: raw length (uint16 little endian) | lz4 block
+#define LZ_FRAME_PREFIX 2
+
+namespace net_middleware
+{
+    // byte oriented LZ77 in the LZ4 block format: token (literal length:4 | match length:4),
+    // literals, 16 bit offset, length extensions in 255 steps. one hash probe per position and
+    // no entropy stage, so it runs at memory speed for a lower ratio than deflate.
+    // any LZ4 block decoder reads what compress_block writes
+    class lz_codec
+    {
+    public:
+        // worst case of compress_block
+        static inline size_t block_bound(size_t len) { return len + len / 255 + 16; }
+
+        // @return bytes written, 0 if they don't fit in cap
+        static size_t compress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t cap);
+
+        // @param raw_len exact size of the decoded data, dst holds that many bytes
+        // @return false on malformed input, never reads or writes out of bounds
+        static bool decompress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t raw_len);
+
+        // LZ_FRAME_PREFIX + compress_block, payloads stay below 64K
+        // @return bytes written, 0 if they don't fit in cap or len doesn't fit the prefix
+        static size_t compress(const unsigned char* src, size_t len, unsigned char* dst, size_t cap);
+
+        // @return the raw length a frame decodes to, 0 if it is too short to be one
+        static size_t frame_raw_length(const unsigned char* src, size_t len);
+
+        // @param dst frame_raw_length(src, len) bytes
+        static bool decompress(const unsigned char* src, size_t len, unsigned char* dst);
+    };
+}
@@ -0,0 +1,149 @@
+#include "xor_delta.h"
+
+#include <cstring>
+
+namespace
+{
+    inline uint64_t read64(const unsigned char* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+}
+
+size_t net_middleware::xor_delta::encode(const unsigned char* base, size_t base_len, const unsigned char* cur, size_t cur_len, unsigned char* dst, size_t cap)
+{
+    if (cur_len > 0xFFFF || cap < XOR_DELTA_PREFIX)
+    {
+        return 0;
+    }
+
+    dst[0] = (unsigned char)cur_len;
+    dst[1] = (unsigned char)(cur_len >> 8);
+
+    unsigned char* op = dst + XOR_DELTA_PREFIX;
+    unsigned char* const oend = dst + cap;
+    size_t common = base_len < cur_len ? base_len : cur_len;
+
+    // past the base the XOR is the byte itself
+    auto diff = [base, cur, base_len](size_t i) -> unsigned char {
+        return i < base_len ? (unsigned char)(cur[i] ^ base[i]) : cur[i];
+    };
+
+    size_t pos = 0;
+    while (pos < cur_len)
+    {
+        // unchanged run, 8 bytes at a time while both sides have them
+        size_t start = pos;
+        while (pos + 8 <= common && read64(cur + pos) == read64(base + pos))
+        {
+            pos += 8;
+        }
+        while (pos < cur_len && diff(pos) == 0)
+        {
+            ++pos;
+        }
+
+        // the tail is the base's already
+        if (pos == cur_len)
+        {
+            break;
+        }
+
+        for (size_t run = pos - start; run > 0;)
+        {
+            size_t n = run < XOR_DELTA_RUN_MAX ? run : XOR_DELTA_RUN_MAX;
+            if (op == oend)
+            {
+                return 0;
+            }
+            *op++ = (unsigned char)(n - 1);
+            run -= n;
+        }
+
+        // changed run, a lone equal byte inside it costs less than closing the run
+        start = pos;
+        while (pos < cur_len && pos - start < XOR_DELTA_RUN_MAX)
+        {
+            if (diff(pos) == 0 && (pos + 1 == cur_len || diff(pos + 1) == 0))
+            {
+                break;
+            }
+            ++pos;
+        }
+
+        size_t n = pos - start;
+        if ((size_t)(oend - op) < 1 + n)
+        {
+            return 0;
+        }
+
+        *op++ = (unsigned char)(0x7F + n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            *op++ = diff(start + i);
+        }
+    }
+
+    return (size_t)(op - dst);
+}
+
+size_t net_middleware::xor_delta::target_length(const unsigned char* delta, size_t len)
+{
+    if (len < XOR_DELTA_PREFIX)
+    {
+        return 0;
+    }
+
+    return delta[0] | ((size_t)delta[1] << 8);
+}
+
+bool net_middleware::xor_delta::decode(const unsigned char* base, size_t base_len, const unsigned char* delta, size_t len, unsigned char* out)
+{
+    if (len < XOR_DELTA_PREFIX)
+    {
+        return false;
+    }
+
+    size_t out_len = target_length(delta, len);
+    size_t common = base_len < out_len ? base_len : out_len;
+    if (common > 0)
+    {
+        std::memcpy(out, base, common);
+    }
+    std::memset(out + common, 0, out_len - common);
+
+    const unsigned char* ip = delta + XOR_DELTA_PREFIX;
+    const unsigned char* const iend = delta + len;
+    size_t pos = 0;
+
+    while (ip < iend)
+    {
+        unsigned op = *ip++;
+        if (op < 0x80)
+        {
+            pos += op + 1;
+            if (pos > out_len)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        size_t n = op - 0x7F;
+        if ((size_t)(iend - ip) < n || out_len - pos < n)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[pos + i] ^= ip[i];
+        }
+        ip += n;
+        pos += n;
+    }
+
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// new length (uint16 little endian) in front of the ops
+#define XOR_DELTA_PREFIX 2
+// one op covers at most this many bytes
+#define XOR_DELTA_RUN_MAX 128
+
+namespace net_middleware
+{
+    // a snapshot as the XOR against the previous one on the same channel, run length coded:
+    //   new_len(2) | op...
+    //   op < 0x80   skip op + 1 bytes, they equal the base
+    //   op >= 0x80  op - 0x7F bytes follow, each XORed into the base at the current position
+    // decoding starts from the base cut or zero padded to new_len, bytes behind the last op
+    // stay as the base has them. CsNetwork follows decode byte for byte
+    class xor_delta
+    {
+    public:
+        // worst case of encode
+        static inline size_t bound(size_t len) { return XOR_DELTA_PREFIX + len + (len + XOR_DELTA_RUN_MAX - 1) / XOR_DELTA_RUN_MAX; }
+
+        // @return bytes written, 0 if they don't fit in cap or cur_len doesn't fit the prefix
+        static size_t encode(const unsigned char* base, size_t base_len, const unsigned char* cur, size_t cur_len, unsigned char* dst, size_t cap);
+
+        // @return the length a delta decodes to, 0 if it is too short to be one
+        static size_t target_length(const unsigned char* delta, size_t len);
+
+        // @param out target_length(delta, len) bytes, may not overlap base
+        // @return false on malformed input, never reads or writes out of bounds
+        static bool decode(const unsigned char* base, size_t base_len, const unsigned char* delta, size_t len, unsigned char* out);
+    };
+}
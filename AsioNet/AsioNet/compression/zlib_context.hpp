@@ -0,0 +1,343 @@
+#pragma once
+
+#include "config.hpp"
+
+// zlib
+#include <zlib.h>
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// window the proxy deflates a connection stream with, a 32K window would cost every session
+// 256K; the peer inflates with any window up to 15
+#define DEFLATE_STREAM_WINDOW_BITS 12
+#define DEFLATE_STREAM_MEM_LEVEL 5
+
+namespace net_middleware
+{
+    // payload framing of a compressed frame, negotiated in the aaa exchange
+    enum class CompressFormat : unsigned char
+    {
+        GZIP = 0,           // what every client decodes
+        RAW_DEFLATE = 1,    // no 18 byte gzip header/trailer and no crc32
+        DEFLATE_STREAM = 2, // raw deflate, one stream per connection and direction so frames share history,
+                            // Z_SYNC_FLUSH per frame with the 00 00 FF FF tail left off the wire
+        LZ_BLOCK = 3,       // not zlib at all, lz_codec's frame, several times faster for a lower ratio
+    };
+
+    // the tail every Z_SYNC_FLUSH ends with, an empty stored block
+    static const unsigned char DEFLATE_SYNC_TAIL[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+    // preset dictionary for RAW_DEFLATE frames, both ends load the same bytes for an id, see DictTrainer.
+    // deflate only looks back one window, so only the last 32K are kept and the likeliest strings go last
+    class compress_dictionary
+    {
+    public:
+        compress_dictionary(uint32_t id, const std::string& bytes) :
+            _id(id),
+            _bytes(bytes.size() > (1u << 15) ? bytes.substr(bytes.size() - (1u << 15)) : bytes)
+        {
+        }
+
+        inline uint32_t get_id() const { return _id; }
+
+        inline const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(_bytes.data()); }
+
+        inline size_t size() const { return _bytes.size(); }
+
+        // @return nullptr if the file can't be read or is empty
+        static std::shared_ptr<const compress_dictionary> load(uint32_t id, const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open())
+            {
+                return nullptr;
+            }
+
+            std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (bytes.empty())
+            {
+                return nullptr;
+            }
+
+            return std::make_shared<compress_dictionary>(id, bytes);
+        }
+
+    private:
+        uint32_t _id;
+        std::string _bytes;
+    };
+
+    // deflateInit2 allocates ~256KB of window and hash tables, so a context is made once per
+    // thread and only deflateReset between messages
+    class deflate_context
+    {
+    public:
+        explicit deflate_context(CompressFormat format, int level = Z_DEFAULT_COMPRESSION) :
+            _level(level),
+            _next_level(level)
+        {
+            _stream.zalloc = Z_NULL;
+            _stream.zfree = Z_NULL;
+            _stream.opaque = Z_NULL;
+            _stream.avail_in = 0;
+            _stream.next_in = Z_NULL;
+
+            // -15 raw deflate, 15 + 16 gzip, both with a 32K window
+            int window_bits = 15 + 16;
+            int mem_level = 8;
+            if (format == CompressFormat::RAW_DEFLATE)
+            {
+                window_bits = -15;
+            }
+            else if (format == CompressFormat::DEFLATE_STREAM)
+            {
+                window_bits = -DEFLATE_STREAM_WINDOW_BITS;
+                mem_level = DEFLATE_STREAM_MEM_LEVEL;
+            }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+            if (deflateInit2(&_stream, level, Z_DEFLATED, window_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                throw std::runtime_error("deflate init failed");
+            }
+#pragma GCC diagnostic pop
+        }
+
+        ~deflate_context()
+        {
+            deflateEnd(&_stream);
+        }
+
+        deflate_context(const deflate_context&) = delete;
+        deflate_context& operator=(const deflate_context&) = delete;
+
+        // deflate straight into out, never past out_cap
+        // @param dictionary RAW_DEFLATE only, primes the window before data
+        // @return bytes written, 0 if the result doesn't fit in out_cap
+        inline size_t compress(const unsigned char* data, size_t len, unsigned char* out, size_t out_cap, const compress_dictionary* dictionary = nullptr)
+        {
+            deflateReset(&_stream);
+
+            // right after a reset there is nothing to flush, changing the level is cheap here
+            if (_level != _next_level && deflateParams(&_stream, _next_level, Z_DEFAULT_STRATEGY) == Z_OK)
+            {
+                _level = _next_level;
+            }
+
+            if (dictionary != nullptr &&
+                deflateSetDictionary(&_stream, dictionary->data(), static_cast<unsigned int>(dictionary->size())) != Z_OK)
+            {
+                return 0;
+            }
+
+            _stream.next_in = reinterpret_cast<z_const Bytef*>(data);
+            _stream.avail_in = static_cast<unsigned int>(len);
+            _stream.next_out = reinterpret_cast<Bytef*>(out);
+            _stream.avail_out = static_cast<unsigned int>(out_cap);
+
+            if (deflate(&_stream, Z_FINISH) != Z_STREAM_END)
+            {
+                return 0;
+            }
+
+            return out_cap - _stream.avail_out;
+        }
+
+        // DEFLATE_STREAM, append one frame to the stream, no reset so it is matched against the earlier ones
+        // @param out_cap at least flush_bound(len)
+        // @return bytes written without the sync tail, 0 if out_cap was too small and the stream is broken
+        inline size_t compress_flush(const unsigned char* data, size_t len, unsigned char* out, size_t out_cap)
+        {
+            _stream.next_in = reinterpret_cast<z_const Bytef*>(data);
+            _stream.avail_in = static_cast<unsigned int>(len);
+            _stream.next_out = reinterpret_cast<Bytef*>(out);
+            _stream.avail_out = static_cast<unsigned int>(out_cap);
+
+            // a flush that filled out_cap exactly may still have output pending
+            if (deflate(&_stream, Z_SYNC_FLUSH) != Z_OK || _stream.avail_in != 0 || _stream.avail_out == 0)
+            {
+                return 0;
+            }
+
+            size_t written = out_cap - _stream.avail_out;
+            if (written <= sizeof(DEFLATE_SYNC_TAIL))
+            {
+                return 0;
+            }
+
+            return written - sizeof(DEFLATE_SYNC_TAIL);
+        }
+
+        // worst case of compress_flush, deflateBound plus the flush marker and pending bits
+        inline size_t flush_bound(size_t len)
+        {
+            return deflateBound(&_stream, static_cast<uLong>(len)) + 16;
+        }
+
+        // level of the next compress, not for DEFLATE_STREAM which keeps the level it was made with
+        inline void set_level(int level) { _next_level = level; }
+
+        // the calling thread's context for format
+        static inline deflate_context& local(CompressFormat format)
+        {
+            // apart, so a thread only pays for the formats it meets
+            if (format == CompressFormat::RAW_DEFLATE)
+            {
+                static thread_local deflate_context raw_context(CompressFormat::RAW_DEFLATE);
+                return raw_context;
+            }
+
+            static thread_local deflate_context gzip_context(CompressFormat::GZIP);
+            return gzip_context;
+        }
+
+    private:
+        z_stream _stream;
+        int _level;
+        int _next_level;
+    };
+
+    class inflate_context
+    {
+    public:
+        explicit inflate_context(CompressFormat format)
+        {
+            _stream.zalloc = Z_NULL;
+            _stream.zfree = Z_NULL;
+            _stream.opaque = Z_NULL;
+            _stream.avail_in = 0;
+            _stream.next_in = Z_NULL;
+
+            // gzip side detects gzip and zlib headers both, a stream may come from a peer with a full window
+            int window_bits = format == CompressFormat::GZIP ? 15 + 32 : -15;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+            if (inflateInit2(&_stream, window_bits) != Z_OK)
+            {
+                throw std::runtime_error("inflate init failed");
+            }
+#pragma GCC diagnostic pop
+        }
+
+        ~inflate_context()
+        {
+            inflateEnd(&_stream);
+        }
+
+        inflate_context(const inflate_context&) = delete;
+        inflate_context& operator=(const inflate_context&) = delete;
+
+        // inflate straight into output.buffer(), growing it in place through reserve, sets output.length.
+        // OutputType is a slab_buffer or anything with the same offset/length/capacity/reserve
+        // @return false on corrupt or truncated data, reserve throws if the result is too large
+        template <typename OutputType>
+        bool decompress(OutputType& output, const unsigned char* data, size_t len, const compress_dictionary* dictionary = nullptr)
+        {
+            inflateReset(&_stream);
+
+            // a raw stream has no dictionary id to ask for, it is set up front
+            if (dictionary != nullptr &&
+                inflateSetDictionary(&_stream, dictionary->data(), static_cast<unsigned int>(dictionary->size())) != Z_OK)
+            {
+                return false;
+            }
+
+            // the size classes leave headroom, grow one class at a time from there
+            output.length = 0;
+            output.reserve(output.offset + len);
+
+            _stream.next_in = reinterpret_cast<z_const Bytef*>(data);
+            _stream.avail_in = static_cast<unsigned int>(len);
+
+            while (true)
+            {
+                size_t room = output.capacity() - output.offset - output.length;
+                _stream.next_out = reinterpret_cast<Bytef*>(output.buffer(output.length));
+                _stream.avail_out = static_cast<unsigned int>(room);
+
+                int ret = inflate(&_stream, Z_FINISH);
+                output.length += room - _stream.avail_out;
+
+                if (ret == Z_STREAM_END)
+                {
+                    return true;
+                }
+
+                // corrupt, or room left but no input: truncated
+                if ((ret != Z_OK && ret != Z_BUF_ERROR) || _stream.avail_out != 0)
+                {
+                    return false;
+                }
+
+                output.reserve(output.capacity() + 1);
+            }
+        }
+
+        // DEFLATE_STREAM, inflate one frame of the stream, the sync tail is fed back in behind it.
+        // a failure leaves the stream broken, the connection has to go
+        template <typename OutputType>
+        bool decompress_flush(OutputType& output, const unsigned char* data, size_t len)
+        {
+            output.length = 0;
+            output.reserve(output.offset + len);
+
+            const unsigned char* parts[2] = { data, DEFLATE_SYNC_TAIL };
+            size_t part_lens[2] = { len, sizeof(DEFLATE_SYNC_TAIL) };
+
+            for (size_t part = 0; part < 2; ++part)
+            {
+                _stream.next_in = reinterpret_cast<z_const Bytef*>(parts[part]);
+                _stream.avail_in = static_cast<unsigned int>(part_lens[part]);
+
+                do
+                {
+                    size_t room = output.capacity() - output.offset - output.length;
+                    if (room == 0)
+                    {
+                        output.reserve(output.capacity() + 1);
+                        room = output.capacity() - output.offset - output.length;
+                    }
+
+                    _stream.next_out = reinterpret_cast<Bytef*>(output.buffer(output.length));
+                    _stream.avail_out = static_cast<unsigned int>(room);
+
+                    // the stream never ends, a final block is as corrupt as anything else
+                    int ret = inflate(&_stream, Z_SYNC_FLUSH);
+                    output.length += room - _stream.avail_out;
+
+                    if (ret != Z_OK && ret != Z_BUF_ERROR)
+                    {
+                        return false;
+                    }
+                } while (_stream.avail_in != 0 || _stream.avail_out == 0);
+            }
+
+            return true;
+        }
+
+        static inline inflate_context& local(CompressFormat format)
+        {
+            // apart, so a thread only pays for the formats it meets
+            if (format == CompressFormat::RAW_DEFLATE)
+            {
+                static thread_local inflate_context raw_context(CompressFormat::RAW_DEFLATE);
+                return raw_context;
+            }
+
+            static thread_local inflate_context gzip_context(CompressFormat::GZIP);
+            return gzip_context;
+        }
+
+    private:
+        z_stream _stream;
+    };
+}
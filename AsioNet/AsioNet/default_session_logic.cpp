@@ -20,18 +20,18 @@ void net_middleware::default_session_logic::apply_session(std::weak_ptr<basic_as
     _session_holder = session_holder;
 }
 
-bool net_middleware::default_session_logic::unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block)
+bool net_middleware::default_session_logic::unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr /*ret_block*/)
 {
     // check seq
-    if (UNLIKELY(head->seq != ++_seq))
+    if (UNLIKELY(head.seq != ++_seq))
     {
-        LOG("seq error, maybe it's hacked remote is : %d; local is: %d", head->seq, _seq);
+        LOG("seq error, maybe it's hacked remote is : %d; local is: %d", head.seq, _seq);
 
         return false;
     }
 
     // check mask
-    if (UNLIKELY(0 != net_middleware::proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len)))
+    if (UNLIKELY(0 != head.mask_of(buffer->buffer(), head.len)))
     {
         LOG("check mask failed, maybe it's hacked");
 
@@ -45,7 +45,7 @@ bool net_middleware::default_session_logic::unwrap_received_data(once_buffer_spt
 
     if (_authentication == AuthenticationState::BEFORE_VERIFY)
     {
-        verify_authentication(buffer, (protocol_cmd)head->get_cmd());
+        verify_authentication(buffer, (protocol_cmd)head.get_cmd());
     }
 
     return false;
@@ -57,16 +57,16 @@ void net_middleware::default_session_logic::wrap_to_send_data(once_buffer_sptr&
 
     // encrypt none
 
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_AuthenticationAAA, false, _seq);
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len);
-    head->mask = inverse_mask;
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_AuthenticationAAA, false, _seq);
+    uint16_t inverse_mask = head.mask_of(buffer->buffer(), head.len);
+    head.mask = inverse_mask;
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(buffer->origin_buffer());
     buffer->offset -= PROTO_HEAD_SIZE;
     buffer->length += PROTO_HEAD_SIZE;
 }
 
-bool net_middleware::default_session_logic::try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head)
+bool net_middleware::default_session_logic::try_copy_to_storage(once_buffer_sptr /*data*/, const protocol_head& /*head*/)
 {
     return true;
 }
@@ -96,6 +96,27 @@ bool net_middleware::default_session_logic::verify_authentication(once_buffer_sp
     _server_info.server_id_ = aaa_request->server_id;
     _server_info.platform_ = aaa_request->platform;
     _server_info.link_type_ = aaa_request->link_type;
+    _rc4_info.cipher_suite_ = cipher_factory::choose(aaa_request->cipher_suites);
+    _rc4_info.compress_format_ = CompressFormat::GZIP;
+    _rc4_info.dictionary_ = nullptr;
+    _rc4_info.delta_ = (aaa_request->cipher_suites & AAA_OFFER_DELTA) != 0;
+    if ((aaa_request->cipher_suites & AAA_OFFER_DEFLATE_STREAM) && PROXY_MGR->is_compress_stream())
+    {
+        _rc4_info.compress_format_ = CompressFormat::DEFLATE_STREAM;
+    }
+    else if (aaa_request->cipher_suites & AAA_OFFER_LZ)
+    {
+        _rc4_info.compress_format_ = CompressFormat::LZ_BLOCK;
+    }
+    else
+    {
+        // an unknown dictionary id falls back to plain raw deflate or gzip
+        if (aaa_request->cipher_suites & AAA_OFFER_DICTIONARY)
+            _rc4_info.dictionary_ = PROXY_MGR->find_dictionary(aaa_request->dictionary_id);
+
+        if (_rc4_info.dictionary_ || (aaa_request->cipher_suites & AAA_OFFER_RAW_DEFLATE))
+            _rc4_info.compress_format_ = CompressFormat::RAW_DEFLATE;
+    }
 
     if (UNLIKELY(_session_holder.expired()))
     {
@@ -134,18 +155,41 @@ bool net_middleware::default_session_logic::verify_authentication(once_buffer_sp
 
 void net_middleware::default_session_logic::echo_authentication_res(TransferError ec)
 {
-    auto send_buffer = TEMP_BUFFER;
+    auto send_buffer = TEMP_BUFFER_OF(SLAB_CLASS_0); // the response is a few dozen bytes
     uint16_t len = 0;
 
+    // the client session inherits this mode, announce it with the key
+    _rc4_info.rc4_mode_ = PROXY_MGR->is_rc4_stream() ? rc4_context::Mode::STREAM : rc4_context::Mode::RESET_PER_MESSAGE;
+
+    // a newer suite's key rides behind the rc4 key
+    unsigned char key_block[RC4_KEY_LEN + CIPHER_KEY_LEN];
+    std::memcpy(key_block, _rc4_info.rc4_key_, RC4_KEY_LEN);
+    std::memcpy(key_block + RC4_KEY_LEN, _rc4_info.cipher_key_, CIPHER_KEY_LEN);
+    uint16_t key_len = _rc4_info.cipher_suite_ == CipherSuite::RC4 ? RC4_KEY_LEN : RC4_KEY_LEN + CIPHER_KEY_LEN;
+
+    unsigned char suite_byte = (unsigned char)_rc4_info.cipher_suite_;
+    if (_rc4_info.dictionary_)
+        suite_byte |= AAA_OFFER_RAW_DEFLATE | AAA_OFFER_DICTIONARY;
+    else if (_rc4_info.compress_format_ == CompressFormat::RAW_DEFLATE)
+        suite_byte |= AAA_OFFER_RAW_DEFLATE;
+    else if (_rc4_info.compress_format_ == CompressFormat::DEFLATE_STREAM)
+        suite_byte |= AAA_OFFER_DEFLATE_STREAM;
+    else if (_rc4_info.compress_format_ == CompressFormat::LZ_BLOCK)
+        suite_byte |= AAA_OFFER_LZ;
+    if (_rc4_info.delta_)
+        suite_byte |= AAA_OFFER_DELTA;
+
     send_buffer->offset = prefix_size();
     authentication_aaa_response::pack(send_buffer->buffer(), len,
         ec,
         _rc4_info.rc4_subtract_,
         _rc4_info.rc4_modvt_,
-        _rc4_info.rc4_key_,
-        RC4_KEY_LEN,
+        key_block,
+        key_len,
         _target_uid,
-        _server_info.link_type_
+        _server_info.link_type_,
+        (unsigned char)_rc4_info.rc4_mode_,
+        suite_byte
     );
     send_buffer->length += len;
 
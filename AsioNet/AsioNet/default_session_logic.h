@@ -30,11 +30,11 @@ namespace net_middleware
 
         virtual SessionType get_session_type() final { return SessionType::SINGLE_SESSION_BEGIN; }
 
-        virtual bool unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block) final;
+        virtual bool unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block) final;
 
         virtual void wrap_to_send_data(once_buffer_sptr& buffer) final;
 
-        virtual bool try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head) final;
+        virtual bool try_copy_to_storage(once_buffer_sptr data, const protocol_head& head) final;
 
         virtual size_t prefix_size() final { return PROTO_HEAD_SIZE; }
 
@@ -0,0 +1,224 @@
+#include "multicast_group.h"
+#include "LogUtils.hpp"
+#include "basic_async_session.h"
+#include "client_session_logic.h"
+
+void net_middleware::multicast_groups::join(uint32_t group_id, const std::vector<session_sptr>& clients)
+{
+    auto iter = _groups.find(group_id);
+    if (iter == _groups.end())
+    {
+        if (UNLIKELY(_groups.size() >= MULTICAST_GROUPS_MAX))
+        {
+            LOG("too many multicast groups, group %u is not created", group_id);
+            return;
+        }
+
+        iter = _groups.insert(std::make_pair(group_id, group())).first;
+        iter->second.pruned = std::chrono::steady_clock::now();
+    }
+
+    group& g = iter->second;
+
+    // a partition the frame touches is copied once, whatever many members it gains
+    std::vector<std::shared_ptr<std::vector<session_sptr>>> grown(g.partitions.size());
+    for (auto& client : clients)
+    {
+        if (!client)
+        {
+            continue;
+        }
+
+        auto cln_logic = session_logic_interface::session_cast<client_session_logic>(client->get_logic());
+        if (UNLIKELY(!cln_logic) || !g.uids.insert(client->get_uuid()).second)
+        {
+            continue;
+        }
+        _member_of[client->get_uuid()].push_back(group_id);
+
+        asio::io_context::strand* strand = &client->strand_to_run();
+        CompressFormat format = cln_logic->get_compress_format();
+        const compress_dictionary* dictionary = cln_logic->get_dictionary();
+
+        size_t p = 0;
+        while (p < g.partitions.size() &&
+            (g.partitions[p].strand != strand || g.partitions[p].format != format || g.partitions[p].dictionary != dictionary))
+        {
+            ++p;
+        }
+
+        if (p == g.partitions.size())
+        {
+            multicast_partition partition = { strand, format, dictionary, nullptr };
+            g.partitions.push_back(partition);
+            grown.push_back(std::make_shared<std::vector<session_sptr>>());
+        }
+        else if (!grown[p])
+        {
+            grown[p] = std::make_shared<std::vector<session_sptr>>(*g.partitions[p].members);
+        }
+
+        grown[p]->push_back(client);
+    }
+
+    for (size_t p = 0; p < grown.size(); ++p)
+    {
+        if (grown[p])
+        {
+            g.partitions[p].members = grown[p];
+        }
+    }
+
+    if (g.uids.empty())
+    {
+        _groups.erase(iter);
+    }
+}
+
+void net_middleware::multicast_groups::leave(uint32_t group_id, const std::vector<session_uid>& client_uids)
+{
+    auto iter = _groups.find(group_id);
+    if (iter == _groups.end())
+    {
+        return;
+    }
+
+    std::unordered_set<session_uid> leaving(client_uids.begin(), client_uids.end());
+    drop_members(group_id, iter->second, [&leaving](const session_sptr& member) {
+        return leaving.count(member->get_uuid()) > 0;
+    });
+
+    if (iter->second.uids.empty())
+    {
+        _groups.erase(iter);
+    }
+}
+
+void net_middleware::multicast_groups::dismiss(uint32_t group_id)
+{
+    auto iter = _groups.find(group_id);
+    if (iter == _groups.end())
+    {
+        return;
+    }
+
+    for (session_uid uid : iter->second.uids)
+    {
+        unlink(uid, group_id);
+    }
+    _groups.erase(iter);
+}
+
+void net_middleware::multicast_groups::forget(session_uid client_uid)
+{
+    auto iter = _member_of.find(client_uid);
+    if (iter == _member_of.end())
+    {
+        return;
+    }
+
+    // leave unlinks as it goes
+    std::vector<uint32_t> group_ids(iter->second);
+    std::vector<session_uid> leaving(1, client_uid);
+    for (uint32_t group_id : group_ids)
+    {
+        leave(group_id, leaving);
+    }
+}
+
+const std::vector<net_middleware::multicast_partition>* net_middleware::multicast_groups::find(uint32_t group_id)
+{
+    auto iter = _groups.find(group_id);
+    if (iter == _groups.end())
+    {
+        return nullptr;
+    }
+
+    // a closed member costs its strand a state check per cast until it is dropped
+    auto now = std::chrono::steady_clock::now();
+    if (now - iter->second.pruned >= std::chrono::milliseconds(PROXY_CLEAN_PERIOD_MS))
+    {
+        iter->second.pruned = now;
+        drop_members(group_id, iter->second, [](const session_sptr& member) {
+            return member->is_session_closed();
+        });
+
+        if (iter->second.uids.empty())
+        {
+            _groups.erase(iter);
+            return nullptr;
+        }
+    }
+
+    return &iter->second.partitions;
+}
+
+template <typename Pred>
+void net_middleware::multicast_groups::drop_members(uint32_t group_id, group& g, Pred drop)
+{
+    for (size_t p = 0; p < g.partitions.size();)
+    {
+        auto& members = *g.partitions[p].members;
+
+        size_t first = 0;
+        while (first < members.size() && !drop(members[first]))
+        {
+            ++first;
+        }
+
+        if (first == members.size())
+        {
+            ++p;
+            continue;
+        }
+
+        auto kept = std::make_shared<std::vector<session_sptr>>(members.begin(), members.begin() + first);
+        for (size_t i = first; i < members.size(); ++i)
+        {
+            if (drop(members[i]))
+            {
+                g.uids.erase(members[i]->get_uuid());
+                unlink(members[i]->get_uuid(), group_id);
+            }
+            else
+            {
+                kept->push_back(members[i]);
+            }
+        }
+
+        if (kept->empty())
+        {
+            g.partitions.erase(g.partitions.begin() + p);
+        }
+        else
+        {
+            g.partitions[p].members = kept;
+            ++p;
+        }
+    }
+}
+
+void net_middleware::multicast_groups::unlink(session_uid client_uid, uint32_t group_id)
+{
+    auto iter = _member_of.find(client_uid);
+    if (iter == _member_of.end())
+    {
+        return;
+    }
+
+    auto& group_ids = iter->second;
+    for (size_t i = 0; i < group_ids.size(); ++i)
+    {
+        if (group_ids[i] == group_id)
+        {
+            group_ids[i] = group_ids.back();
+            group_ids.pop_back();
+            break;
+        }
+    }
+
+    if (group_ids.empty())
+    {
+        _member_of.erase(iter);
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <asio.hpp>
+
+#include "NetUtils.hpp"
+#include "protocol.hpp"
+#include "compression/zlib_context.hpp"
+
+// groups one game server may keep on the proxy, join frames for more are dropped
+#define MULTICAST_GROUPS_MAX 65536
+// uids one join or leave frame carries at most, next to the group id in the largest frame
+#define MULTICAST_UIDS_PER_FRAME ((PROTO_PAYLOAD_MAX - sizeof(uint32_t)) / sizeof(session_uid))
+
+namespace net_middleware
+{
+    class basic_async_session;
+
+    // the members of a group that share a strand, a compress format and a dictionary,
+    // a cast hands each partition to its strand as one task
+    struct multicast_partition
+    {
+        asio::io_context::strand* strand;
+        CompressFormat format;
+        const compress_dictionary* dictionary;
+        // copy on write, a task still in flight keeps the members it was given
+        std::shared_ptr<const std::vector<std::shared_ptr<basic_async_session>>> members;
+    };
+
+    // rooms, guilds, map shards: the groups a game server created with join/leave frames, so a cast
+    // frame carries a group id instead of every uid. owned by that server's session and only touched
+    // in its strand, no lock
+    class multicast_groups
+    {
+    public:
+        typedef std::shared_ptr<basic_async_session> session_sptr;
+
+        // creates the group on the first join, members already in it are skipped
+        // @param clients found client sessions, empty ones are skipped
+        void join(uint32_t group_id, const std::vector<session_sptr>& clients);
+
+        // a group left empty is dismissed
+        void leave(uint32_t group_id, const std::vector<session_uid>& client_uids);
+
+        void dismiss(uint32_t group_id);
+
+        // a closed client leaves every group it is in, so nothing here keeps it alive
+        void forget(session_uid client_uid);
+
+        inline void clear()
+        {
+            _groups.clear();
+            _member_of.clear();
+        }
+
+        // closed members are dropped here, at most once per PROXY_CLEAN_PERIOD_MS per group
+        // @return nullptr if there is no such group
+        const std::vector<multicast_partition>* find(uint32_t group_id);
+
+        inline size_t size() const { return _groups.size(); }
+
+    private:
+        struct group
+        {
+            std::vector<multicast_partition> partitions;
+            std::unordered_set<session_uid> uids;
+            std::chrono::steady_clock::time_point pruned;
+        };
+
+        // rebuild the partitions that hold a member drop picks, without it
+        template <typename Pred>
+        void drop_members(uint32_t group_id, group& g, Pred drop);
+
+        void unlink(session_uid client_uid, uint32_t group_id);
+
+    private:
+        std::unordered_map<uint32_t, group> _groups;
+        // client uid -> the groups it is in, a handful each
+        std::unordered_map<session_uid, std::vector<uint32_t>> _member_of;
+    };
+}
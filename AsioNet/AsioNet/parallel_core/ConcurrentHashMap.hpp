@@ -0,0 +1,406 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "ParallelUtils.h"
+#include "EpochReclaimer.h"
+
+namespace parallel_core
+{
+	// hash map split into lock striped shards. writers lock their key's shard only, readers take no
+	// lock at all: they pin the epoch and walk bucket chains whose nodes are never changed once
+	// published, an update links in a new node and retires the old one to EpochReclaimer.
+	// Value is copied out of a node, keep it cheap to copy (a shared_ptr, an id)
+	template<class Key, class Value, class _Hasher = std::hash<Key>, class _Keyeq = std::equal_to<Key>>
+	class ConcurrentHashMap
+	{
+	public:
+		// shard_bits: 2^shard_bits shards, a few times the writer threads keeps them apart
+		explicit ConcurrentHashMap(unsigned shard_bits = 6) :
+			_shard_bits(shard_bits),
+			_shard_storage(new unsigned char[sizeof(shard) * ((size_t)1 << shard_bits) + alignof(shard) - 1])
+		{
+			// new[] of an over-aligned type ignores alignas before c++17, so the shards are placed by hand
+			size_t base = (size_t)_shard_storage;
+			_shards = reinterpret_cast<shard*>((base + alignof(shard) - 1) & ~(alignof(shard) - 1));
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				new (&_shards[i]) shard();
+			}
+		}
+
+		~ConcurrentHashMap()
+		{
+			// nobody reads any more, the arrays and chains go right away
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				destroy(_shards[i].buckets.load(std::memory_order_relaxed));
+				_shards[i].~shard();
+			}
+			delete[] _shard_storage;
+		}
+
+		ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+		ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+	public:
+		size_t size() const
+		{
+			size_t n = 0;
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				n += _shards[i].size.load(std::memory_order_relaxed);
+			}
+			return n;
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		bool contains_key(const Key& k)
+		{
+			EpochGuard guard;
+			return find(k, hash_of(k)) != NULL;
+		}
+
+		bool try_get(const Key& k, Value& ref_val)
+		{
+			EpochGuard guard;
+			node* n = find(k, hash_of(k));
+			if (n == NULL)
+			{
+				return false;
+			}
+
+			ref_val = n->value;
+			return true;
+		}
+
+		// one pin for the whole batch, found[i] stays empty if keys[i] is missing
+		size_t try_get_all(const std::vector<Key>& keys, std::vector<Value>& found)
+		{
+			EpochGuard guard;
+
+			size_t hits = 0;
+			found.assign(keys.size(), Value());
+			for (size_t i = 0; i < keys.size(); ++i)
+			{
+				node* n = find(keys[i], hash_of(keys[i]));
+				if (n != NULL)
+				{
+					found[i] = n->value;
+					++hits;
+				}
+			}
+			return hits;
+		}
+
+		// @return false if k is there already
+		bool insert(const Key& k, const Value& v)
+		{
+			return write(k, v, false);
+		}
+
+		void insert_or_set(const Key& k, const Value& v)
+		{
+			write(k, v, true);
+		}
+
+		bool erase(const Key& k)
+		{
+			size_t h = hash_of(k);
+			shard& s = shard_of(h);
+			std::lock_guard<std::mutex> lock(s.mut);
+
+			bucket_array* buckets = s.buckets.load(std::memory_order_relaxed);
+			if (buckets == NULL)
+			{
+				return false;
+			}
+
+			std::atomic<node*>* link = &buckets->heads[h & buckets->mask];
+			for (node* n = link->load(std::memory_order_relaxed); n != NULL; n = link->load(std::memory_order_relaxed))
+			{
+				if (n->hash == h && _keyeq(n->key, k))
+				{
+					link->store(n->next.load(std::memory_order_relaxed), std::memory_order_release);
+					s.size.fetch_sub(1, std::memory_order_relaxed);
+					retire(n);
+					return true;
+				}
+				link = &n->next;
+			}
+			return false;
+		}
+
+		void clear()
+		{
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				shard& s = _shards[i];
+				std::lock_guard<std::mutex> lock(s.mut);
+
+				bucket_array* buckets = s.buckets.exchange(NULL, std::memory_order_acq_rel);
+				s.size.store(0, std::memory_order_relaxed);
+				if (buckets != NULL)
+				{
+					EPOCH_RECLAIMER->retire([buckets]() { destroy(buckets); });
+				}
+			}
+		}
+
+		// visit(key, value) for every entry, shard by shard in place, nothing is copied or locked.
+		// entries written meanwhile may or may not be seen, visit may write to the map
+		template<class Visitor>
+		void for_each(Visitor visit)
+		{
+			EpochGuard guard;
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				bucket_array* buckets = _shards[i].buckets.load(std::memory_order_acquire);
+				if (buckets == NULL)
+				{
+					continue;
+				}
+
+				for (size_t b = 0; b <= buckets->mask; ++b)
+				{
+					for (node* n = buckets->heads[b].load(std::memory_order_acquire); n != NULL; n = n->next.load(std::memory_order_acquire))
+					{
+						visit(n->key, n->value);
+					}
+				}
+			}
+		}
+
+		// drop every entry pred(key, value) holds for, each shard is locked while it is walked,
+		// so pred must not touch the map
+		template<class Predicate>
+		size_t erase_if(Predicate pred)
+		{
+			size_t erased = 0;
+			for (size_t i = 0; i < shard_count(); ++i)
+			{
+				shard& s = _shards[i];
+				std::lock_guard<std::mutex> lock(s.mut);
+
+				bucket_array* buckets = s.buckets.load(std::memory_order_relaxed);
+				if (buckets == NULL)
+				{
+					continue;
+				}
+
+				for (size_t b = 0; b <= buckets->mask; ++b)
+				{
+					std::atomic<node*>* link = &buckets->heads[b];
+					for (node* n = link->load(std::memory_order_relaxed); n != NULL; n = link->load(std::memory_order_relaxed))
+					{
+						if (pred(n->key, n->value))
+						{
+							link->store(n->next.load(std::memory_order_relaxed), std::memory_order_release);
+							s.size.fetch_sub(1, std::memory_order_relaxed);
+							retire(n);
+							++erased;
+						}
+						else
+						{
+							link = &n->next;
+						}
+					}
+				}
+			}
+			return erased;
+		}
+
+	private:
+		// key, value and hash never change once the node is reachable, next only by the shard's writer
+		struct node
+		{
+			node(size_t h, const Key& k, const Value& v, node* nxt) :
+				hash(h),
+				key(k),
+				value(v),
+				next(nxt)
+			{
+			}
+
+			size_t hash;
+			Key key;
+			Value value;
+			std::atomic<node*> next;
+		};
+
+		struct bucket_array
+		{
+			explicit bucket_array(size_t count) :
+				mask(count - 1),
+				heads(new std::atomic<node*>[count])
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					heads[i].store(NULL, std::memory_order_relaxed);
+				}
+			}
+
+			~bucket_array()
+			{
+				delete[] heads;
+			}
+
+			size_t mask;
+			std::atomic<node*>* heads;
+		};
+
+		struct alignas(64) shard
+		{
+			shard() :
+				buckets(NULL),
+				size(0)
+			{
+			}
+
+			std::mutex mut; // writers
+			std::atomic<bucket_array*> buckets;
+			std::atomic<size_t> size;
+		};
+
+	private:
+		inline size_t shard_count() const
+		{
+			return (size_t)1 << _shard_bits;
+		}
+
+		// std::hash of an integer is the integer itself, spread it before taking bits off both ends
+		inline size_t hash_of(const Key& k) const
+		{
+			uint64_t h = (uint64_t)_hasher(k) * 0x9e3779b97f4a7c15ull;
+			return (size_t)(h ^ (h >> 29));
+		}
+
+		// high bits pick the shard, low bits the bucket
+		inline shard& shard_of(size_t h) const
+		{
+			return _shards[_shard_bits == 0 ? 0 : h >> (sizeof(size_t) * 8 - _shard_bits)];
+		}
+
+		// the caller is pinned
+		node* find(const Key& k, size_t h) const
+		{
+			bucket_array* buckets = shard_of(h).buckets.load(std::memory_order_acquire);
+			if (buckets == NULL)
+			{
+				return NULL;
+			}
+
+			for (node* n = buckets->heads[h & buckets->mask].load(std::memory_order_acquire); n != NULL; n = n->next.load(std::memory_order_acquire))
+			{
+				if (n->hash == h && _keyeq(n->key, k))
+				{
+					return n;
+				}
+			}
+			return NULL;
+		}
+
+		bool write(const Key& k, const Value& v, bool overwrite)
+		{
+			size_t h = hash_of(k);
+			shard& s = shard_of(h);
+			std::lock_guard<std::mutex> lock(s.mut);
+
+			bucket_array* buckets = s.buckets.load(std::memory_order_relaxed);
+			if (buckets == NULL)
+			{
+				buckets = new bucket_array(16);
+				s.buckets.store(buckets, std::memory_order_release);
+			}
+
+			std::atomic<node*>* head = &buckets->heads[h & buckets->mask];
+			std::atomic<node*>* link = head;
+			for (node* n = link->load(std::memory_order_relaxed); n != NULL; n = link->load(std::memory_order_relaxed))
+			{
+				if (n->hash == h && _keyeq(n->key, k))
+				{
+					if (!overwrite)
+					{
+						return false;
+					}
+
+					// readers on n keep the old value
+					link->store(new node(h, k, v, n->next.load(std::memory_order_relaxed)), std::memory_order_release);
+					retire(n);
+					return true;
+				}
+				link = &n->next;
+			}
+
+			head->store(new node(h, k, v, head->load(std::memory_order_relaxed)), std::memory_order_release);
+			size_t size = s.size.fetch_add(1, std::memory_order_relaxed) + 1;
+
+			// load factor 1
+			if (size > buckets->mask + 1)
+			{
+				grow(s, buckets);
+			}
+			return true;
+		}
+
+		// under the shard's lock. readers may be walking the old chains, so the nodes are copied
+		// into the new array and the old array goes with its nodes
+		void grow(shard& s, bucket_array* old_buckets)
+		{
+			bucket_array* new_buckets = new bucket_array((old_buckets->mask + 1) * 2);
+			for (size_t b = 0; b <= old_buckets->mask; ++b)
+			{
+				for (node* n = old_buckets->heads[b].load(std::memory_order_relaxed); n != NULL; n = n->next.load(std::memory_order_relaxed))
+				{
+					std::atomic<node*>& head = new_buckets->heads[n->hash & new_buckets->mask];
+					head.store(new node(n->hash, n->key, n->value, head.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+				}
+			}
+
+			s.buckets.store(new_buckets, std::memory_order_release);
+			EPOCH_RECLAIMER->retire([old_buckets]() { destroy(old_buckets); });
+		}
+
+		static void retire(node* n)
+		{
+			EPOCH_RECLAIMER->retire([n]() { delete n; });
+		}
+
+		// the array and every chain hanging off it
+		static void destroy(bucket_array* buckets)
+		{
+			if (buckets == NULL)
+			{
+				return;
+			}
+
+			for (size_t b = 0; b <= buckets->mask; ++b)
+			{
+				node* n = buckets->heads[b].load(std::memory_order_relaxed);
+				while (n != NULL)
+				{
+					node* next = n->next.load(std::memory_order_relaxed);
+					delete n;
+					n = next;
+				}
+			}
+			delete buckets;
+		}
+
+	private:
+		unsigned _shard_bits;
+		unsigned char* _shard_storage;
+		shard* _shards; // _shard_storage rounded up to the shards' alignment
+		_Hasher _hasher;
+		_Keyeq _keyeq;
+	};
+}
@@ -0,0 +1,184 @@
+#include <vector>
+
+#include "EpochReclaimer.h"
+
+namespace
+{
+	// pins of this thread, nested guards don't touch the record
+	thread_local int pin_depth = 0;
+}
+
+parallel_core::EpochReclaimer::EpochReclaimer() :
+	_slots_in_use(0),
+	_overflow_pins(0),
+	_epoch(0)
+{
+	for (auto& r : _records)
+	{
+		r.state.store(0, std::memory_order_relaxed);
+	}
+}
+
+parallel_core::EpochReclaimer::~EpochReclaimer()
+{
+	for (auto& b : _bags)
+	{
+		for (auto& retired : b.retired)
+		{
+			retired.second();
+		}
+	}
+}
+
+void parallel_core::EpochReclaimer::pin()
+{
+	if (pin_depth++ > 0)
+		return;
+
+	int slot = slot_in_use();
+	if (UNLIKELY(slot < 0))
+	{
+		_overflow_pins.fetch_add(1, std::memory_order_seq_cst);
+		return;
+	}
+
+	// the epoch may move between reading and announcing it, announce until it stands still
+	std::atomic<uint64_t>& state = _records[slot].state;
+	uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+	while (true)
+	{
+		state.store(epoch << 1 | 1, std::memory_order_seq_cst);
+
+		uint64_t now = _epoch.load(std::memory_order_seq_cst);
+		if (LIKELY(now == epoch))
+			break;
+
+		epoch = now;
+	}
+}
+
+void parallel_core::EpochReclaimer::unpin()
+{
+	if (--pin_depth > 0)
+		return;
+
+	int slot = get_current_thread_slot();
+	if (UNLIKELY(slot < 0))
+	{
+		_overflow_pins.fetch_sub(1, std::memory_order_release);
+		return;
+	}
+
+	_records[slot].state.store(0, std::memory_order_release);
+}
+
+void parallel_core::EpochReclaimer::retire(std::function<void()> deleter)
+{
+	int slot = slot_in_use();
+	bag& b = _bags[slot < 0 ? MAX_THREAD_SLOT : slot];
+
+	// the caller's unlink comes before the epoch it is stamped with
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool full;
+	{
+		std::lock_guard<std::mutex> lock(b.mut);
+		b.retired.push_back(std::make_pair(_epoch.load(std::memory_order_seq_cst), std::move(deleter)));
+		full = ++b.since_collect >= EPOCH_COLLECT_BATCH;
+	}
+
+	if (full)
+	{
+		try_advance();
+		collect_bag(b, _epoch.load(std::memory_order_seq_cst));
+	}
+}
+
+size_t parallel_core::EpochReclaimer::collect()
+{
+	try_advance();
+
+	uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+	size_t ran = collect_bag(_bags[MAX_THREAD_SLOT], epoch);
+
+	int in_use = _slots_in_use.load(std::memory_order_acquire);
+	for (int i = 0; i < in_use; ++i)
+	{
+		ran += collect_bag(_bags[i], epoch);
+	}
+	return ran;
+}
+
+size_t parallel_core::EpochReclaimer::pending()
+{
+	size_t n = 0;
+	for (auto& b : _bags)
+	{
+		std::lock_guard<std::mutex> lock(b.mut);
+		n += b.retired.size();
+	}
+	return n;
+}
+
+int parallel_core::EpochReclaimer::slot_in_use()
+{
+	int slot = get_current_thread_slot();
+
+	int in_use = _slots_in_use.load(std::memory_order_relaxed);
+	while (UNLIKELY(slot >= in_use) && !_slots_in_use.compare_exchange_weak(in_use, slot + 1, std::memory_order_seq_cst))
+	{
+	}
+
+	return slot;
+}
+
+bool parallel_core::EpochReclaimer::try_advance()
+{
+	uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+
+	if (_overflow_pins.load(std::memory_order_seq_cst) != 0)
+		return false;
+
+	int in_use = _slots_in_use.load(std::memory_order_seq_cst);
+	for (int i = 0; i < in_use; ++i)
+	{
+		uint64_t state = _records[i].state.load(std::memory_order_seq_cst);
+		if ((state & 1) && (state >> 1) != epoch)
+			return false;
+	}
+
+	return _epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+size_t parallel_core::EpochReclaimer::collect_bag(bag& b, uint64_t epoch)
+{
+	// retired at e, readers may still be pinned at e, and at e + 1 if they pinned just before the unlink
+	std::vector<std::function<void()>> ready;
+	{
+		std::lock_guard<std::mutex> lock(b.mut);
+		b.since_collect = 0;
+
+		while (!b.retired.empty() && b.retired.front().first + 2 <= epoch)
+		{
+			ready.push_back(std::move(b.retired.front().second));
+			b.retired.pop_front();
+		}
+	}
+
+	// out of the lock, a deleter may retire more
+	for (auto& deleter : ready)
+	{
+		deleter();
+	}
+
+	return ready.size();
+}
+
+parallel_core::EpochGuard::EpochGuard()
+{
+	EPOCH_RECLAIMER->pin();
+}
+
+parallel_core::EpochGuard::~EpochGuard()
+{
+	EPOCH_RECLAIMER->unpin();
+}
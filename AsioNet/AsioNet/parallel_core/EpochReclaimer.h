@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "ParallelUtils.h"
+#include "SafeSingleton.h"
+
+// retires of one thread between two collects of its bag
+#define EPOCH_COLLECT_BATCH 64
+
+namespace parallel_core
+{
+	// epoch based reclamation. a reader pins the current epoch for as long as it holds pointers it
+	// loaded from a shared structure, a writer unlinks an object and retires it, and the object is
+	// destroyed once every thread pinned at that time has unpinned. pinning writes the thread's own
+	// cache line only, readers never wait on writers. each thread retires into its own bag, so writers
+	// on different threads don't meet either
+	class EpochReclaimer : public SafeSingleton<EpochReclaimer>
+	{
+	public:
+		EpochReclaimer();
+		~EpochReclaimer();
+
+		// nests, only the outermost pin counts
+		void pin();
+
+		void unpin();
+
+		// deleter runs on whichever thread collects it, after every reader pinned before this call unpinned,
+		// every EPOCH_COLLECT_BATCH retires collect on their own
+		void retire(std::function<void()> deleter);
+
+		// advance the epoch if every pinned thread has seen it, run the deleters old enough in every bag
+		// @return deleters run
+		size_t collect();
+
+		size_t pending();
+
+	private:
+		// padded rather than alignas, the singleton is allocated with a plain new. two states are a whole
+		// line apart, so no two threads' states share one
+		struct record
+		{
+			std::atomic<uint64_t> state; // epoch << 1 | pinned
+			char pad[64 - sizeof(std::atomic<uint64_t>)];
+		};
+
+		// stamped in retire order, so the epochs only grow front to back
+		struct bag
+		{
+			bag() : since_collect(0) {}
+
+			std::mutex mut; // its thread, and whoever collects
+			std::deque<std::pair<uint64_t, std::function<void()>>> retired;
+			size_t since_collect;
+		};
+
+		// threads without a slot share the last record and bag
+		int slot_in_use();
+
+		bool try_advance();
+
+		size_t collect_bag(bag& b, uint64_t epoch);
+
+	private:
+		record _records[MAX_THREAD_SLOT];
+		std::atomic<int> _slots_in_use; // records past it were never pinned
+		std::atomic<uint32_t> _overflow_pins; // threads without a slot hold the epoch where it is while pinned
+		std::atomic<uint64_t> _epoch;
+
+		bag _bags[MAX_THREAD_SLOT + 1];
+	};
+
+	// pins the current thread for its scope
+	class EpochGuard
+	{
+	public:
+		EpochGuard();
+		~EpochGuard();
+
+		EpochGuard(const EpochGuard&) = delete;
+		EpochGuard& operator=(const EpochGuard&) = delete;
+	};
+}
+
+#define EPOCH_RECLAIMER parallel_core::EpochReclaimer::instance()
@@ -1,3 +1,6 @@
+#include <mutex>
+#include <vector>
+
 #include "ParallelUtils.h"
 
 #ifdef __linux__
@@ -19,4 +22,57 @@ size_t get_standard_thread_num()
 	return si.dwNumberOfProcessors;
 }
 
-#endif
\ No newline at end of file
+#endif
+
+namespace
+{
+	struct thread_slot_registry
+	{
+		std::mutex mut;
+		std::vector<int> free_slots;
+		int next_slot = 0;
+	};
+
+	thread_slot_registry& slot_registry()
+	{
+		static thread_slot_registry registry;
+		return registry;
+	}
+
+	struct thread_slot_holder
+	{
+		thread_slot_holder()
+		{
+			thread_slot_registry& registry = slot_registry();
+			std::lock_guard<std::mutex> lock(registry.mut);
+
+			if (!registry.free_slots.empty())
+			{
+				slot = registry.free_slots.back();
+				registry.free_slots.pop_back();
+			}
+			else if (registry.next_slot < MAX_THREAD_SLOT)
+				slot = registry.next_slot++;
+			else
+				slot = -1;
+		}
+
+		~thread_slot_holder()
+		{
+			if (slot < 0)
+				return;
+
+			thread_slot_registry& registry = slot_registry();
+			std::lock_guard<std::mutex> lock(registry.mut);
+			registry.free_slots.push_back(slot);
+		}
+
+		int slot;
+	};
+}
+
+int get_current_thread_slot()
+{
+	static thread_local thread_slot_holder holder;
+	return holder.slot;
+}
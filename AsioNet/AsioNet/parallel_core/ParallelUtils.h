@@ -15,9 +15,15 @@
 
 // cpu processor num
 size_t get_standard_thread_num();
+
+// dense per-thread index in [0, MAX_THREAD_SLOT), handed back when the thread exits so the next
+// thread adopts it, -1 once every slot is taken
+#define MAX_THREAD_SLOT 256
+int get_current_thread_slot();
 #ifdef __linux__
 #include "unistd.h"
 #include "sys/sysinfo.h"
+#include "sys/syscall.h"
 
 #else
 #include "winsock2.h"
@@ -26,7 +32,7 @@ size_t get_standard_thread_num();
 #endif
 
 #ifdef __linux__
-#define GET_CURRENT_THREAD_ID getpid()
+#define GET_CURRENT_THREAD_ID ((int)syscall(SYS_gettid))
 #else
 #define GET_CURRENT_THREAD_ID GetCurrentThreadId()
 #endif
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace parallel_core
+{
+	template <class T>
+	class ThreadSafeObjectPool;
+
+	// intrusive refcounted handle to an object from ThreadSafeObjectPool<T>,
+	// the count and the owning slot live in the pool node, so copying or dropping it never allocates
+	template <class T>
+	class PoolHandle
+	{
+	public:
+		PoolHandle() :
+			_ptr(NULL)
+		{
+		}
+
+		PoolHandle(std::nullptr_t) :
+			_ptr(NULL)
+		{
+		}
+
+		// @param element must come from ThreadSafeObjectPool<T>::get_handle, takes another reference
+		explicit PoolHandle(T* element) :
+			_ptr(element)
+		{
+			if (NULL != _ptr)
+				ThreadSafeObjectPool<T>::add_ref(_ptr);
+		}
+
+		PoolHandle(const PoolHandle& other) :
+			PoolHandle(other._ptr)
+		{
+		}
+
+		PoolHandle(PoolHandle&& other) :
+			_ptr(other._ptr)
+		{
+			other._ptr = NULL;
+		}
+
+		~PoolHandle()
+		{
+			reset();
+		}
+
+		PoolHandle& operator=(const PoolHandle& other)
+		{
+			PoolHandle(other).swap(*this);
+			return *this;
+		}
+
+		PoolHandle& operator=(PoolHandle&& other)
+		{
+			PoolHandle(std::move(other)).swap(*this);
+			return *this;
+		}
+
+		PoolHandle& operator=(std::nullptr_t)
+		{
+			reset();
+			return *this;
+		}
+
+		inline void reset()
+		{
+			if (NULL != _ptr)
+			{
+				T* ptr = _ptr;
+				_ptr = NULL;
+				ThreadSafeObjectPool<T>::drop_ref(ptr);
+			}
+		}
+
+		inline void swap(PoolHandle& other)
+		{
+			std::swap(_ptr, other._ptr);
+		}
+
+		// give up the reference without dropping it, pair with adopt
+		inline T* detach()
+		{
+			T* ptr = _ptr;
+			_ptr = NULL;
+			return ptr;
+		}
+
+		static inline PoolHandle adopt(T* element)
+		{
+			PoolHandle ret;
+			ret._ptr = element;
+			return ret;
+		}
+
+		inline T* get() const { return _ptr; }
+
+		inline T* operator->() const { return _ptr; }
+
+		inline T& operator*() const { return *_ptr; }
+
+		explicit operator bool() const { return NULL != _ptr; }
+
+		inline bool operator==(std::nullptr_t) const { return NULL == _ptr; }
+
+		inline bool operator!=(std::nullptr_t) const { return NULL != _ptr; }
+
+		friend inline bool operator==(std::nullptr_t, const PoolHandle& h) { return NULL == h._ptr; }
+
+		friend inline bool operator!=(std::nullptr_t, const PoolHandle& h) { return NULL != h._ptr; }
+
+	private:
+		T* _ptr;
+	};
+
+	// type erased, move-only owner of one PoolHandle reference, for queues holding several buffer kinds
+	class AnyPoolHandle
+	{
+	public:
+		AnyPoolHandle() :
+			_ptr(NULL),
+			_drop(NULL)
+		{
+		}
+
+		template <class T>
+		AnyPoolHandle(PoolHandle<T> handle) :
+			_ptr(handle.detach()),
+			_drop(&drop_as<T>)
+		{
+		}
+
+		AnyPoolHandle(AnyPoolHandle&& other) :
+			_ptr(other._ptr),
+			_drop(other._drop)
+		{
+			other._ptr = NULL;
+		}
+
+		AnyPoolHandle& operator=(AnyPoolHandle&& other)
+		{
+			if (this != &other)
+			{
+				reset();
+				_ptr = other._ptr;
+				_drop = other._drop;
+				other._ptr = NULL;
+			}
+
+			return *this;
+		}
+
+		AnyPoolHandle(const AnyPoolHandle&) = delete;
+		AnyPoolHandle& operator=(const AnyPoolHandle&) = delete;
+
+		~AnyPoolHandle()
+		{
+			reset();
+		}
+
+		inline void reset()
+		{
+			if (NULL != _ptr)
+			{
+				void* ptr = _ptr;
+				_ptr = NULL;
+				_drop(ptr);
+			}
+		}
+
+	private:
+		template <class T>
+		static void drop_as(void* ptr)
+		{
+			ThreadSafeObjectPool<T>::drop_ref(static_cast<T*>(ptr));
+		}
+
+	private:
+		void* _ptr;
+		void(*_drop)(void*);
+	};
+}
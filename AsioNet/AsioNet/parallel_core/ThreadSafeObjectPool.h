@@ -1,19 +1,36 @@
 #pragma once
 
-#include "parallel_core/ThreadCacheContainer.h"
-#include "parallel_core/ObjectPool.h"
+#include "parallel_core/ParallelUtils.h"
+#include "parallel_core/Spinlock.hpp"
 #include "parallel_core/SafeSingleton.h"
+#include "parallel_core/PoolHandle.h"
 #include <assert.h>
+#include <atomic>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <tuple>
+#include <vector>
+
+// objects a thread keeps without touching the depot
+#define POOL_MAGAZINE_SIZE 64
+// objects moved between a magazine and the depot at once
+#define POOL_BATCH_SIZE 32
 
 namespace parallel_core
 {
+	// thread caching pool:
+	// each thread slot owns a magazine served without any lock, a miss first drains what other threads
+	// released back to this slot, then takes a whole batch from the depot, an overflow hands a batch back.
+	// objects released on another thread are pushed onto the owner's remote list with one CAS.
 	template <class T>
 	class ThreadSafeObjectPool : public SafeSingleton<ThreadSafeObjectPool<T>>
 	{
 	public:
+		ThreadSafeObjectPool();
+		~ThreadSafeObjectPool();
+
+		// @return slot the object belongs to, pass it back on release
 		template <class ... P>
 		inline std::tuple<int, T*> get(P&& ... p);
 
@@ -23,42 +40,325 @@ namespace parallel_core
 		template <class ...P>
 		inline std::shared_ptr<T> get_shared(P&& ...p);
 
+		// same as get_shared, but the refcount lives in the pool node, nothing is allocated per handle
+		template <class ...P>
+		inline PoolHandle<T> get_handle(P&& ...p);
+
+		// refcount of objects handed out by get_handle, used by PoolHandle
+		static inline void add_ref(T* element);
+
+		static inline void drop_ref(T* element);
+
+		// free what sits in the depot and in the calling thread's magazine
 		inline void clearCache();
 	private:
-		ThreadCacheContiner<ObjectPool<T>> _container;
+		struct pool_node
+		{
+			template <class ... P>
+			pool_node(P&& ... p) :
+				value(std::forward<P>(p) ...),
+				next(NULL),
+				slot(-1)
+			{
+				refs.store(0);
+			}
+
+			// must stay the first member, released pointers are cast back to the node
+			T value;
+			pool_node* next;
+
+			// only used by handles
+			std::atomic<int> refs;
+			int slot;
+		};
+
+		struct thread_cache
+		{
+			thread_cache() :
+				count(0)
+			{
+				remote.store(NULL);
+			}
+
+			pool_node* magazine[POOL_MAGAZINE_SIZE];
+			int count;
+
+			// keep the line other threads write to away from the owner's magazine
+			char padding[64];
+			std::atomic<pool_node*> remote;
+		};
+
+		inline thread_cache* local_cache(int slot);
+
+		inline void refill(thread_cache* cache);
+
+		inline void flush(thread_cache* cache);
+
+		inline void push_depot(pool_node* chain);
+
+		inline pool_node* pop_depot();
+
+		static inline void delete_chain(pool_node* chain);
+
+		static inline pool_node* node_of(T* element)
+		{
+			return reinterpret_cast<pool_node*>(element);
+		}
+
+	private:
+		std::atomic<thread_cache*> _caches[MAX_THREAD_SLOT];
+
+		Spinlock _depot_lock;
+		std::vector<pool_node*> _depot;
 	};
 
+	template<class T>
+	inline ThreadSafeObjectPool<T>::ThreadSafeObjectPool()
+	{
+		for (int i = 0; i < MAX_THREAD_SLOT; ++i)
+			_caches[i].store(NULL);
+	}
+
+	template<class T>
+	ThreadSafeObjectPool<T>::~ThreadSafeObjectPool()
+	{
+		for (int i = 0; i < MAX_THREAD_SLOT; ++i)
+		{
+			thread_cache* cache = _caches[i].load();
+			if (NULL == cache)
+				continue;
+
+			for (int j = 0; j < cache->count; ++j)
+			{
+				SAFE_DELETE(cache->magazine[j]);
+			}
+
+			delete_chain(cache->remote.exchange(NULL));
+			SAFE_DELETE(cache);
+		}
+
+		for (pool_node* chain : _depot)
+			delete_chain(chain);
+	}
+
 	template<class T>
 	template<class ... P>
 	inline std::tuple<int, T*> ThreadSafeObjectPool<T>::get(P&& ... p)
 	{
-		auto* element = _container.getThreadCache()->get(std::forward<P>(p) ...);
-		return std::make_tuple(GET_CURRENT_THREAD_ID, element);
+		int slot = get_current_thread_slot();
+		pool_node* node = NULL;
+
+		if (LIKELY(slot >= 0))
+		{
+			thread_cache* cache = local_cache(slot);
+			if (UNLIKELY(cache->count == 0))
+				refill(cache);
+
+			if (LIKELY(cache->count > 0))
+				node = cache->magazine[--cache->count];
+		}
+		else
+		{
+			// out of slots, share the depot
+			node = pop_depot();
+			if (NULL != node && NULL != node->next)
+			{
+				push_depot(node->next);
+				node->next = NULL;
+			}
+		}
+
+		if (UNLIKELY(NULL == node))
+		{
+			node = new(std::nothrow) pool_node(std::forward<P>(p) ...);
+			if (UNLIKELY(NULL == node))
+				return std::make_tuple(slot, (T*)NULL);
+		}
+
+		return std::make_tuple(slot, &(node->value));
 	}
 
 	template<class T>
 	inline void ThreadSafeObjectPool<T>::release(T* element, int threadId)
 	{
 		assert(NULL != element);
-		_container.getThreadCache(threadId)->release(element);
+
+		pool_node* node = node_of(element);
+		int slot = get_current_thread_slot();
+
+		if (LIKELY(slot == threadId && slot >= 0))
+		{
+			thread_cache* cache = local_cache(slot);
+			if (UNLIKELY(cache->count == POOL_MAGAZINE_SIZE))
+				flush(cache);
+
+			cache->magazine[cache->count++] = node;
+			return;
+		}
+
+		thread_cache* owner = (threadId >= 0 && threadId < MAX_THREAD_SLOT) ?
+			_caches[threadId].load(std::memory_order_acquire) : NULL;
+
+		if (UNLIKELY(NULL == owner))
+		{
+			node->next = NULL;
+			push_depot(node);
+			return;
+		}
+
+		// only the owner takes from this list and it takes all of it, so a plain push has no ABA
+		pool_node* head = owner->remote.load(std::memory_order_relaxed);
+		do
+		{
+			node->next = head;
+		} while (!owner->remote.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
 	}
 
 	template<class T>
 	template <class ...P>
 	inline std::shared_ptr<T> ThreadSafeObjectPool<T>::get_shared(P&& ... p)
 	{
-		auto* ptr = _container.getThreadCache()->get(std::forward<P>(p)...);
+		auto ret = get(std::forward<P>(p)...);
 
-		auto pid = GET_CURRENT_THREAD_ID;
-		return std::shared_ptr<T>(ptr, [this, pid](T* p) {
-			_container.getThreadCache(pid)->release(p);
+		int tid = std::get<0>(ret);
+		return std::shared_ptr<T>(std::get<1>(ret), [this, tid](T* p) {
+			release(p, tid);
 		});
 	}
 
+	template<class T>
+	template <class ...P>
+	inline PoolHandle<T> ThreadSafeObjectPool<T>::get_handle(P&& ... p)
+	{
+		auto ret = get(std::forward<P>(p)...);
+
+		T* element = std::get<1>(ret);
+		if (UNLIKELY(NULL == element))
+			return PoolHandle<T>();
+
+		pool_node* node = node_of(element);
+		node->slot = std::get<0>(ret);
+		node->refs.store(1, std::memory_order_relaxed);
+		return PoolHandle<T>::adopt(element);
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::add_ref(T* element)
+	{
+		node_of(element)->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::drop_ref(T* element)
+	{
+		// instance() runs call_once on every call, too slow for the release path
+		static ThreadSafeObjectPool<T>* pool = ThreadSafeObjectPool<T>::instance();
+
+		pool_node* node = node_of(element);
+		if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			pool->release(element, node->slot);
+	}
+
 	template<class T>
 	inline void ThreadSafeObjectPool<T>::clearCache()
 	{
-		_container.clearUnusedThreadCache();
+		int slot = get_current_thread_slot();
+		if (slot >= 0 && NULL != _caches[slot].load())
+		{
+			thread_cache* cache = _caches[slot].load();
+			for (int i = 0; i < cache->count; ++i)
+			{
+				SAFE_DELETE(cache->magazine[i]);
+			}
+
+			cache->count = 0;
+			delete_chain(cache->remote.exchange(NULL, std::memory_order_acquire));
+		}
+
+		std::vector<pool_node*> depot;
+		{
+			SpinlockHolder lk(&_depot_lock);
+			depot.swap(_depot);
+		}
+
+		for (pool_node* chain : depot)
+			delete_chain(chain);
 	}
 
-}
\ No newline at end of file
+	template<class T>
+	inline typename ThreadSafeObjectPool<T>::thread_cache* ThreadSafeObjectPool<T>::local_cache(int slot)
+	{
+		thread_cache* cache = _caches[slot].load(std::memory_order_relaxed);
+		if (LIKELY(NULL != cache))
+			return cache;
+
+		// only the thread holding this slot creates its cache, the release pairs with remote pushers
+		cache = new thread_cache;
+		_caches[slot].store(cache, std::memory_order_release);
+		return cache;
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::refill(thread_cache* cache)
+	{
+		pool_node* chain = cache->remote.exchange(NULL, std::memory_order_acquire);
+		if (NULL == chain)
+			chain = pop_depot();
+
+		while (NULL != chain)
+		{
+			if (UNLIKELY(cache->count == POOL_MAGAZINE_SIZE))
+				flush(cache);
+
+			cache->magazine[cache->count++] = chain;
+			chain = chain->next;
+		}
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::flush(thread_cache* cache)
+	{
+		// hand back the coldest batch, the top of the magazine is still in this core's cache
+		pool_node* chain = NULL;
+		for (int i = POOL_BATCH_SIZE - 1; i >= 0; --i)
+		{
+			cache->magazine[i]->next = chain;
+			chain = cache->magazine[i];
+		}
+
+		cache->count -= POOL_BATCH_SIZE;
+		std::memmove(cache->magazine, cache->magazine + POOL_BATCH_SIZE, cache->count * sizeof(pool_node*));
+
+		push_depot(chain);
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::push_depot(pool_node* chain)
+	{
+		SpinlockHolder lk(&_depot_lock);
+		_depot.push_back(chain);
+	}
+
+	template<class T>
+	inline typename ThreadSafeObjectPool<T>::pool_node* ThreadSafeObjectPool<T>::pop_depot()
+	{
+		SpinlockHolder lk(&_depot_lock);
+		if (_depot.empty())
+			return NULL;
+
+		pool_node* chain = _depot.back();
+		_depot.pop_back();
+		return chain;
+	}
+
+	template<class T>
+	inline void ThreadSafeObjectPool<T>::delete_chain(pool_node* chain)
+	{
+		while (NULL != chain)
+		{
+			pool_node* next = chain->next;
+			SAFE_DELETE(chain);
+			chain = next;
+		}
+	}
+}
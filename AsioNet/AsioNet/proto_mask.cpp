@@ -0,0 +1,197 @@
+#include "proto_mask.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PROTO_MASK_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define PROTO_MASK_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PROTO_MASK_TARGET(isa)
+#endif
+
+// a 32 bit lane takes two 16 bit words per block, widen to 64 bit before it can wrap
+#define PROTO_MASK_BLOCKS_PER_ROUND 16384
+
+// one's complement sums don't care about byte order (RFC 1071): the kernels add little endian words,
+// which is a plain load on x86, and swap the folded result back into the big endian order the scalar
+// kernel and CsNetwork use. a folded sum is 0 only if every word was 0, so the result stays bit-exact
+
+namespace
+{
+    typedef uint32_t(*mask_kernel)(const unsigned char*, size_t, uint64_t);
+
+    inline uint32_t fold_to_16(uint64_t sum)
+    {
+        sum = (sum >> 32) + (sum & 0xffffffffull);
+        sum = (sum >> 32) + (sum & 0xffffffffull);
+        sum = (sum >> 16) + (sum & 0xffffull);
+        sum = (sum >> 16) + (sum & 0xffffull);
+        sum = (sum >> 16) + (sum & 0xffffull);
+        return (uint32_t)sum;
+    }
+
+    inline uint32_t swap_16(uint32_t folded)
+    {
+        return ((folded & 0xffu) << 8) | ((folded >> 8) & 0xffu);
+    }
+
+    inline uint64_t tail_le(const unsigned char* octetptr, size_t len, uint64_t sum)
+    {
+        while (len > 1)
+        {
+            sum += (uint64_t)octetptr[0] | ((uint64_t)octetptr[1] << 8);
+            octetptr += 2;
+            len -= 2;
+        }
+
+        if (len > 0)
+        {
+            sum += octetptr[0];
+        }
+
+        return sum;
+    }
+
+    uint32_t kernel_scalar(const unsigned char* octetptr, size_t len, uint64_t sum)
+    {
+        return fold_to_16(tail_le(octetptr, len, sum));
+    }
+
+#ifdef PROTO_MASK_X86
+    PROTO_MASK_TARGET("sse2")
+    uint32_t kernel_sse2(const unsigned char* octetptr, size_t len, uint64_t sum)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc64 = zero;
+
+        while (len >= 16)
+        {
+            size_t blocks = len / 16;
+            if (blocks > PROTO_MASK_BLOCKS_PER_ROUND)
+                blocks = PROTO_MASK_BLOCKS_PER_ROUND;
+
+            __m128i acc32 = zero;
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)octetptr);
+                acc32 = _mm_add_epi32(acc32, _mm_unpacklo_epi16(x, zero));
+                acc32 = _mm_add_epi32(acc32, _mm_unpackhi_epi16(x, zero));
+                octetptr += 16;
+            }
+
+            acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(acc32, zero));
+            acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(acc32, zero));
+            len -= blocks * 16;
+        }
+
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, acc64);
+        sum += lanes[0] + lanes[1];
+
+        return fold_to_16(tail_le(octetptr, len, sum));
+    }
+
+    PROTO_MASK_TARGET("avx2")
+    uint32_t kernel_avx2(const unsigned char* octetptr, size_t len, uint64_t sum)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc64 = zero;
+
+        while (len >= 32)
+        {
+            size_t blocks = len / 32;
+            if (blocks > PROTO_MASK_BLOCKS_PER_ROUND)
+                blocks = PROTO_MASK_BLOCKS_PER_ROUND;
+
+            __m256i acc32 = zero;
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)octetptr);
+                acc32 = _mm256_add_epi32(acc32, _mm256_unpacklo_epi16(x, zero));
+                acc32 = _mm256_add_epi32(acc32, _mm256_unpackhi_epi16(x, zero));
+                octetptr += 32;
+            }
+
+            acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(acc32, zero));
+            acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(acc32, zero));
+            len -= blocks * 32;
+        }
+
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, acc64);
+        sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+        return fold_to_16(tail_le(octetptr, len, sum));
+    }
+
+    bool cpu_has_avx2()
+    {
+#if defined(__GNUC__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    bool cpu_has_sse2()
+    {
+#if defined(__x86_64__) || defined(_M_X64)
+        return true;
+#elif defined(__GNUC__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2") != 0;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        return false;
+#endif
+    }
+#endif
+
+    mask_kernel select_kernel()
+    {
+#ifdef PROTO_MASK_X86
+        if (cpu_has_avx2())
+            return &kernel_avx2;
+
+        if (cpu_has_sse2())
+            return &kernel_sse2;
+#endif
+        return &kernel_scalar;
+    }
+
+    const mask_kernel wide_kernel = select_kernel();
+}
+
+uint32_t net_middleware::proto_mask::mask_off_32_wide(void* dataptr, size_t len, uint32_t acc)
+{
+    // the incoming acc is big endian like the result, move it into the little endian domain first
+    uint64_t sum = swap_16(fold_to_16(acc));
+
+    // kernels could be called before this TU's statics are set up, from another TU's static init
+    mask_kernel kernel = wide_kernel ? wide_kernel : &kernel_scalar;
+    return swap_16(kernel((const unsigned char*)dataptr, len, sum));
+}
@@ -1,5 +1,9 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+
+// below this many bytes the scalar loop beats the dispatched kernels
+#define PROTO_MASK_SIMD_MIN 64
 
 namespace net_middleware
 {
@@ -14,7 +18,32 @@ namespace net_middleware
 			return (uint16_t)~(inverseMask & 0xffff);
         }
 
+        // mask of the same payload sealed under new_head instead of old_head, the payload is not read again.
+        // both heads are encoded with a zero mask field, old_mask is what old_head was sealed with
+        static uint16_t update_mask(uint16_t old_mask, unsigned char* old_head, unsigned char* new_head, size_t head_len)
+        {
+            // ~old_mask is the folded sum of everything, swap the old head's share for the new one's (RFC 1624)
+            uint32_t acc = (uint16_t)~old_mask;
+            acc += (uint16_t)~mask_off_32_scalar(old_head, head_len, 0);
+            acc = mask_off_32_scalar(new_head, head_len, acc);
+            return (uint16_t)~(acc & 0xffff);
+        }
+
+        // picks the widest kernel the cpu supports, bit-exact with mask_off_32_scalar
         static uint32_t mask_off_32(void* dataptr, size_t len, uint32_t acc)
+        {
+            if (len < PROTO_MASK_SIMD_MIN)
+            {
+                return mask_off_32_scalar(dataptr, len, acc);
+            }
+
+            return mask_off_32_wide(dataptr, len, acc);
+        }
+
+        static uint32_t mask_off_32_wide(void* dataptr, size_t len, uint32_t acc);
+
+        // the reference kernel, keep it as is, CsNetwork computes exactly this
+        static uint32_t mask_off_32_scalar(void* dataptr, size_t len, uint32_t acc)
         {
             uint16_t src;
             unsigned char* octetptr;
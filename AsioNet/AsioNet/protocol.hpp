@@ -5,6 +5,14 @@
 
 #include "parallel_core/ThreadCacheContainer.h"
 #include "NetUtils.hpp"
+#include "proto_mask.hpp"
+
+#define PROTO_HEAD_SIZE ((size_t)11)
+
+// payload of one frame at most, head and payload have to fit the largest receive buffer
+#define PROTO_PAYLOAD_MAX (slab_buffer::class_capacity(SLAB_CLASS_NUM - 1) - PROTO_HEAD_SIZE)
+
+#define FRAME_KEY 0x2e
 
 namespace net_middleware
 {
@@ -18,93 +26,107 @@ namespace net_middleware
         Commands_BroadCast,
         Commands_ConnectionConfirm,
         Commands_Kick,
+        // server to proxy only, payload starts with a uint32 group id, see multicast_groups
+        Commands_GroupCast,
+        Commands_GroupJoin,
+        Commands_GroupLeave,
+        Commands_GroupDismiss,
+        // server to proxy only, see aoi_grid
+        Commands_AoiUpdate,
+        Commands_AoiRemove,
+        Commands_AoiCast,
+        // state snapshots on a channel the game server names, channel(2, little endian) | payload.
+        // server to proxy as uid(4) | channel(2) | snapshot; to clients that offered AAA_OFFER_DELTA:
+        //   RoutingState  channel(2) | snapshot, the client keeps it as the channel's base
+        //   RoutingDelta  channel(2) | xor_delta against the base, the client decodes it and keeps
+        //                 the result as the new base
+        // other clients get a plain RoutingTransparent snapshot. the delta sits inside the compressed
+        // and encrypted payload, undone after them. the proxy only sends a delta on a base it sent before
+        Commands_RoutingState,
+        Commands_RoutingDelta,
         Commands_RCriticalSI = 0xFFFF,
     };
 
-#pragma pack(push, 1)
+    // value type, decoded from and encoded to the 11 wire bytes explicitly, so the layout no longer
+    // depends on how a compiler packs bitfields:
+    // fk(1) | len(2) | mask(2) | cmd:15 compressed:1 (2) | seq(4), every field little endian
     struct protocol_head
     {
-#define HEAD_FROM_POOL parallel_core::ThreadSafeObjectPool<protocol_head>::instance()->get_shared()
-        typedef std::shared_ptr<protocol_head> head_sptr;
-
-#ifdef _MSC_VER
         unsigned char	fk;
         uint16_t		len;
         uint16_t		mask;
-        uint16_t		cmd_compressed_flag;
+        uint16_t		cmd;
+        bool			compressed;
         uint32_t		seq;
 
-        inline uint16_t get_cmd()
+        static constexpr protocol_head get_a_head(unsigned char fk_, uint16_t len_, uint16_t mask_, uint16_t cmd_, bool compressed_, uint32_t seq_)
         {
-#if LITTLE_ENDIAN
-            return (cmd_compressed_flag & 0x7FFF);
-#endif
+            return protocol_head{ fk_, len_, mask_, (uint16_t)(cmd_ & 0x7FFF), compressed_, seq_ };
         }
 
-        inline bool get_compressed()
+        static constexpr protocol_head decode(const unsigned char* head_block)
         {
-#if LITTLE_ENDIAN
-            return (cmd_compressed_flag >> 15) != 0;
-#endif
+            return protocol_head{
+                head_block[0],
+                read_uint16_le(head_block + 1),
+                read_uint16_le(head_block + 3),
+                (uint16_t)(read_uint16_le(head_block + 5) & 0x7FFF),
+                (read_uint16_le(head_block + 5) >> 15) != 0,
+                read_uint32_le(head_block + 7)
+            };
         }
 
-        static head_sptr get_a_head(unsigned char fk_, uint16_t len_, uint16_t mask_, uint16_t cmd_, bool compressed_, uint32_t seq_)
+        inline void encode(unsigned char* head_block) const
         {
-            head_sptr head = HEAD_FROM_POOL;
-            head->fk = fk_;
-            head->len = len_;
-            head->mask = mask_;
-#if LITTLE_ENDIAN
-            head->cmd_compressed_flag = compressed_ ? (uint16_t)(1 << 15) : (uint16_t)0;
-            head->cmd_compressed_flag |= (uint16_t)(cmd_ & 0x7FFF);
-#endif
-            head->seq = seq_;
-
-            return head;
+            head_block[0] = fk;
+            write_uint16_le(head_block + 1, len);
+            write_uint16_le(head_block + 3, mask);
+            write_uint16_le(head_block + 5, (uint16_t)((cmd & 0x7FFF) | (compressed ? 0x8000 : 0)));
+            write_uint32_le(head_block + 7, seq);
         }
-#else
-        unsigned char		fk;
-        uint16_t			len;
-        uint16_t			mask;
-        struct
+
+        // checksum over the encoded head and the payload, 0 on a received frame that is intact
+        inline uint16_t mask_of(unsigned char* data, size_t data_len, uint32_t acc = 0) const
         {
-            uint16_t		cmd : 15;
-            unsigned char	compressed : 1;
-        };
-        uint32_t			seq;
+            unsigned char head_block[PROTO_HEAD_SIZE];
+            encode(head_block);
+            return proto_mask::get_mask(head_block, sizeof(head_block), data, data_len, acc);
+        }
 
-        static head_sptr get_a_head(unsigned char fk_, uint16_t len_, uint16_t mask_, uint16_t cmd_, bool compressed_, uint32_t seq_)
+        // mask of this head over the payload sealed carries, the payload is not read again
+        inline uint16_t remask(const protocol_head& sealed) const
         {
-            head_sptr head = HEAD_FROM_POOL;
-            head->fk = fk_;
-            head->len = len_;
-            head->mask = mask_;
-            head->cmd = cmd_;
-            head->compressed = (unsigned char)compressed_;
-            head->seq = seq_;
-
-            return head;
+            unsigned char old_block[PROTO_HEAD_SIZE];
+            unsigned char new_block[PROTO_HEAD_SIZE];
+
+            protocol_head old_head = sealed;
+            old_head.mask = 0;
+            old_head.encode(old_block);
+
+            protocol_head new_head = *this;
+            new_head.mask = 0;
+            new_head.encode(new_block);
+
+            return proto_mask::update_mask(sealed.mask, old_block, new_block, PROTO_HEAD_SIZE);
         }
 
-        inline uint16_t get_cmd()
+        inline uint16_t get_cmd() const
         {
             return cmd;
         }
 
-        inline bool get_compressed()
+        inline bool get_compressed() const
         {
-            return compressed != 0;
+            return compressed;
         }
-#endif
 
         //serialize a msg
         static void pack(unsigned char* ret_block, uint16_t& ret_length, unsigned char* msg, uint16_t length, uint16_t cmd_, uint32_t seq_)
         {
-            head_sptr head = get_a_head(0x2e, length, 0, cmd_, 0, seq_);
-            ret_length = length + sizeof(protocol_head);
+            get_a_head(FRAME_KEY, length, 0, cmd_, 0, seq_).encode(ret_block);
+            ret_length = length + PROTO_HEAD_SIZE;
 
-            std::memcpy(ret_block, head.get(), sizeof(protocol_head));
-            std::memcpy(ret_block + sizeof(protocol_head), msg, length);
+            std::memcpy(ret_block + PROTO_HEAD_SIZE, msg, length);
         }
 
         static void pack(unsigned char* ret_block, uint16_t& ret_length, const std::vector<unsigned char*>& msgs, const std::vector<size_t>& lens, uint16_t cmd_, uint32_t seq_)
@@ -114,46 +136,53 @@ namespace net_middleware
 
             for (size_t i = 0; i < lens.size(); ++i)
             {
-                std::memcpy(ret_block + sizeof(protocol_head) + total_length, msgs[i], lens[i]);
+                std::memcpy(ret_block + PROTO_HEAD_SIZE + total_length, msgs[i], lens[i]);
                 total_length += lens[i];
             }
 
-            head_sptr head = get_a_head(0x2e, (uint16_t)total_length, 0, cmd_, 0, seq_);
-            ret_length = (uint16_t)(total_length + sizeof(protocol_head));
-            std::memcpy(ret_block, head.get(), sizeof(protocol_head));
+            get_a_head(FRAME_KEY, (uint16_t)total_length, 0, cmd_, 0, seq_).encode(ret_block);
+            ret_length = (uint16_t)(total_length + PROTO_HEAD_SIZE);
         }
 
-        static head_sptr unpack(unsigned char* ret_msg, uint16_t& ret_length, unsigned char* origin, uint16_t length)
+        static protocol_head unpack(unsigned char* ret_msg, uint16_t& ret_length, unsigned char* origin, uint16_t length)
         {
-            head_sptr head = HEAD_FROM_POOL;
-
-            std::memcpy(head.get(), origin, sizeof(protocol_head));
-            std::memcpy(ret_msg, origin + sizeof(protocol_head), length - sizeof(protocol_head));
+            std::memcpy(ret_msg, origin + PROTO_HEAD_SIZE, length - PROTO_HEAD_SIZE);
+            ret_length = length - PROTO_HEAD_SIZE;
 
-            return head;
+            return decode(origin);
         }
 
-        static head_sptr unpack_head(unsigned char* head_block)
+        static void unpack_msg(unsigned char* ret_msg, unsigned char* msg_block, uint16_t length)
         {
-            head_sptr head = HEAD_FROM_POOL;
-
-            std::memcpy(head.get(), head_block, sizeof(protocol_head));
-
-            return head;
+            std::memcpy(ret_msg, msg_block, length);
         }
 
-        static void unpack_head(head_sptr head, unsigned char* head_block)
+        // kick, heartbeat and authentication frames must not wait in a corked send queue
+        static bool is_latency_critical(unsigned char* head_block)
         {
-            std::memcpy(head.get(), head_block, sizeof(protocol_head));
-        }
+            protocol_head head = decode(head_block);
 
-        static void unpack_msg(unsigned char* ret_msg, unsigned char* msg_block, uint16_t length)
-        {
-            std::memcpy(ret_msg, msg_block, length);
+            uint16_t cmd = head.get_cmd();
+            return head.len == 0 ||
+                cmd == (uint16_t)protocol_cmd::Commands_Heartbeat ||
+                cmd == (uint16_t)protocol_cmd::Commands_Kick ||
+                cmd == (uint16_t)protocol_cmd::Commands_AuthenticationAAA;
         }
     };
 
-    
+// high bit of the offered suites byte, the client inflates raw deflate frames;
+// echoed in the response's suite byte when the proxy agrees
+#define AAA_OFFER_RAW_DEFLATE 0x80
+// next bit, the client keeps a deflate stream per direction across frames, wins over raw deflate
+#define AAA_OFFER_DEFLATE_STREAM 0x40
+// the client has the preset dictionary named by the request's dictionary_id, raw deflate primed with it
+#define AAA_OFFER_DICTIONARY 0x20
+// the client decodes lz_codec frames, wins over the deflate variants but a configured deflate stream
+#define AAA_OFFER_LZ 0x10
+// the client keeps state channel bases and decodes Commands_RoutingDelta frames
+#define AAA_OFFER_DELTA 0x08
+
+#pragma pack(push, 1)
     struct authentication_aaa_request
     {
         uint16_t		area_id;
@@ -161,11 +190,15 @@ namespace net_middleware
         unsigned char	link_type;
         std::string		platform;
         uint16_t		platform_len;
+        // CIPHER_SUITE_BIT flags the client speaks | AAA_OFFER_* bits, 0 from clients that only know rc4
+        unsigned char	cipher_suites;
+        // compress_dictionary id, 0 unless cipher_suites has AAA_OFFER_DICTIONARY
+        uint32_t		dictionary_id;
 
-        typedef std::shared_ptr<authentication_aaa_request> aaa_req_sptr;
-#define AAA_REQ_FROM_POOL parallel_core::ThreadSafeObjectPool<authentication_aaa_request>::instance()->get_shared()
+        typedef parallel_core::PoolHandle<authentication_aaa_request> aaa_req_sptr;
+#define AAA_REQ_FROM_POOL parallel_core::ThreadSafeObjectPool<authentication_aaa_request>::instance()->get_handle()
 
-        static void pack(unsigned char* ret_block, uint16_t& ret_length, uint16_t area_id_, uint16_t server_id_, unsigned char link_type_,  unsigned char* platform_, uint16_t platform_len_)
+        static void pack(unsigned char* ret_block, uint16_t& ret_length, uint16_t area_id_, uint16_t server_id_, unsigned char link_type_,  unsigned char* platform_, uint16_t platform_len_, unsigned char cipher_suites_ = 0, uint32_t dictionary_id_ = 0)
         {
             write_uint16(ret_block, area_id_);
             write_uint16(ret_block + 2, server_id_);
@@ -175,11 +208,44 @@ namespace net_middleware
             write_uint16(msg_start + platform_len_ + 1, platform_len_);
 
             ret_length = 2 + 2 + 1 + platform_len_ + 1 + 2;
+
+            // the dictionary id goes in front of the suites byte
+            if (dictionary_id_ != 0)
+            {
+                write_uint32(ret_block + ret_length, dictionary_id_);
+                ret_length += 4;
+                cipher_suites_ |= AAA_OFFER_DICTIONARY;
+            }
+
+            // trailing byte, the legacy layout ends at platform_len
+            if (cipher_suites_ != 0)
+            {
+                ret_block[ret_length] = cipher_suites_;
+                ret_length += 1;
+            }
         }
 
         static aaa_req_sptr unpack(unsigned char* block, uint16_t length)
         {
             auto msg = AAA_REQ_FROM_POOL;
+
+            // the suites byte is there if the terminator and platform_len line up one byte earlier,
+            // a legacy frame can't match: its platform would have to end with '\0'
+            msg->cipher_suites = 0;
+            msg->dictionary_id = 0;
+            if (length >= 13 && (block[length - 1] & AAA_OFFER_DICTIONARY) &&
+                block[length - 8] == '\0' && read_uint16(block + length - 7) == length - 13)
+            {
+                // same with the 4 byte dictionary id in between
+                msg->cipher_suites = block[length - 1];
+                msg->dictionary_id = read_uint32(block + length - 5);
+                length -= 5;
+            }
+            else if (length >= 9 && block[length - 4] == '\0' && read_uint16(block + length - 3) == length - 9)
+            {
+                msg->cipher_suites = block[length - 1];
+                length -= 1;
+            }
             
             msg->platform_len = length - 8;
 
@@ -202,7 +268,11 @@ namespace net_middleware
         uint16_t		key_len;
         uint32_t		link_no;
         unsigned char	link_type;
+        unsigned char	cipher_mode;
+        unsigned char	cipher_suite;
 
+        // @param key_ rc4 key, followed by CIPHER_KEY_LEN bytes for any other suite
+        // @param cipher_mode_ rc4_context::Mode, cipher_suite_ CipherSuite | the accepted AAA_OFFER_* bit, both go into bytes older clients never read
         static void pack(unsigned char* ret, uint16_t& ret_length,
             unsigned char	ec_,
             unsigned char	subtract_,
@@ -210,7 +280,9 @@ namespace net_middleware
             unsigned char*	key_,
             uint16_t		key_len_,
             uint32_t		link_no_,
-            unsigned char	link_type_)
+            unsigned char	link_type_,
+            unsigned char	cipher_mode_ = 0,
+            unsigned char	cipher_suite_ = 0)
         {
             ret[0] = ec_;
             ret[1] = subtract_;
@@ -218,12 +290,14 @@ namespace net_middleware
             std::memcpy(&(ret[3]), key_, (size_t)key_len_);
             write_uint32(&(ret[key_len_ + 3]), link_no_);
             ret[key_len_ + 3 + 4] = link_type_;
+            ret[key_len_ + 3 + 4 + 1] = cipher_mode_;
+            ret[key_len_ + 3 + 4 + 2] = cipher_suite_;
 
             ret_length = 1 + 1 + 1 + key_len_ + 2 + 4 + 1;
         }
 
-        typedef std::shared_ptr<authentication_aaa_response> aaa_res_sptr;
-#define AAA_RES_FROM_POOL parallel_core::ThreadSafeObjectPool<authentication_aaa_response>::instance()->get_shared()
+        typedef parallel_core::PoolHandle<authentication_aaa_response> aaa_res_sptr;
+#define AAA_RES_FROM_POOL parallel_core::ThreadSafeObjectPool<authentication_aaa_response>::instance()->get_handle()
 
         static aaa_res_sptr unpack(unsigned char* block, uint16_t length)
         {
@@ -235,6 +309,8 @@ namespace net_middleware
             msg->key_len = length - 11;
             msg->key = std::string((char*)&block[3], msg->key_len);
             msg->link_no = read_uint32(block + msg->key_len + 1 + 3);
+            msg->cipher_mode = block[length - 2];
+            msg->cipher_suite = block[length - 1];
 
             return msg;
         }
@@ -244,8 +320,8 @@ namespace net_middleware
     {
         uint32_t ip;
 
-        typedef std::shared_ptr<session_connect_confirm> confirm_sptr;
-#define CONFIRM_FROM_POOL parallel_core::ThreadSafeObjectPool<session_connect_confirm>::instance()->get_shared()
+        typedef parallel_core::PoolHandle<session_connect_confirm> confirm_sptr;
+#define CONFIRM_FROM_POOL parallel_core::ThreadSafeObjectPool<session_connect_confirm>::instance()->get_handle()
 
         static void pack(unsigned char* ret_block, uint16_t& ret_length,
             uint32_t ip
@@ -267,8 +343,9 @@ namespace net_middleware
 #pragma pack(pop)
 }
 
-#define PROTO_HEAD_SIZE sizeof(net_middleware::protocol_head)
-
-#define FRAME_KEY 0x2e
 
-#define K_SIZE_COMPRESS 64
\ No newline at end of file
+#define K_SIZE_COMPRESS 64
+#define K_SIZE_COMPRESS_DICT 16 // a preset dictionary pays off on much smaller payloads
+#define K_SIZE_STREAM_MAX 1024 * 32 // bigger frames skip the connection stream, they gain little from history
+#define K_SIZE_DELTA_BASE_MAX 1024 * 4 // bigger snapshots go whole, every client keeps a base per channel
+#define K_DELTA_CHANNELS_MAX 16
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "default_session_logic.h"
 #include "server_session_logic.h"
 #include "client_session_logic.h"
+#include "compress_policy.h"
+#include "parallel_core/EpochReclaimer.h"
 
 using namespace std;
 using namespace net_middleware;
@@ -13,15 +15,29 @@ net_middleware::proxy_manager::proxy_manager():
 	_acceptor_executor(new async_job_executor(1)),
 	_acceptor_job_agent(JOB_AGENT(_acceptor_executor)),
 	_acceptor(_acceptor_job_agent->strand_to_run(), tcp::endpoint(tcp::v4(), _config.listened_port_)),
+	_servers_by_id(new server_index()),
 	_session_excutor(new async_job_executor(_config.session_thread_num_)),
-	_clean_up_timer(_acceptor_executor->context_to_run())
+	_maintain_timer(_acceptor_executor->context_to_run())
 {
-	
+    for (auto& entry : _config.compress_dictionaries_)
+    {
+        auto dictionary = compress_dictionary::load(entry.first, entry.second);
+        if (!dictionary)
+        {
+            LOG("failed to load compress dictionary %u: %s", entry.first, entry.second.c_str());
+            continue;
+        }
+
+        _dictionaries[entry.first] = dictionary;
+    }
+
+    COMPRESS_POLICY->configure(_config.compress_cpu_threshold_, _config.session_thread_num_);
 }
 
 net_middleware::proxy_manager::~proxy_manager()
 {
-    _clean_up_timer.cancel();
+    _maintain_timer.cancel();
+    delete _servers_by_id.load();
 }
 
 void net_middleware::proxy_manager::start()
@@ -34,7 +50,7 @@ void net_middleware::proxy_manager::start()
 
 	accept_a_session();
 
-	clean_up_closed_session();
+	maintain();
 }
 
 void net_middleware::proxy_manager::accept_a_session()
@@ -46,6 +62,8 @@ void net_middleware::proxy_manager::accept_a_session()
 
 		auto new_session = std::make_shared<basic_async_session>(_session_excutor);
         new_session->modify_session_logic(DEFAULT_SESSION_LOGIC);
+        new_session->set_send_queue_cap(_config.send_queue_cap_);
+        new_session->set_send_cork(_config.send_cork_bytes_, std::chrono::milliseconds(_config.max_send_delay_));
 		_acceptor.async_accept(new_session->socket_to_accept(), [new_session, this](asio::error_code ec) {
 			if (UNLIKELY(ec))
 			{
@@ -58,7 +76,16 @@ void net_middleware::proxy_manager::accept_a_session()
                 LOG_NON_SENSITIVE("accept a new session");
             }
 
-            _un_managed_sessions.insert(new_session->get_uuid(), new_session);
+            session_uid uid = _sessions.add(new_session, session_role::UNMANAGED);
+            if (UNLIKELY(uid == 0))
+            {
+                LOG("session registry is full, %llu sessions", (unsigned long long)_sessions.size());
+                new_session->close(false);
+                accept_a_session();
+                return;
+            }
+            new_session->set_uuid(uid);
+            new_session->set_close_handler([this](const session_sptr& session) { unregister_session(session); });
 
             new_session->passively_connect_succ();
 
@@ -82,31 +109,15 @@ bool net_middleware::proxy_manager::verify_authentication(SessionType session_ty
 {
 	if (session_type_ == SessionType::CLIENT_PROXY)
 	{
-		bool find = false;
         session_sptr target_server_session;
-		auto find_method = [&find, server_id_, &target_uid, &target_server_session](std::unordered_map<session_uid, session_sptr> container) {
-			for (auto& pair : container)
-			{
-                auto logic = pair.second->get_logic();
-
-                auto server_logic = session_logic_interface::session_cast<server_session_logic>(logic);
-                if (server_logic->get_server_id() == server_id_)
-                {
-                    *target_uid = pair.second->get_uuid();
-                    target_server_session = pair.second;
-                    find = true;
-                }
-			}
-		};
-
-		_server_sessions.complex_operation(find_method);
-
-		if (!find)
+		if (!find_server(server_id_, target_server_session))
 		{
 			LOG("cannot find server, self session type: %d,  target server_id: %llu", session_type_, server_id_);
 			return false;
 		}
 
+        *target_uid = target_server_session->get_uuid();
+
         // send confirm connect msg to server
         auto logic = target_server_session->get_logic();
         auto server_logic = session_logic_interface::session_cast<server_session_logic>(logic);
@@ -114,11 +125,17 @@ bool net_middleware::proxy_manager::verify_authentication(SessionType session_ty
 
         move_client_available(session_uid_);
 
+        {
+            std::lock_guard<std::mutex> lock(_clients_by_server_mut);
+            _clients_by_server[*target_uid].insert(session_uid_);
+        }
+
 		return true;
 	}
     else if (session_type_ > SessionType::MULTI_SESSION_BEGIN)
     {
-        if (UNLIKELY(_server_sessions.contains_key(session_uid_)))
+        session_sptr server;
+        if (UNLIKELY(_sessions.try_get(session_uid_, session_role::SERVER, server)))
         {
             LOG("duplicate server, %d", session_uid_);
             return false;
@@ -136,7 +153,7 @@ bool net_middleware::proxy_manager::verify_authentication(SessionType session_ty
 void net_middleware::proxy_manager::send_to_server(session_uid target, once_buffer_sptr msg)
 {
 	session_sptr server;
-	if (UNLIKELY(!_server_sessions.try_get(target, server)))
+	if (UNLIKELY(!_sessions.try_get(target, session_role::SERVER, server)))
 	{
 		LOG("target session id not found, uid %d", target);
 		return;
@@ -148,7 +165,7 @@ void net_middleware::proxy_manager::send_to_server(session_uid target, once_buff
 void net_middleware::proxy_manager::send_to_server_multi(session_uid target, tiny_buffer_sptr head, once_buffer_sptr msg)
 {
     session_sptr server;
-    if (UNLIKELY(!_server_sessions.try_get(target, server)))
+    if (UNLIKELY(!_sessions.try_get(target, session_role::SERVER, server)))
     {
         LOG("target session id not found, uid %d", target);
         return;
@@ -160,7 +177,7 @@ void net_middleware::proxy_manager::send_to_server_multi(session_uid target, tin
 void net_middleware::proxy_manager::send_to_client(session_uid client_uid, once_buffer_sptr msg)
 {
 	session_sptr client;
-	if (UNLIKELY(!_client_sessions.try_get(client_uid, client)))
+	if (UNLIKELY(!_sessions.try_get(client_uid, session_role::CLIENT, client)))
 	{
 		LOG("cannot find client, client uid: %lu", client_uid);
 		return;
@@ -169,10 +186,22 @@ void net_middleware::proxy_manager::send_to_client(session_uid client_uid, once_
 	client->async_send(msg);
 }
 
+void net_middleware::proxy_manager::send_state_to_client(session_uid client_uid, once_buffer_sptr msg)
+{
+    session_sptr client;
+    if (UNLIKELY(!_sessions.try_get(client_uid, session_role::CLIENT, client)))
+    {
+        LOG("cannot find client, client uid: %u", client_uid);
+        return;
+    }
+
+    client->async_send_state(msg);
+}
+
 void net_middleware::proxy_manager::send_to_client_multi(session_uid client_uid, tiny_buffer_sptr head, once_buffer_sptr msg)
 {
     session_sptr client;
-    if (UNLIKELY(!_client_sessions.try_get(client_uid, client)))
+    if (UNLIKELY(!_sessions.try_get(client_uid, session_role::CLIENT, client)))
     {
         LOG("cannot find client, client uid: %lu", client_uid);
         return;
@@ -181,13 +210,228 @@ void net_middleware::proxy_manager::send_to_client_multi(session_uid client_uid,
     client->async_send_multi(head, msg);
 }
 
+std::shared_ptr<const compress_dictionary> net_middleware::proxy_manager::find_dictionary(uint32_t dictionary_id) const
+{
+    auto iter = _dictionaries.find(dictionary_id);
+    return iter == _dictionaries.end() ? nullptr : iter->second;
+}
+
+void net_middleware::proxy_manager::broadcast_to_clients(const std::vector<session_uid>& client_uids, once_buffer_sptr msg)
+{
+    std::vector<session_sptr> clients;
+    if (UNLIKELY(_sessions.try_get_all(client_uids, session_role::CLIENT, clients) < client_uids.size()))
+    {
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            if (!clients[i])
+            {
+                LOG("cannot find client, client uid: %u", client_uids[i]);
+            }
+        }
+    }
+
+    broadcast_to_sessions(clients, msg);
+}
+
+void net_middleware::proxy_manager::broadcast_to_sessions(const std::vector<session_sptr>& clients, once_buffer_sptr msg)
+{
+    // one compressed payload per format and dictionary, split again by the strand that owns them,
+    // strands[b] are the targets of payloads[b]
+    typedef std::shared_ptr<std::vector<session_sptr>> strand_group;
+    std::vector<shared_payload> payloads;
+    std::vector<std::vector<std::pair<asio::io_context::strand*, strand_group>>> strands;
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        const session_sptr& client = clients[i];
+        if (UNLIKELY(!client))
+        {
+            continue;
+        }
+
+        auto cln_logic = session_logic_interface::session_cast<client_session_logic>(client->get_logic());
+        if (!cln_logic || cln_logic->get_compress_format() == CompressFormat::DEFLATE_STREAM)
+        {
+            send_private_copy(client, msg);
+            continue;
+        }
+
+        size_t b = find_shared_payload(payloads, cln_logic->get_compress_format(), cln_logic->get_dictionary(), msg, protocol_cmd::Commands_BroadCast);
+        strands.resize(payloads.size());
+
+        // as many strands as session threads
+        auto& groups = strands[b];
+        asio::io_context::strand* strand = &client->strand_to_run();
+        size_t s = 0;
+        while (s < groups.size() && groups[s].first != strand)
+        {
+            ++s;
+        }
+
+        if (s == groups.size())
+        {
+            groups.push_back(std::make_pair(strand, std::make_shared<std::vector<session_sptr>>()));
+        }
+
+        groups[s].second->push_back(client);
+    }
+
+    for (size_t b = 0; b < payloads.size(); ++b)
+    {
+        once_buffer_sptr payload = payloads[b].payload;
+        bool compressed = payloads[b].compressed;
+
+        for (auto& group : strands[b])
+        {
+            // dispatch keeps the order against a unicast the caller sends right after
+            strand_group sessions = group.second;
+            group.first->dispatch([sessions, payload, compressed]() {
+                broadcast_in_strand(*sessions, payload, compressed);
+            });
+        }
+    }
+}
+
+void net_middleware::proxy_manager::multicast_to_clients(const std::vector<multicast_partition>& partitions, once_buffer_sptr msg)
+{
+    std::vector<shared_payload> payloads;
+
+    for (auto& partition : partitions)
+    {
+        auto members = partition.members;
+
+        if (partition.format == CompressFormat::DEFLATE_STREAM)
+        {
+            for (auto& client : *members)
+            {
+                send_private_copy(client, msg);
+            }
+            continue;
+        }
+
+        size_t b = find_shared_payload(payloads, partition.format, partition.dictionary, msg, protocol_cmd::Commands_GroupCast);
+
+        once_buffer_sptr payload = payloads[b].payload;
+        bool compressed = payloads[b].compressed;
+        partition.strand->dispatch([members, payload, compressed]() {
+            broadcast_in_strand(*members, payload, compressed);
+        });
+    }
+}
+
+size_t net_middleware::proxy_manager::find_shared_payload(std::vector<shared_payload>& payloads, CompressFormat format,
+    const compress_dictionary* dictionary, once_buffer_sptr msg, protocol_cmd cmd)
+{
+    size_t b = 0;
+    while (b < payloads.size() && (payloads[b].format != format || payloads[b].dictionary != dictionary))
+    {
+        ++b;
+    }
+
+    if (b == payloads.size())
+    {
+        shared_payload shared = { format, dictionary, msg, false };
+        shared.compressed = client_session_logic::compress_to_send(shared.payload, format, dictionary, cmd);
+        payloads.push_back(shared);
+    }
+
+    return b;
+}
+
+void net_middleware::proxy_manager::send_private_copy(const session_sptr& client, once_buffer_sptr msg)
+{
+    auto copy = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + msg->length);
+    copy->offset = PROTO_HEAD_SIZE;
+    copy->length = msg->length;
+    std::memcpy(copy->buffer(), msg->buffer(), msg->length);
+
+    client->async_send(copy);
+}
+
+size_t net_middleware::proxy_manager::find_clients(const std::vector<session_uid>& client_uids, std::vector<session_sptr>& clients)
+{
+    return _sessions.try_get_all(client_uids, session_role::CLIENT, clients);
+}
+
+void net_middleware::proxy_manager::broadcast_in_strand(const std::vector<session_sptr>& sessions, once_buffer_sptr payload, bool compressed)
+{
+    std::vector<once_buffer_sptr> buffers(sessions.size());
+    std::vector<const rc4_context*> contexts;
+    std::vector<unsigned char*> datas;
+
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        // a group may still list a member that went away since
+        if (UNLIKELY(sessions[i]->get_state() != basic_async_session::StateSocket::CONNECTING))
+        {
+            continue;
+        }
+
+        auto cln_logic = session_logic_interface::session_cast<client_session_logic>(sessions[i]->get_logic());
+        if (UNLIKELY(!cln_logic))
+        {
+            continue;
+        }
+
+        auto copy = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + payload->length);
+        copy->offset = PROTO_HEAD_SIZE;
+        copy->length = payload->length;
+        std::memcpy(copy->buffer(), payload->buffer(), payload->length);
+        buffers[i] = copy;
+
+        // reset mode rc4 goes side by side, stream keystreams are this strand's to advance
+        const rc4_context* context = cln_logic->shared_encryptor();
+        if (context != NULL)
+        {
+            contexts.push_back(context);
+            datas.push_back(copy->buffer());
+        }
+        else
+        {
+            cln_logic->encrypt(copy->buffer(), copy->length);
+        }
+    }
+
+    rc4_context::crypt_multi(contexts.data(), datas.data(), contexts.size(), payload->length);
+
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        if (buffers[i])
+        {
+            sessions[i]->send_encrypted(buffers[i], compressed);
+        }
+    }
+}
+
+void net_middleware::proxy_manager::forward_to_server(session_uid target, tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len)
+{
+    session_sptr server;
+    if (UNLIKELY(!_sessions.try_get(target, session_role::SERVER, server)))
+    {
+        LOG("target session id not found, uid %d", target);
+        return;
+    }
+
+    server->async_send_cut_through(head, holder, payload, len);
+}
+
+void net_middleware::proxy_manager::forward_to_client(session_uid client_uid, tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len)
+{
+    session_sptr client;
+    if (UNLIKELY(!_sessions.try_get(client_uid, session_role::CLIENT, client)))
+    {
+        LOG("cannot find client, client uid: %u", client_uid);
+        return;
+    }
+
+    client->async_send_cut_through(head, holder, payload, len);
+}
+
 void net_middleware::proxy_manager::move_client_available(session_uid client_uid)
 {
     session_sptr c_s;
-    if (LIKELY(_un_managed_sessions.try_get(client_uid, c_s)))
+    if (LIKELY(_sessions.try_get(client_uid, session_role::UNMANAGED, c_s)))
     {
-        _un_managed_sessions.erase(client_uid);
-        
         auto origin_logic = c_s->get_logic();
         if (UNLIKELY(origin_logic->get_session_type() != SessionType::SINGLE_SESSION_BEGIN))
         {
@@ -200,27 +444,25 @@ void net_middleware::proxy_manager::move_client_available(session_uid client_uid
         
         c_s->modify_session_logic(session_logic_interface::session_cast<session_logic_interface>(new_client_logic));
 
-        if (UNLIKELY(!_client_sessions.insert(client_uid, c_s)))
+        if (UNLIKELY(!_sessions.change_role(client_uid, session_role::UNMANAGED, session_role::CLIENT)))
         {
             LOG("duplicate client session %d", client_uid);
         }
     }
     else
     {
-        LOG("_un_managed_sessions doesn't have this session %u, please check", client_uid);
+        LOG("no unmanaged session %u, please check", client_uid);
     }
 	
 }
 
 void net_middleware::proxy_manager::move_server_available(session_uid server_uid)
 {
-    LOG_NON_SENSITIVE("move server, log size: %llu", _un_managed_sessions.size());
+    LOG_NON_SENSITIVE("move server, log size: %llu", (unsigned long long)_sessions.size());
 
     session_sptr s_s;
-    if (LIKELY(_un_managed_sessions.try_get(server_uid, s_s)))
+    if (LIKELY(_sessions.try_get(server_uid, session_role::UNMANAGED, s_s)))
     {
-        _un_managed_sessions.erase(server_uid);
-
         auto origin_logic = s_s->get_logic();
         if (UNLIKELY(origin_logic->get_session_type() != SessionType::SINGLE_SESSION_BEGIN))
         {
@@ -233,21 +475,24 @@ void net_middleware::proxy_manager::move_server_available(session_uid server_uid
 
         s_s->modify_session_logic(session_logic_interface::session_cast<session_logic_interface>(new_server_logic));
 
-        if (UNLIKELY(!_server_sessions.insert(server_uid, s_s)))
+        if (UNLIKELY(!_sessions.change_role(server_uid, session_role::UNMANAGED, session_role::SERVER)))
         {
             LOG("duplicate server session %d", server_uid);
+            return;
         }
+
+        update_server_index(new_server_logic->get_server_id(), server_uid, true);
     }
     else
     {
-        LOG("_un_managed_sessions doesn't have this session %u, please check", server_uid);
+        LOG("no unmanaged session %u, please check", server_uid);
     }
 }
 
 bool net_middleware::proxy_manager::kick_one_client(session_uid client_uid)
 {
     session_sptr cln;
-    if (LIKELY(_client_sessions.try_get(client_uid, cln)))
+    if (LIKELY(_sessions.try_get(client_uid, session_role::CLIENT, cln)))
     {
         cln->kick();
         return true;
@@ -259,62 +504,162 @@ bool net_middleware::proxy_manager::kick_one_client(session_uid client_uid)
     }
 }
 
-bool net_middleware::proxy_manager::kick_server_peer(SessionType server_type)
+bool net_middleware::proxy_manager::kick_server_peer(session_uid server_uid)
 {
-    auto kick_method = [server_type](std::unordered_map<session_uid, session_sptr> container) {
-        for (auto& pair : container)
+    std::vector<session_uid> client_uids;
+    {
+        std::lock_guard<std::mutex> lock(_clients_by_server_mut);
+        auto iter = _clients_by_server.find(server_uid);
+        if (iter == _clients_by_server.end())
         {
-            auto logic = pair.second->get_logic();
-            auto cln_logic = session_logic_interface::session_cast<client_session_logic>(logic);
-            if (cln_logic->get_target_server_type() == server_type)
-            {
-                pair.second->kick();
-            }
+            return false;
         }
-    };
 
-    _client_sessions.complex_operation(kick_method);
+        client_uids.assign(iter->second.begin(), iter->second.end());
+        _clients_by_server.erase(iter);
+    }
 
-    auto kick_self_method = [server_type](std::unordered_map<session_uid, session_sptr> container) {
-        for (auto& pair : container)
+    for (session_uid client_uid : client_uids)
+    {
+        session_sptr client;
+        if (_sessions.try_get(client_uid, session_role::CLIENT, client))
         {
-            auto logic = pair.second->get_logic();
-            if (logic->get_session_type() == server_type)
+            client->kick();
+        }
+    }
+
+    return true;
+}
+
+bool net_middleware::proxy_manager::find_server(server_id server_id_, session_sptr& server)
+{
+    session_uid server_uid;
+    {
+        parallel_core::EpochGuard guard;
+        const server_index* index = _servers_by_id.load(std::memory_order_acquire);
+        auto iter = index->find(server_id_);
+        if (iter == index->end())
+        {
+            return false;
+        }
+
+        server_uid = iter->second;
+    }
+
+    return _sessions.try_get(server_uid, session_role::SERVER, server);
+}
+
+void net_middleware::proxy_manager::update_server_index(server_id server_id_, session_uid server_uid, bool add)
+{
+    std::lock_guard<std::mutex> lock(_servers_by_id_mut);
+    const server_index* old_index = _servers_by_id.load(std::memory_order_relaxed);
+
+    // a server that reconnected before its old session was cleaned keeps the newer entry
+    auto iter = old_index->find(server_id_);
+    if (!add && (iter == old_index->end() || iter->second != server_uid))
+    {
+        return;
+    }
+
+    // a few dozen servers, copying is cheaper than making every login take a lock
+    server_index* new_index = new server_index(*old_index);
+    if (add)
+    {
+        (*new_index)[server_id_] = server_uid;
+    }
+    else
+    {
+        new_index->erase(server_id_);
+    }
+
+    _servers_by_id.store(new_index, std::memory_order_release);
+    EPOCH_RECLAIMER->retire([old_index]() { delete old_index; });
+}
+
+void net_middleware::proxy_manager::unindex_session(const session_sptr& session, session_role role)
+{
+    if (role == session_role::CLIENT)
+    {
+        auto cln_logic = session_logic_interface::session_cast<client_session_logic>(session->get_logic());
+        if (UNLIKELY(!cln_logic))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_clients_by_server_mut);
+        auto iter = _clients_by_server.find(cln_logic->get_target_uid());
+        if (iter != _clients_by_server.end())
+        {
+            iter->second.erase(session->get_uuid());
+            if (iter->second.empty())
             {
-                pair.second->kick();
+                _clients_by_server.erase(iter);
             }
         }
-    };
-    
-    _server_sessions.complex_operation(kick_self_method);
+    }
+    else if (role == session_role::SERVER)
+    {
+        auto server_logic = session_logic_interface::session_cast<server_session_logic>(session->get_logic());
+        if (UNLIKELY(!server_logic))
+        {
+            return;
+        }
+
+        update_server_index(server_logic->get_server_id(), session->get_uuid(), false);
 
-    return false;
+        // its clients are kicked or cleaned on their own, the set only held their uids
+        std::lock_guard<std::mutex> lock(_clients_by_server_mut);
+        _clients_by_server.erase(session->get_uuid());
+    }
 }
 
-void net_middleware::proxy_manager::clean_up_closed_session()
+void net_middleware::proxy_manager::unregister_session(const session_sptr& session)
 {
-	_clean_up_timer.expires_from_now(std::chrono::milliseconds(PROXY_CLEAN_PERIOD_MS));
+    session_role role;
+    if (UNLIKELY(!_sessions.erase(session->get_uuid(), &role)))
+    {
+        return;
+    }
 
-	_clean_up_timer.async_wait([this](asio::error_code ec) {
+    unindex_session(session, role);
+
+    // the server's groups and grid hold the client too, they drop it in the server's strand
+    if (role == session_role::CLIENT)
+    {
+        session_sptr server;
+        auto cln_logic = session_logic_interface::session_cast<client_session_logic>(session->get_logic());
+        if (cln_logic && _sessions.try_get(cln_logic->get_target_uid(), session_role::SERVER, server))
+        {
+            session_uid client_uid = session->get_uuid();
+            server->strand_to_run().post([server, client_uid]() {
+                auto server_logic = session_logic_interface::session_cast<server_session_logic>(server->get_logic());
+                if (server_logic)
+                {
+                    server_logic->forget_client(client_uid);
+                }
+            });
+        }
+    }
+
+    // a mass disconnect frees its sessions as it goes, not at the next tick
+    EPOCH_RECLAIMER->collect();
+}
+
+void net_middleware::proxy_manager::maintain()
+{
+	_maintain_timer.expires_from_now(std::chrono::milliseconds(PROXY_CLEAN_PERIOD_MS));
+
+	_maintain_timer.async_wait([this](asio::error_code ec) {
 		if (UNLIKELY(ec))
 		{
 			LOG("timer error occurred %s", ec.message().c_str());
 		}
 
-		auto close_method = [](std::unordered_map<session_uid, session_sptr> container) {
-			for (auto iter = container.begin(); iter != container.end();)
-			{
-				if (iter->second->is_session_closed())
-					iter = container.erase(iter);
-				else
-					++iter;
-			}
-		};
-
-		_client_sessions.complex_operation(close_method);
+        // the last few retires of a burst wait for an epoch nobody moves on otherwise
+        EPOCH_RECLAIMER->collect();
 
-		_server_sessions.complex_operation(close_method);
+        COMPRESS_POLICY->update_cpu_load();
 
-		clean_up_closed_session();
+		maintain();
 	});
 }
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "parallel_core/SafeSingleton.h"
-#include "parallel_core/SafeHashMap.hpp"
 #include "JsonUtils.hpp"
 #include "NetUtils.hpp"
 #include "basic_async_session.h"
+#include "multicast_group.h"
+#include "session_registry.hpp"
 
 namespace net_middleware
 {
@@ -18,7 +22,21 @@ namespace net_middleware
 		uint16_t session_thread_num_;
         uint32_t tick_interval_;
         uint32_t keep_alive_timeout_;
+        // ms a session may hold frames smaller than send_cork_bytes_ to write them in one go, every routed
+        // frame under the threshold can wait this long at each hop, so keep it to a few ms; 0 disables corking
         uint32_t max_send_delay_;
+        uint32_t send_queue_cap_;
+        // queued bytes that flush a corked session before max_send_delay_ runs out, about one mss
+        uint32_t send_cork_bytes_;
+        bool cut_through_;
+        bool rc4_stream_;
+        bool compress_stream_;
+        uint32_t compress_cpu_threshold_;
+        // side of an aoi_grid cell in the game servers' units, best near the radius they cast with
+        int32_t aoi_cell_size_;
+        // preset dictionary id -> file, one per protocol version clients may still speak,
+        // [ { "id": 1, "path": "proto_v1.dict" } ] with files from DictTrainer
+        std::vector<std::pair<uint32_t, std::string>> compress_dictionaries_;
 		
 		proxy_config(const std::string& filepath = "../../../../proxy_config.json")
 		{
@@ -31,6 +49,21 @@ namespace net_middleware
                     tick_interval_      = _dom["tick_interval"].GetInt();
                     keep_alive_timeout_ = _dom["keep_alive_timeout"].GetInt();
                     max_send_delay_     = _dom["max_send_delay"].GetInt();
+                    send_queue_cap_     = _dom["send_queue_cap"].GetInt();
+                    send_cork_bytes_    = _dom["send_cork_bytes"].GetInt();
+                    cut_through_        = _dom["cut_through"].GetBool();
+                    rc4_stream_         = _dom["rc4_stream"].GetBool();
+                    compress_stream_    = _dom["compress_stream"].GetBool();
+                    compress_cpu_threshold_ = _dom["compress_cpu_threshold"].GetInt();
+                    aoi_cell_size_      = _dom["aoi_cell_size"].GetInt();
+
+                    const rapidjson::Value& dictionaries = _dom["compress_dictionaries"];
+                    for (rapidjson::SizeType i = 0; i < dictionaries.Size(); ++i)
+                    {
+                        compress_dictionaries_.push_back(std::make_pair(
+                            (uint32_t)dictionaries[i]["id"].GetUint(),
+                            std::string(dictionaries[i]["path"].GetString())));
+                    }
 
 					return;
 				}
@@ -51,7 +84,6 @@ namespace net_middleware
 	{
 	public:
 		typedef std::shared_ptr<basic_async_session> session_sptr;
-		typedef parallel_core::SafeHashMap<session_uid, session_sptr> session_set;
         using SessionType = net_middleware::session_logic_interface::SessionType;
 
     public:
@@ -82,6 +114,43 @@ namespace net_middleware
 
         void send_to_client_multi(session_uid client_uid, tiny_buffer_sptr head, once_buffer_sptr msg);
 
+        // msg is channel(2) | snapshot, see Commands_RoutingState
+        void send_state_to_client(session_uid client_uid, once_buffer_sptr msg);
+
+        // one payload to many clients: the targets are looked up in the registry, compressed once per
+        // format and dictionary, and handed to their strands in one task each, only the copy,
+        // the cipher and the head are per client
+        // @param msg the bare payload, not touched
+        void broadcast_to_clients(const std::vector<session_uid>& client_uids, once_buffer_sptr msg);
+
+        // broadcast_to_clients for sessions the caller already holds, closed ones are skipped
+        void broadcast_to_sessions(const std::vector<session_sptr>& clients, once_buffer_sptr msg);
+
+        // one payload to every member of a group, the partitions already tell strand, format and dictionary
+        // @param msg the bare payload, not touched
+        void multicast_to_clients(const std::vector<multicast_partition>& partitions, once_buffer_sptr msg);
+
+        // clients only, found[i] stays empty for a uid that isn't one
+        size_t find_clients(const std::vector<session_uid>& client_uids, std::vector<session_sptr>& clients);
+
+        // cut-through, payload still lives in the receive buffer of the source session
+        void forward_to_server(session_uid target, tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len);
+
+        void forward_to_client(session_uid client_uid, tiny_buffer_sptr head, once_buffer_sptr holder, unsigned char* payload, size_t len);
+
+        inline bool is_cut_through() const { return _config.cut_through_; }
+
+        // keystream of new client sessions carries on across messages, the client must be told so
+        inline bool is_rc4_stream() const { return _config.rc4_stream_; }
+
+        // clients offering AAA_OFFER_DEFLATE_STREAM get one deflate stream per direction
+        inline bool is_compress_stream() const { return _config.compress_stream_; }
+
+        inline int32_t aoi_cell_size() const { return _config.aoi_cell_size_; }
+
+        // @return nullptr if no dictionary with that id is loaded
+        std::shared_ptr<const compress_dictionary> find_dictionary(uint32_t dictionary_id) const;
+
         // move a free session to managed session
 		void move_client_available(session_uid client_uid);
 
@@ -90,12 +159,47 @@ namespace net_middleware
 
         bool kick_one_client(session_uid client_uid);
 
-        bool kick_server_peer(SessionType server_type);
+        // kick the clients routed to this server
+        // @return false if none are
+        bool kick_server_peer(session_uid server_uid);
 
     private:
         void accept_a_session();
 
-        void clean_up_closed_session();
+        // close handler of every accepted session, in its strand once it reached CLOSE_DONE
+        void unregister_session(const session_sptr& session);
+
+        // cpu load sample, and reclamation of what the last erases retired
+        void maintain();
+
+        // the server registered under server_id_ last, still in the registry
+        bool find_server(server_id server_id_, session_sptr& server);
+
+        // copy the server index, change it and swap it in, readers keep the one they hold
+        void update_server_index(server_id server_id_, session_uid server_uid, bool add);
+
+        // a closed session leaves the indexes right after it left the registry
+        void unindex_session(const session_sptr& session, session_role role);
+
+        // targets sharing a compress format and dictionary share one compressed payload
+        struct shared_payload
+        {
+            CompressFormat format;
+            const compress_dictionary* dictionary;
+            once_buffer_sptr payload;
+            bool compressed;
+        };
+
+        // a handful of formats and dictionary versions at most, the payload is compressed the first time
+        // @return its index in payloads
+        static size_t find_shared_payload(std::vector<shared_payload>& payloads, CompressFormat format,
+            const compress_dictionary* dictionary, once_buffer_sptr msg, protocol_cmd cmd);
+
+        // the deflate stream's history has to see every frame, the session wraps its own copy
+        static void send_private_copy(const session_sptr& client, once_buffer_sptr msg);
+
+        // the per client half of broadcast_to_clients, runs in the strand all of sessions share
+        static void broadcast_in_strand(const std::vector<session_sptr>& sessions, once_buffer_sptr payload, bool compressed);
 
 	private:
 		proxy_config _config;
@@ -104,15 +208,25 @@ namespace net_middleware
 		std::shared_ptr<job_agent> _acceptor_job_agent;
 		asio::ip::tcp::acceptor _acceptor;
 
-		parallel_core::SafeHashMap<session_uid, session_sptr> _server_sessions;
+        // every session from accept on, its role tells unmanaged, client and server apart
+        session_registry<basic_async_session> _sessions;
 
-		session_set _client_sessions;
+        // server_id -> server uid, read by every client login, replaced as a whole when a server comes
+        // or goes, so readers only pin the epoch, see parallel_core::EpochReclaimer
+        typedef std::unordered_map<server_id, session_uid> server_index;
+        std::atomic<const server_index*> _servers_by_id;
+        std::mutex _servers_by_id_mut;
 
-		session_set _un_managed_sessions;
+        // target server uid -> its clients, written by every login and logout, read by a peer kick
+        std::unordered_map<session_uid, std::unordered_set<session_uid>> _clients_by_server;
+        std::mutex _clients_by_server_mut;
 		
 		job_excutor_sptr _session_excutor;
 
-		asio::steady_timer _clean_up_timer;
+		asio::steady_timer _maintain_timer;
+
+        // loaded once at start, read only afterwards
+        std::unordered_map<uint32_t, std::shared_ptr<const compress_dictionary>> _dictionaries;
 	};
 
 #define PROXY_MGR net_middleware::proxy_manager::instance()
@@ -1,5 +1,43 @@
 #pragma once
 
+#include <cstring>
+#include <assert.h>
+#include "parallel_core/ParallelUtils.h"
+
+// independent keystreams crypt_multi advances side by side
+#define RC4_MULTI_LANES 8
+
+// one rc4 lane kept in locals b/m/h/p/x/e/d##k, rc4_context::crypt and the multi-lane kernels share it
+#define RC4_LANE_INIT(k) \
+    unsigned char b##k[255]; \
+    std::memcpy(b##k, contexts[k]->_schedule, (size_t)contexts[k]->_mod); \
+    int m##k = contexts[k]->_mod, h##k = 0, p##k = 0; \
+    unsigned char x##k = contexts[k]->_x; \
+    bool e##k = contexts[k]->_encrypt; \
+    unsigned char* d##k = datas[k]; \
+    assert(contexts[k]->is_shareable());
+
+// the reference never moves low off 0, and every index stays below 2 * mod, so no division;
+// the wraps are masks, a branch on them mispredicts half the time
+#define RC4_LANE_STEP(k) \
+    { \
+        int h = h##k + b##k[p##k]; \
+        h -= m##k & -(int)(h >= m##k); \
+        h##k = h; \
+        p##k = (p##k + 1) & -(int)(p##k + 1 != m##k); \
+        unsigned char lo = b##k[0]; \
+        unsigned char hi = b##k[h]; \
+        b##k[0] = hi; \
+        b##k[h] = lo; \
+        int mid = lo + hi; \
+        mid -= m##k & -(int)(mid >= m##k); \
+        unsigned char ks = b##k[mid]; \
+        if (e##k) \
+            d##k[i] = (unsigned char)((d##k[i] ^ ks) - x##k); \
+        else \
+            d##k[i] = (unsigned char)((d##k[i] - x##k) ^ ks); \
+    }
+
 namespace net_middleware
 {
 	class rc4
@@ -47,5 +85,135 @@ namespace net_middleware
 			}
 		}
 	};
+
+	// per-direction cipher state of one session, the key schedule runs once in init.
+	// reset mode restarts the keystream on every message exactly like rc4::rc4_crypt, so peers that
+	// still do that interoperate; stream mode carries the keystream on across messages instead
+	class rc4_context
+	{
+	public:
+		enum class Mode : unsigned char
+		{
+			RESET_PER_MESSAGE = 0,
+			STREAM = 1,
+		};
+
+	public:
+		rc4_context() :
+			_mod(0),
+			_x(0),
+			_high(0),
+			_pos(0),
+			_encrypt(false),
+			_mode(Mode::RESET_PER_MESSAGE)
+		{
+		}
+
+		// @param E same as rc4::rc4_crypt, non zero to encrypt
+		inline void init(int mod, unsigned char* key, size_t keylen, int subtract, int E, Mode mode)
+		{
+			_mod = 0;
+			if (mod <= 0 || mod > (int)sizeof(_schedule) || NULL == key || keylen <= 0)
+				return;
+
+			_mod = mod;
+			_encrypt = (E != 0);
+			_x = (unsigned char)(_encrypt ? subtract : -subtract);
+			_mode = mode;
+
+			rc4::rc4_sbox(mod, _schedule, key, keylen);
+			restart();
+		}
+
+		inline bool is_ready() const { return _mod > 0; }
+
+		inline Mode get_mode() const { return _mode; }
+
+		// reset mode never carries state from one message to the next, so several threads may read it
+		inline bool is_shareable() const { return is_ready() && _mode == Mode::RESET_PER_MESSAGE; }
+
+		// crypt datas[k] with contexts[k] for every k, all of them len bytes, the result equals calling
+		// crypt on each one, contexts must be shareable and are only read.
+		// one stream is a chain of dependent loads, running RC4_MULTI_LANES side by side hides the latency
+		static inline void crypt_multi(const rc4_context* const* contexts, unsigned char* const* datas, size_t count, size_t len)
+		{
+			size_t k = 0;
+			for (; k + RC4_MULTI_LANES <= count; k += RC4_MULTI_LANES)
+				crypt_eight(contexts + k, datas + k, len);
+
+			for (; k < count; ++k)
+				crypt_one(contexts[k], datas[k], len);
+		}
+
+		// en/decrypt in place, whichever direction init chose
+		inline void crypt(unsigned char* data, size_t datalen)
+		{
+			if (UNLIKELY(!is_ready() || NULL == data || datalen <= 0))
+				return;
+
+			if (_mode == Mode::RESET_PER_MESSAGE)
+				restart();
+
+			// locals only, stores through data may alias any member
+			int m0 = _mod;
+			int h0 = _high;
+			int p0 = _pos;
+			unsigned char x0 = _x;
+			bool e0 = _encrypt;
+			unsigned char* b0 = _box;
+			unsigned char* d0 = data;
+
+			for (size_t i = 0; i < datalen; ++i)
+			{
+				RC4_LANE_STEP(0);
+			}
+
+			_high = h0;
+			_pos = p0;
+		}
+
+	private:
+		static inline void crypt_one(const rc4_context* context, unsigned char* data, size_t len)
+		{
+			const rc4_context* const* contexts = &context;
+			unsigned char* const* datas = &data;
+			RC4_LANE_INIT(0);
+
+			for (size_t i = 0; i < len; ++i)
+			{
+				RC4_LANE_STEP(0);
+			}
+		}
+
+		// spelled out lane by lane so every lane's indices live in registers
+		static inline void crypt_eight(const rc4_context* const* contexts, unsigned char* const* datas, size_t len)
+		{
+			RC4_LANE_INIT(0); RC4_LANE_INIT(1); RC4_LANE_INIT(2); RC4_LANE_INIT(3);
+			RC4_LANE_INIT(4); RC4_LANE_INIT(5); RC4_LANE_INIT(6); RC4_LANE_INIT(7);
+
+			for (size_t i = 0; i < len; ++i)
+			{
+				RC4_LANE_STEP(0); RC4_LANE_STEP(1); RC4_LANE_STEP(2); RC4_LANE_STEP(3);
+				RC4_LANE_STEP(4); RC4_LANE_STEP(5); RC4_LANE_STEP(6); RC4_LANE_STEP(7);
+			}
+		}
+
+		inline void restart()
+		{
+			std::memcpy(_box, _schedule, (size_t)_mod);
+			_high = 0;
+			_pos = 0;
+		}
+
+	private:
+		unsigned char _schedule[255];
+		unsigned char _box[255];
+		int _mod;
+		unsigned char _x;
+		int _high;
+		int _pos;
+		bool _encrypt;
+		Mode _mode;
+	};
 }
 
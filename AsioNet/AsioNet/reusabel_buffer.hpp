@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stddef.h>
+
+// lives in ThreadSafeObjectPool<reusabel_buffer<SIZE>>, handed out through get_handle
 template <size_t SIZE>
-class reusabel_buffer :public std::enable_shared_from_this<reusabel_buffer<SIZE>>
+class reusabel_buffer
 {
 public:
     inline unsigned char* buffer(size_t explicit_offset = 0)
@@ -9,11 +12,10 @@ public:
         return &(_buffer[offset + explicit_offset]);
     }
 
-    inline std::shared_ptr<reusabel_buffer> reset()
+    inline void reset()
     {
         offset = 0;
         length = 0;
-        return shared_from_this();
     }
 
     inline size_t available_capacity()
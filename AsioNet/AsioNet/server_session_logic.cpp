@@ -9,6 +9,10 @@ void net_middleware::server_session_logic::inherit_logic(server_info s, uint32_t
 {
     _server_info = s;
     _seq = seq;
+
+    // the logic comes out of a pool, nothing of the last server it served may carry over
+    _groups.clear();
+    _aoi.reset(PROXY_MGR->aoi_cell_size());
 }
 
 void net_middleware::server_session_logic::apply_session(std::weak_ptr<basic_async_session> session_holder)
@@ -16,91 +20,327 @@ void net_middleware::server_session_logic::apply_session(std::weak_ptr<basic_asy
     _session_holder = session_holder;
 }
 
-bool net_middleware::server_session_logic::unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block)
+bool net_middleware::server_session_logic::unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block)
 {
     // check seq
-    if (UNLIKELY(head->seq != ++_seq))
+    if (UNLIKELY(head.seq != ++_seq))
     {
-        LOG("seq error, maybe it's hacked, local is %d, remote is %d", _seq, head->seq);
+        LOG("seq error, maybe it's hacked, local is %d, remote is %d", _seq, head.seq);
 
         return false;
     }
 
     // check mask
-    if (UNLIKELY(0 != net_middleware::proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len)))
+    if (UNLIKELY(0 != head.mask_of(buffer->buffer(), head.len)))
     {
         LOG("check mask failed, maybe it's hacked");
 
         return false;
     }
 
-    if (head->len == 0)
+    if (head.len == 0)
     {
         LOG_NON_SENSITIVE("accept a keep alive proto");
         return false;
     }
 
-    std::memcpy(ret_block->buffer(), buffer->buffer(), head->len);
-    ret_block->length = head->len;
+    std::memcpy(ret_block->buffer(), buffer->buffer(), head.len);
+    ret_block->length = head.len;
 
     return true;
 }
 
-bool net_middleware::server_session_logic::try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head)
+bool net_middleware::server_session_logic::try_copy_to_storage(once_buffer_sptr data, const protocol_head& head)
 {
-    if (head->get_cmd() == (uint16_t)protocol_cmd::Commands_BroadCast)
+    switch ((protocol_cmd)head.get_cmd())
+    {
+    case protocol_cmd::Commands_BroadCast:
     {
-        size_t size = read_uint16(data->buffer()); // avoid warning
-        
-        auto mutable_buffer = TEMP_BUFFER;
-        std::memcpy(mutable_buffer->buffer(), data->buffer(2 + 4 * size), data->length - (2 + 4 * size));
-        
+        // a malformed frame is dropped, false would have it parsed again as if storage were full
+        size_t size = data->length < 2 ? 0 : read_uint16(data->buffer()); // avoid warning
+        if (UNLIKELY(data->length < 2 || data->length < 2 + 4 * size))
+        {
+            LOG("broadcast target list overflows the frame, size: %d, length: %d", (int)size, (int)data->length);
+            break;
+        }
+
+        std::vector<session_uid> uids(size);
         for (size_t i = 0; i < size; ++i)
         {
-            session_uid uid = read_uint32(data->buffer(2 + i * 4));
-            
-            auto head_buffer = TINY_BUFFER;
-            auto new_head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)mutable_buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, false, _seq);
-            uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)new_head.get(), PROTO_HEAD_SIZE, mutable_buffer->buffer(), mutable_buffer->length);
-            new_head->mask = inverse_mask;
-            std::memcpy(head_buffer->buffer(), new_head.get(), PROTO_HEAD_SIZE);
-
-            PROXY_MGR->send_to_client_multi(uid, head_buffer, mutable_buffer);
+            uids[i] = read_uint32(data->buffer(2 + i * 4));
         }
+
+        // every client gets its own head and cipher, the payload is sliced out in place
+        data->offset += 2 + 4 * size;
+        data->length -= 2 + 4 * size;
+
+        PROXY_MGR->broadcast_to_clients(uids, data);
+        break;
     }
-    else
+    case protocol_cmd::Commands_GroupCast:
+    {
+        if (UNLIKELY(data->length < sizeof(uint32_t)))
+        {
+            LOG("group cast without a group id");
+            break;
+        }
+
+        uint32_t group_id = read_uint32(data->buffer());
+        data->offset += sizeof(uint32_t);
+        data->length -= sizeof(uint32_t);
+
+        auto partitions = _groups.find(group_id);
+        if (UNLIKELY(partitions == nullptr))
+        {
+            LOG("cast to an unknown group %u", group_id);
+            break;
+        }
+
+        PROXY_MGR->multicast_to_clients(*partitions, data);
+        break;
+    }
+    case protocol_cmd::Commands_GroupJoin:
+    case protocol_cmd::Commands_GroupLeave:
+        edit_group(data, head);
+        break;
+    case protocol_cmd::Commands_GroupDismiss:
+        if (LIKELY(data->length >= sizeof(uint32_t)))
+        {
+            _groups.dismiss(read_uint32(data->buffer()));
+        }
+        break;
+    case protocol_cmd::Commands_AoiUpdate:
+        update_aoi(data);
+        break;
+    case protocol_cmd::Commands_AoiRemove:
+        for (size_t i = 0; i + sizeof(session_uid) <= data->length; i += sizeof(session_uid))
+        {
+            _aoi.erase(read_uint32(data->buffer(i)));
+        }
+        break;
+    case protocol_cmd::Commands_AoiCast:
+        cast_aoi(data);
+        break;
+    case protocol_cmd::Commands_RoutingState:
+    {
+        if (UNLIKELY(data->length < sizeof(session_uid) + sizeof(uint16_t)))
+        {
+            LOG("state frame without a channel");
+            break;
+        }
+
+        session_uid target_client_uid = read_uint32(data->buffer());
+        data->offset += sizeof(session_uid);
+        data->length -= sizeof(session_uid);
+
+        PROXY_MGR->send_state_to_client(target_client_uid, data);
+        break;
+    }
+    default:
     {
         session_uid target_client_uid = read_uint32(data->buffer());
         data->offset += sizeof(session_uid);
         data->length -= sizeof(session_uid);
 
         PROXY_MGR->send_to_client(target_client_uid, data);
+        break;
+    }
     }
 
     return true;
 }
 
+void net_middleware::server_session_logic::forget_client(session_uid client_uid)
+{
+    _groups.forget(client_uid);
+    _aoi.erase(client_uid);
+}
+
+void net_middleware::server_session_logic::edit_group(once_buffer_sptr data, const protocol_head& head)
+{
+    if (UNLIKELY(data->length < sizeof(uint32_t) || (data->length - sizeof(uint32_t)) % sizeof(session_uid) != 0))
+    {
+        LOG("malformed group edit, length: %d", (int)data->length);
+        return;
+    }
+
+    uint32_t group_id = read_uint32(data->buffer());
+    size_t size = (data->length - sizeof(uint32_t)) / sizeof(session_uid);
+
+    std::vector<session_uid> uids(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        uids[i] = read_uint32(data->buffer(sizeof(uint32_t) + i * sizeof(session_uid)));
+    }
+
+    if (head.get_cmd() == (uint16_t)protocol_cmd::Commands_GroupJoin)
+    {
+        std::vector<multicast_groups::session_sptr> clients;
+        if (PROXY_MGR->find_clients(uids, clients) < size)
+        {
+            LOG_NON_SENSITIVE("some clients joining group %u are gone", group_id);
+        }
+
+        _groups.join(group_id, clients);
+    }
+    else
+    {
+        _groups.leave(group_id, uids);
+    }
+}
+
+void net_middleware::server_session_logic::update_aoi(once_buffer_sptr data)
+{
+    if (UNLIKELY(data->length % AOI_POSITION_SIZE != 0))
+    {
+        LOG("malformed aoi update, length: %d", (int)data->length);
+        return;
+    }
+
+    std::vector<aoi_position> joining;
+    for (size_t off = 0; off < data->length; off += AOI_POSITION_SIZE)
+    {
+        aoi_position p = {
+            read_uint32(data->buffer(off)),
+            (int32_t)read_uint32(data->buffer(off + 4)),
+            (int32_t)read_uint32(data->buffer(off + 8))
+        };
+
+        if (!_aoi.move(p.uid, p.x, p.y))
+        {
+            joining.push_back(p);
+        }
+    }
+
+    if (joining.empty())
+    {
+        return;
+    }
+
+    std::vector<session_uid> uids(joining.size());
+    for (size_t i = 0; i < joining.size(); ++i)
+    {
+        uids[i] = joining[i].uid;
+    }
+
+    std::vector<std::shared_ptr<basic_async_session>> clients;
+    PROXY_MGR->find_clients(uids, clients);
+
+    for (size_t i = 0; i < joining.size(); ++i)
+    {
+        if (clients[i])
+        {
+            _aoi.insert(joining[i].uid, joining[i].x, joining[i].y, clients[i]);
+        }
+    }
+}
+
+void net_middleware::server_session_logic::cast_aoi(once_buffer_sptr data)
+{
+    if (UNLIKELY(data->length < 12))
+    {
+        LOG("aoi cast without a center and radius");
+        return;
+    }
+
+    int32_t x = (int32_t)read_uint32(data->buffer());
+    int32_t y = (int32_t)read_uint32(data->buffer(4));
+    uint32_t radius = read_uint32(data->buffer(8));
+    data->offset += 12;
+    data->length -= 12;
+
+    std::vector<std::shared_ptr<basic_async_session>> targets;
+    std::vector<session_uid> closed;
+    _aoi.query(x, y, radius, [&targets, &closed](session_uid uid, std::shared_ptr<basic_async_session>& client) {
+        if (client->is_session_closed())
+        {
+            closed.push_back(uid);
+        }
+        else
+        {
+            targets.push_back(client);
+        }
+    });
+
+    // the game server may never tell about a client that went away, the cast finds it
+    for (auto uid : closed)
+    {
+        _aoi.erase(uid);
+    }
+
+    PROXY_MGR->broadcast_to_sessions(targets, data);
+}
+
 void net_middleware::server_session_logic::wrap_to_send_data(once_buffer_sptr& buffer)
 {
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, false, _seq);
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), buffer->length);
-    head->mask = inverse_mask;
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, false, _seq);
+    uint16_t inverse_mask = head.mask_of(buffer->buffer(), buffer->length);
+    head.mask = inverse_mask;
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(buffer->origin_buffer());
     buffer->offset -= PROTO_HEAD_SIZE;
     buffer->length += PROTO_HEAD_SIZE;
 
     assert(buffer->offset == 0 && "offset align error");
 }
 
+bool net_middleware::server_session_logic::try_cut_through(once_buffer_sptr recv_block, unsigned char* payload, const protocol_head& head)
+{
+    if (!PROXY_MGR->is_cut_through() ||
+        head.get_cmd() != (uint16_t)protocol_cmd::Commands_RoutingTransparent ||
+        head.len <= sizeof(session_uid))
+    {
+        return false;
+    }
+
+    if (UNLIKELY(head.seq != ++_seq))
+    {
+        LOG("seq error, maybe it's hacked, local is %d, remote is %d", _seq, head.seq);
+        return true;
+    }
+
+    if (UNLIKELY(0 != head.mask_of(payload, head.len)))
+    {
+        LOG("check mask failed, maybe it's hacked");
+        return true;
+    }
+
+    session_uid target_client_uid = read_uint32(payload);
+
+    auto head_buffer = TINY_BUFFER;
+    head_buffer->length = PROTO_HEAD_SIZE;
+
+    PROXY_MGR->forward_to_client(target_client_uid, head_buffer, recv_block, payload + sizeof(session_uid), head.len - sizeof(session_uid));
+
+    return true;
+}
+
+void net_middleware::server_session_logic::wrap_cut_through(tiny_buffer_sptr& head_block, unsigned char* payload, size_t len)
+{
+    // the client session already wrote its uid behind the head
+    size_t prefix_len = head_block->length - PROTO_HEAD_SIZE;
+
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)(prefix_len + len), 0, (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent, false, _seq);
+    uint32_t prefix_acc = proto_mask::mask_off_32(head_block->origin_buffer(PROTO_HEAD_SIZE), prefix_len, 0);
+    head.mask = head.mask_of(payload, len, prefix_acc);
+
+    head.encode(head_block->origin_buffer());
+}
+
 void net_middleware::server_session_logic::kick_peer()
 {
-    PROXY_MGR->kick_server_peer(get_session_type());
+    if (UNLIKELY(_session_holder.expired()))
+    {
+        LOG("unexpected session expired");
+        return;
+    }
+
+    PROXY_MGR->kick_server_peer(_session_holder.lock()->get_uuid());
 }
 
 void net_middleware::server_session_logic::send_confirm_connect(session_uid client_id, uint32_t ip)
 {
-    auto buffer = TEMP_BUFFER;
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(session_uid) + sizeof(uint32_t));
     
     uint16_t length = 0;
     session_connect_confirm::pack(buffer->origin_buffer(PROTO_HEAD_SIZE + sizeof(session_uid)), length, ip);
@@ -108,11 +348,11 @@ void net_middleware::server_session_logic::send_confirm_connect(session_uid clie
 
     write_uint32(buffer->origin_buffer(PROTO_HEAD_SIZE), client_id);
 
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_ConnectionConfirm, false, _seq);
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->origin_buffer(PROTO_HEAD_SIZE), buffer->length - PROTO_HEAD_SIZE);
-    head->mask = inverse_mask;
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)net_middleware::protocol_cmd::Commands_ConnectionConfirm, false, _seq);
+    uint16_t inverse_mask = head.mask_of(buffer->origin_buffer(PROTO_HEAD_SIZE), buffer->length - PROTO_HEAD_SIZE);
+    head.mask = inverse_mask;
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(buffer->origin_buffer());
 
     if (UNLIKELY(_session_holder.expired()))
     {
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "session_logic.h"
+#include "multicast_group.h"
+#include "aoi_grid.hpp"
 #include "parallel_core/ThreadSafeObjectPool.h"
 
 namespace net_middleware 
@@ -20,9 +22,9 @@ namespace net_middleware
 
         virtual SessionType get_session_type() final { return (SessionType)_server_info.link_type_; }
 
-        virtual bool unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block) final;
+        virtual bool unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block) final;
 
-        virtual bool try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head) final;
+        virtual bool try_copy_to_storage(once_buffer_sptr data, const protocol_head& head) final;
 
         virtual void wrap_to_send_data(once_buffer_sptr& buffer) final;
 
@@ -30,15 +32,35 @@ namespace net_middleware
 
         virtual void kick_peer() final;
 
+        virtual bool try_cut_through(once_buffer_sptr recv_block, unsigned char* payload, const protocol_head& head) final;
+
+        virtual void wrap_cut_through(tiny_buffer_sptr& head_block, unsigned char* payload, size_t len) final;
+
 #pragma endregion
 
         // send some extra info to server
         void send_confirm_connect(session_uid client_id, uint32_t ip);
 
+        // a client routed here closed, its groups and grid entry let go of it. must be called in strand
+        void forget_client(session_uid client_uid);
+
+    private:
+        // Commands_GroupJoin / GroupLeave, group id(4) | uid(4) * n
+        void edit_group(once_buffer_sptr data, const protocol_head& head);
+
+        // Commands_AoiUpdate, (uid(4) | x(4) | y(4)) * n, clients new to the grid are looked up under one lock
+        void update_aoi(once_buffer_sptr data);
+
+        // Commands_AoiCast, x(4) | y(4) | radius(4) | payload
+        void cast_aoi(once_buffer_sptr data);
+
     private:
         uint32_t _seq;
         server_info _server_info;
         std::weak_ptr<basic_async_session> _session_holder;
+        // groups this server created and positions it pushed, touched in this session's strand only
+        multicast_groups _groups;
+        aoi_grid<std::shared_ptr<basic_async_session>> _aoi;
     };
 
 #define SERVER_SESSION_LOGIC parallel_core::ThreadSafeObjectPool<server_session_logic>::instance()->get_shared()
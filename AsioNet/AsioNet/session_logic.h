@@ -4,6 +4,8 @@
 #include <tuple>
 #include "NetUtils.hpp"
 #include "protocol.hpp"
+#include "cipher.hpp"
+#include "compression/zlib_context.hpp"
 #include "parallel_core/SafeRandom.hpp"
 
 namespace net_middleware
@@ -47,16 +49,29 @@ namespace net_middleware
 
         virtual SessionType get_session_type() = 0;
 
-        virtual bool unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block) = 0;
+        virtual bool unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block) = 0;
 
         virtual size_t prefix_size() = 0;
 
         virtual void wrap_to_send_data(once_buffer_sptr& buffer) = 0;
 
-        virtual bool try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head) = 0;
+        virtual bool try_copy_to_storage(once_buffer_sptr data, const protocol_head& head) = 0;
 
         virtual void kick_peer() = 0;
 
+        // cut-through forwarding: the payload stays inside recv_block and is handed to the target session
+        // @return true if the frame was handled (forwarded or dropped), false to go through unwrap & copy
+        virtual bool try_cut_through(once_buffer_sptr /*recv_block*/, unsigned char* /*payload*/, const protocol_head& /*head*/) { return false; }
+
+        // seal a forwarded payload in place, head_block may already carry a prefix behind PROTO_HEAD_SIZE
+        virtual void wrap_cut_through(tiny_buffer_sptr& /*head_block*/, unsigned char* /*payload*/, size_t /*len*/) { assert(false && "cut-through is not supported"); }
+
+        // wrap_to_send_data for a payload some batch already compressed and encrypted for this session
+        virtual void wrap_encrypted_data(once_buffer_sptr& /*buffer*/, bool /*compressed*/) { assert(false && "batched encryption is not supported"); }
+
+        // wrap_to_send_data for a state snapshot, buffer starts with its channel, see Commands_RoutingState
+        virtual void wrap_state_data(once_buffer_sptr& /*buffer*/) { assert(false && "state channels are not supported"); }
+
         template <class _SessionType>
         static std::shared_ptr<_SessionType> session_cast(std::shared_ptr<session_logic_interface> basic_session)
         {
@@ -87,9 +102,25 @@ namespace net_middleware
         int           rc4_modvt_;
         unsigned char rc4_key_[RC4_KEY_LEN];
         int           rc4_subtract_;
+        rc4_context::Mode rc4_mode_;
+
+        // negotiated in the aaa exchange, rc4 unless the client offered something better
+        CipherSuite   cipher_suite_;
+        unsigned char cipher_key_[CIPHER_KEY_LEN];
+
+        // gzip unless the client offered AAA_OFFER_RAW_DEFLATE, AAA_OFFER_DEFLATE_STREAM or AAA_OFFER_LZ
+        CompressFormat compress_format_;
+        // RAW_DEFLATE primed with a preset dictionary, the client offered AAA_OFFER_DICTIONARY with its id
+        std::shared_ptr<const compress_dictionary> dictionary_;
+        // the client offered AAA_OFFER_DELTA
+        bool          delta_;
 
         // do data copy when inherit
-        rc4_info()
+        rc4_info() :
+            rc4_mode_(rc4_context::Mode::RESET_PER_MESSAGE),
+            cipher_suite_(CipherSuite::RC4),
+            compress_format_(CompressFormat::GZIP),
+            delta_(false)
         {
             uint64_t rand = SAFE_RAND;
             rc4_modvt_ = rand % 255 + 1;
@@ -101,6 +132,11 @@ namespace net_middleware
 
             rand = SAFE_RAND;
             rc4_subtract_ = rand % 255 + 1;
+
+            for (size_t i = 0; i < CIPHER_KEY_LEN; i += sizeof(rand)) {
+                rand = SAFE_RAND;
+                std::memcpy(cipher_key_ + i, &rand, sizeof(rand));
+            }
         }
     };
 
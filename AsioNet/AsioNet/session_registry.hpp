@@ -0,0 +1,309 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NetUtils.hpp"
+#include "parallel_core/EpochReclaimer.h"
+
+// session_uid = generation(12) | slot(20), generations start at 1 so 0 stays "no session"
+#define SESSION_SLOT_BITS 20
+#define SESSION_SLOTS_MAX (1u << SESSION_SLOT_BITS)
+#define SESSION_SEGMENT_SLOTS 1024 // slots are added a segment at a time and never move
+#define SESSION_GENERATION_MAX ((1u << (32 - SESSION_SLOT_BITS)) - 1)
+
+namespace net_middleware
+{
+    // which side a session plays, a lookup names the role it expects
+    enum class session_role : uint8_t
+    {
+        FREE = 0,
+
+        UNMANAGED, // accepted, not authenticated yet
+
+        CLIENT,
+
+        SERVER,
+    };
+
+    // slot map of the proxy's sessions. a uid is its slot index tagged with the slot's generation,
+    // so a lookup is one array index and one compare, a stale uid of a slot reused since fails that
+    // compare. readers take no lock, they pin the epoch while copying the shared_ptr out, and erase
+    // never waits: it retires the slot to EpochReclaimer, which drops the session and frees the slot
+    // once those readers are gone.
+    // freed slots are reused oldest first, a uid has to outlive 4095 reuses of its slot to come back
+    template <typename Session>
+    class session_registry
+    {
+    public:
+        typedef std::shared_ptr<Session> session_sptr;
+
+        session_registry() :
+            _slot_count(0),
+            _size(0),
+            _retiring(0)
+        {
+            for (auto& segment : _segments)
+            {
+                segment.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        // erases still retired point back here, so must not be called pinned
+        ~session_registry()
+        {
+            while (_retiring.load(std::memory_order_acquire) != 0)
+            {
+                EPOCH_RECLAIMER->collect();
+                std::this_thread::yield();
+            }
+
+            for (auto& segment : _segments)
+            {
+                delete[] segment.load(std::memory_order_relaxed);
+            }
+        }
+
+        session_registry(const session_registry&) = delete;
+        session_registry& operator=(const session_registry&) = delete;
+
+    public:
+        inline size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+        // @return the new uid, 0 if all SESSION_SLOTS_MAX slots are taken
+        session_uid add(const session_sptr& session, session_role role)
+        {
+            uint32_t index;
+            uint32_t generation;
+            {
+                std::lock_guard<std::mutex> lock(_free_mut);
+                if (!_free.empty())
+                {
+                    index = _free.front();
+                    _free.pop_front();
+                }
+                else if (!grow(index))
+                {
+                    return 0;
+                }
+
+                generation = slot_at(index)->generation;
+            }
+
+            session_uid uid = (generation << SESSION_SLOT_BITS) | index;
+
+            // readers seeing tag 0 leave session alone, it is ours until the tag is published
+            slot* s = slot_at(index);
+            s->session = session;
+            s->tag.store(tag_of(uid, role), std::memory_order_seq_cst);
+
+            _size.fetch_add(1, std::memory_order_relaxed);
+            return uid;
+        }
+
+        bool try_get(session_uid uid, session_role role, session_sptr& ref_val)
+        {
+            slot* s = find_slot(uid);
+            if (UNLIKELY(!s || s->tag.load(std::memory_order_relaxed) != tag_of(uid, role)))
+            {
+                return false;
+            }
+
+            return copy_if(s, tag_of(uid, role), ref_val);
+        }
+
+        // found[i] stays empty if uids[i] isn't there in that role
+        size_t try_get_all(const std::vector<session_uid>& uids, session_role role, std::vector<session_sptr>& found)
+        {
+            size_t hits = 0;
+            found.assign(uids.size(), session_sptr());
+            for (size_t i = 0; i < uids.size(); ++i)
+            {
+                if (try_get(uids[i], role, found[i]))
+                {
+                    ++hits;
+                }
+            }
+            return hits;
+        }
+
+        // the uid stays, only lookups in the new role find it from now on
+        bool change_role(session_uid uid, session_role from, session_role to)
+        {
+            slot* s = find_slot(uid);
+            if (UNLIKELY(!s))
+            {
+                return false;
+            }
+
+            uint64_t expected = tag_of(uid, from);
+            return s->tag.compare_exchange_strong(expected, tag_of(uid, to), std::memory_order_acq_rel);
+        }
+
+        // lookups miss uid from here on, the slot's reference to the session is dropped and the
+        // slot freed once the epoch moved past every reader that may still be copying it
+        // @param role set to the role uid had, if erased
+        bool erase(session_uid uid, session_role* role = nullptr)
+        {
+            slot* s = find_slot(uid);
+            if (UNLIKELY(!s))
+            {
+                return false;
+            }
+
+            // whoever clears the tag owns the erase, a role change in between only retries it
+            uint64_t tag = s->tag.load(std::memory_order_relaxed);
+            do
+            {
+                if ((uint32_t)tag != uid)
+                {
+                    return false;
+                }
+            } while (!s->tag.compare_exchange_weak(tag, 0, std::memory_order_seq_cst));
+
+            if (role)
+            {
+                *role = (session_role)(tag >> 32);
+            }
+
+            _size.fetch_sub(1, std::memory_order_relaxed);
+            _retiring.fetch_add(1, std::memory_order_relaxed);
+
+            uint32_t index = uid & (SESSION_SLOTS_MAX - 1);
+            EPOCH_RECLAIMER->retire([this, s, index]() {
+                // the session may go away here, before the slot is someone else's
+                session_sptr dropped;
+                dropped.swap(s->session);
+                release(index);
+                _retiring.fetch_sub(1, std::memory_order_release);
+            });
+            return true;
+        }
+
+        // visit(session) for every session in role, it may call back into the registry
+        template <typename Visitor>
+        void for_each(session_role role, Visitor visit)
+        {
+            uint32_t slots = _slot_count.load(std::memory_order_acquire);
+            for (uint32_t index = 0; index < slots; ++index)
+            {
+                slot* s = slot_at(index);
+                uint64_t tag = s->tag.load(std::memory_order_relaxed);
+                session_sptr session;
+                if (tag != 0 && (session_role)(tag >> 32) == role && copy_if(s, tag, session))
+                {
+                    visit(session);
+                }
+            }
+        }
+
+        // drops every session pred(session, role) holds for, whatever its role
+        template <typename Predicate>
+        size_t erase_if(Predicate pred)
+        {
+            size_t erased = 0;
+            uint32_t slots = _slot_count.load(std::memory_order_acquire);
+            for (uint32_t index = 0; index < slots; ++index)
+            {
+                slot* s = slot_at(index);
+                uint64_t tag = s->tag.load(std::memory_order_relaxed);
+                session_sptr session;
+                if (tag == 0 || !copy_if(s, tag, session))
+                {
+                    continue;
+                }
+
+                if (pred(session, (session_role)(tag >> 32)) && erase((session_uid)tag))
+                {
+                    ++erased;
+                }
+            }
+            return erased;
+        }
+
+    private:
+        struct slot
+        {
+            slot() :
+                tag(0),
+                generation(1)
+            {
+            }
+
+            std::atomic<uint64_t> tag; // role(8) << 32 | uid, 0 while free
+            session_sptr session; // written while tag is 0 and no reader is pinned since it was cleared
+            uint32_t generation; // of the next uid handed out here, under _free_mut
+        };
+
+        static inline uint64_t tag_of(session_uid uid, session_role role)
+        {
+            return ((uint64_t)role << 32) | uid;
+        }
+
+        inline slot* slot_at(uint32_t index) const
+        {
+            return _segments[index / SESSION_SEGMENT_SLOTS].load(std::memory_order_acquire) + index % SESSION_SEGMENT_SLOTS;
+        }
+
+        // nullptr if uid points past the slots there are
+        inline slot* find_slot(session_uid uid) const
+        {
+            uint32_t index = uid & (SESSION_SLOTS_MAX - 1);
+            slot* segment = _segments[index / SESSION_SEGMENT_SLOTS].load(std::memory_order_acquire);
+            return segment ? segment + index % SESSION_SEGMENT_SLOTS : nullptr;
+        }
+
+        // pin, then check: a reader that still sees the tag pinned before erase retired the slot
+        inline bool copy_if(slot* s, uint64_t tag, session_sptr& ref_val)
+        {
+            parallel_core::EpochGuard guard;
+            bool hit = s->tag.load(std::memory_order_seq_cst) == tag;
+            if (LIKELY(hit))
+            {
+                ref_val = s->session;
+            }
+            return hit;
+        }
+
+        // under _free_mut
+        bool grow(uint32_t& index)
+        {
+            uint32_t slots = _slot_count.load(std::memory_order_relaxed);
+            if (UNLIKELY(slots == SESSION_SLOTS_MAX))
+            {
+                return false;
+            }
+
+            if (slots % SESSION_SEGMENT_SLOTS == 0)
+            {
+                _segments[slots / SESSION_SEGMENT_SLOTS].store(new slot[SESSION_SEGMENT_SLOTS], std::memory_order_release);
+            }
+
+            index = slots;
+            _slot_count.store(slots + 1, std::memory_order_release);
+            return true;
+        }
+
+        void release(uint32_t index)
+        {
+            std::lock_guard<std::mutex> lock(_free_mut);
+            slot* s = slot_at(index);
+            s->generation = s->generation == SESSION_GENERATION_MAX ? 1 : s->generation + 1;
+            _free.push_back(index);
+        }
+
+    private:
+        std::atomic<slot*> _segments[SESSION_SLOTS_MAX / SESSION_SEGMENT_SLOTS];
+        std::atomic<uint32_t> _slot_count;
+        std::atomic<size_t> _size;
+        std::atomic<size_t> _retiring; // erased, slot not released yet
+
+        std::mutex _free_mut;
+        std::deque<uint32_t> _free;
+    };
+}
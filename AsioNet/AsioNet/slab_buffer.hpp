@@ -0,0 +1,204 @@
+#pragma once
+
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+
+#include "parallel_core/ThreadSafeObjectPool.h"
+
+// size classes backing a slab_buffer, the last one must hold ONCE_BUFFER_SIZE
+#define SLAB_CLASS_NUM 4
+#define SLAB_CLASS_0 128
+#define SLAB_CLASS_1 1024
+#define SLAB_CLASS_2 1024 * 8
+#define SLAB_CLASS_3 1024 * 64
+
+template <size_t SIZE>
+struct slab_block
+{
+    unsigned char data[SIZE];
+};
+
+// same interface as reusabel_buffer, but the storage is a block of the smallest size class
+// that holds what the caller asked for, so a heartbeat doesn't pin 64k.
+// lives in ThreadSafeObjectPool<slab_buffer>, handed out through get_handle
+class slab_buffer
+{
+public:
+    slab_buffer():
+        offset(0),
+        length(0),
+        _class(-1),
+        _block(nullptr),
+        _block_tid(0)
+    {
+    }
+
+    ~slab_buffer()
+    {
+        release_block();
+    }
+
+    slab_buffer(const slab_buffer&) = delete;
+    slab_buffer& operator=(const slab_buffer&) = delete;
+
+    // @param need bytes the caller is going to put in, including any prefix it reserves
+    inline void reset(size_t need = SLAB_CLASS_3)
+    {
+        if (UNLIKELY(need > class_capacity(SLAB_CLASS_NUM - 1)))
+        {
+            throw std::length_error("slab_buffer exceeds the largest size class");
+        }
+
+        offset = 0;
+        length = 0;
+
+        int cls = class_of(need);
+        if (cls != _class)
+        {
+            release_block();
+            acquire_block(cls);
+        }
+    }
+
+    // grow to a class holding need bytes from origin, keeps [0, offset + length)
+    inline void reserve(size_t need)
+    {
+        if (need <= capacity())
+        {
+            return;
+        }
+
+        if (UNLIKELY(need > class_capacity(SLAB_CLASS_NUM - 1)))
+        {
+            throw std::length_error("slab_buffer exceeds the largest size class");
+        }
+
+        int old_class = _class;
+        unsigned char* old_block = _block;
+        int old_tid = _block_tid;
+
+        acquire_block(class_of(need));
+        std::memcpy(_block, old_block, offset + length);
+
+        release_block(old_class, old_block, old_tid);
+    }
+
+    inline unsigned char* buffer(size_t explicit_offset = 0)
+    {
+        return &(_block[offset + explicit_offset]);
+    }
+
+    inline size_t capacity() const
+    {
+        return class_capacity(_class);
+    }
+
+    inline size_t available_capacity()
+    {
+        return capacity() - offset;
+    }
+
+    inline unsigned char* origin_buffer(size_t explicit_offset = 0)
+    {
+        return &(_block[explicit_offset]);
+    }
+
+    size_t offset;
+    size_t length;
+
+#pragma region string-style
+    inline unsigned char& operator[](size_t idx)
+    {
+        return _block[offset + idx];
+    }
+
+    inline void resize(size_t s)
+    {
+        reserve(offset + s);
+        length = s;
+    }
+
+    inline size_t size()
+    {
+        return length;
+    }
+#pragma endregion
+
+    static inline size_t class_capacity(int cls)
+    {
+        switch (cls)
+        {
+        case 0: return SLAB_CLASS_0;
+        case 1: return SLAB_CLASS_1;
+        case 2: return SLAB_CLASS_2;
+        case 3: return SLAB_CLASS_3;
+        default: return 0;
+        }
+    }
+
+    static inline int class_of(size_t need)
+    {
+        for (int cls = 0; cls < SLAB_CLASS_NUM - 1; ++cls)
+        {
+            if (need <= class_capacity(cls))
+                return cls;
+        }
+
+        return SLAB_CLASS_NUM - 1;
+    }
+
+private:
+    template <size_t SIZE>
+    static inline unsigned char* acquire_from(int* tid)
+    {
+        auto ret = parallel_core::ThreadSafeObjectPool<slab_block<SIZE>>::instance()->get();
+        *tid = std::get<0>(ret);
+        return std::get<1>(ret)->data;
+    }
+
+    template <size_t SIZE>
+    static inline void release_to(unsigned char* block, int tid)
+    {
+        parallel_core::ThreadSafeObjectPool<slab_block<SIZE>>::instance()->release(reinterpret_cast<slab_block<SIZE>*>(block), tid);
+    }
+
+    inline void acquire_block(int cls)
+    {
+        switch (cls)
+        {
+        case 0: _block = acquire_from<SLAB_CLASS_0>(&_block_tid); break;
+        case 1: _block = acquire_from<SLAB_CLASS_1>(&_block_tid); break;
+        case 2: _block = acquire_from<SLAB_CLASS_2>(&_block_tid); break;
+        default: _block = acquire_from<SLAB_CLASS_3>(&_block_tid); cls = SLAB_CLASS_NUM - 1; break;
+        }
+
+        _class = cls;
+    }
+
+    static inline void release_block(int cls, unsigned char* block, int tid)
+    {
+        if (NULL == block)
+            return;
+
+        switch (cls)
+        {
+        case 0: release_to<SLAB_CLASS_0>(block, tid); break;
+        case 1: release_to<SLAB_CLASS_1>(block, tid); break;
+        case 2: release_to<SLAB_CLASS_2>(block, tid); break;
+        default: release_to<SLAB_CLASS_3>(block, tid); break;
+        }
+    }
+
+    inline void release_block()
+    {
+        release_block(_class, _block, _block_tid);
+        _class = -1;
+        _block = nullptr;
+    }
+
+private:
+    int _class;
+    unsigned char* _block;
+    int _block_tid;
+};
@@ -0,0 +1,148 @@
+// trains a preset compress dictionary from captured payloads
+//
+// DictTrainer [-s dict_size] [-f] -o out.dict sample...
+//   every sample file is one payload, with -f a file is a capture of
+//   uint16 little endian length prefixed payloads instead
+//
+// the dictionary is then listed under compress_dictionaries in proxy_config.json
+// with a new id, and shipped with the client build speaking that protocol version
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "dictionary_trainer.h"
+#include "compression/zlib_context.hpp"
+
+using namespace net_middleware;
+
+namespace
+{
+    bool read_file(const char* path, std::vector<unsigned char>& bytes)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // raw deflate only if it comes out smaller, as compress_to_send decides
+    size_t wire_size(const unsigned char* data, size_t len, const compress_dictionary* dictionary)
+    {
+        std::vector<unsigned char> out(len + 64);
+        size_t packed = deflate_context::local(CompressFormat::RAW_DEFLATE).compress(data, len, out.data(), len - 1, dictionary);
+        return packed == 0 ? len : packed;
+    }
+
+    void usage()
+    {
+        std::cerr << "usage: DictTrainer [-s dict_size] [-f] -o out.dict sample..." << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t dict_size = 16 * 1024;
+    bool framed = false;
+    const char* out_path = nullptr;
+    std::vector<const char*> inputs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == std::strcmp(argv[i], "-s") && i + 1 < argc)
+            dict_size = (size_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (0 == std::strcmp(argv[i], "-f"))
+            framed = true;
+        else if (0 == std::strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else
+            inputs.push_back(argv[i]);
+    }
+
+    if (out_path == nullptr || inputs.empty() || dict_size == 0 || dict_size > (1u << 15))
+    {
+        usage();
+        return 1;
+    }
+
+    dictionary_trainer trainer(dict_size);
+    std::vector<std::vector<unsigned char>> payloads;
+
+    std::vector<unsigned char> bytes;
+    for (auto path : inputs)
+    {
+        if (!read_file(path, bytes))
+        {
+            std::cerr << "cannot read " << path << std::endl;
+            return 1;
+        }
+
+        if (!framed)
+        {
+            payloads.push_back(bytes);
+            continue;
+        }
+
+        size_t pos = 0;
+        while (pos + 2 <= bytes.size())
+        {
+            size_t len = bytes[pos] | ((size_t)bytes[pos + 1] << 8);
+            pos += 2;
+            if (pos + len > bytes.size())
+            {
+                std::cerr << path << " ends in the middle of a payload" << std::endl;
+                break;
+            }
+
+            payloads.push_back(std::vector<unsigned char>(bytes.begin() + pos, bytes.begin() + pos + len));
+            pos += len;
+        }
+    }
+
+    for (auto& payload : payloads)
+    {
+        trainer.add_sample(payload.data(), payload.size());
+    }
+
+    std::string trained = trainer.train();
+    if (trained.empty())
+    {
+        std::cerr << "the samples share nothing worth a dictionary" << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(out_path, std::ios::binary);
+    out.write(trained.data(), (std::streamsize)trained.size());
+    if (!out.good())
+    {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+
+    // an estimate on the training set itself, keep some captures aside for an honest one
+    compress_dictionary dictionary(0, trained);
+    size_t raw = 0, plain = 0, primed = 0;
+    for (auto& payload : payloads)
+    {
+        if (payload.size() < 2)
+            continue;
+
+        raw += payload.size();
+        plain += wire_size(payload.data(), payload.size(), nullptr);
+        primed += wire_size(payload.data(), payload.size(), &dictionary);
+    }
+
+    std::cout << trainer.sample_count() << " samples, " << trainer.sample_bytes() << " bytes -> "
+        << trained.size() << " byte dictionary" << std::endl;
+    std::cout << "payloads " << raw << " bytes, raw deflate " << plain << ", with dictionary " << primed << std::endl;
+
+    return 0;
+}
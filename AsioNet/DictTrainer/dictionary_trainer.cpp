@@ -0,0 +1,155 @@
+#include "dictionary_trainer.h"
+
+#include <algorithm>
+#include <queue>
+
+// k-mer counters, collisions only blur the scores a little
+#define KMER_TABLE_BITS 20
+
+namespace
+{
+    struct candidate
+    {
+        uint64_t score;
+        size_t pos;
+        size_t end;
+
+        bool operator<(const candidate& other) const { return score < other.score; }
+    };
+}
+
+net_middleware::dictionary_trainer::dictionary_trainer(size_t dict_size, size_t segment_len, size_t kmer_len) :
+    _dict_size(dict_size),
+    _segment_len(segment_len),
+    _kmer_len(kmer_len)
+{
+}
+
+void net_middleware::dictionary_trainer::add_sample(const unsigned char* data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    _offsets.push_back(_samples.size());
+    _samples.insert(_samples.end(), data, data + len);
+}
+
+uint32_t net_middleware::dictionary_trainer::kmer_hash(const unsigned char* p) const
+{
+    uint64_t h = 0;
+    for (size_t i = 0; i < _kmer_len; ++i)
+    {
+        h = (h << 8) | p[i];
+    }
+
+    return (uint32_t)((h * 0x9E3779B97F4A7C15ull) >> (64 - KMER_TABLE_BITS));
+}
+
+uint64_t net_middleware::dictionary_trainer::segment_score(const std::vector<uint32_t>& counts, size_t pos, size_t end) const
+{
+    uint64_t score = 0;
+    for (size_t i = pos; i + _kmer_len <= end; ++i)
+    {
+        score += counts[kmer_hash(&_samples[i])];
+    }
+
+    return score;
+}
+
+std::string net_middleware::dictionary_trainer::train() const
+{
+    std::vector<uint32_t> counts((size_t)1 << KMER_TABLE_BITS, 0);
+
+    // in how many samples a k-mer occurs, a sample repeating itself is deflate's job anyway
+    std::vector<uint32_t> seen;
+    for (size_t s = 0; s < _offsets.size(); ++s)
+    {
+        size_t begin = _offsets[s];
+        size_t end = s + 1 < _offsets.size() ? _offsets[s + 1] : _samples.size();
+
+        seen.clear();
+        for (size_t i = begin; i + _kmer_len <= end; ++i)
+        {
+            seen.push_back(kmer_hash(&_samples[i]));
+        }
+
+        std::sort(seen.begin(), seen.end());
+        seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+        for (auto h : seen)
+        {
+            ++counts[h];
+        }
+    }
+
+    // a k-mer of a single sample is worth nothing to the next one
+    for (auto& c : counts)
+    {
+        if (c < 2)
+            c = 0;
+    }
+
+    // candidates overlap by three quarters, a segment boundary rarely lands on the best spot otherwise
+    std::priority_queue<candidate> queue;
+    size_t step = std::max<size_t>(1, _segment_len / 4);
+    for (size_t s = 0; s < _offsets.size(); ++s)
+    {
+        size_t begin = _offsets[s];
+        size_t end = s + 1 < _offsets.size() ? _offsets[s + 1] : _samples.size();
+
+        for (size_t pos = begin; pos < end; pos += step)
+        {
+            size_t seg_end = std::min(pos + _segment_len, end);
+            candidate c = { segment_score(counts, pos, seg_end), pos, seg_end };
+            if (c.score > 0)
+                queue.push(c);
+
+            if (seg_end == end)
+                break;
+        }
+    }
+
+    // scores only drop as k-mers get used up, so a popped candidate that still beats the
+    // next one after rescoring is the real best
+    std::vector<candidate> picked;
+    size_t picked_bytes = 0;
+    while (!queue.empty() && picked_bytes < _dict_size)
+    {
+        candidate top = queue.top();
+        queue.pop();
+
+        top.score = segment_score(counts, top.pos, top.end);
+        if (top.score == 0)
+            continue;
+
+        if (!queue.empty() && top.score < queue.top().score)
+        {
+            queue.push(top);
+            continue;
+        }
+
+        for (size_t i = top.pos; i + _kmer_len <= top.end; ++i)
+        {
+            counts[kmer_hash(&_samples[i])] = 0;
+        }
+
+        picked.push_back(top);
+        picked_bytes += top.end - top.pos;
+    }
+
+    // best last, the tail is cut if the last pick overshot
+    std::string dictionary;
+    dictionary.reserve(picked_bytes);
+    for (auto iter = picked.rbegin(); iter != picked.rend(); ++iter)
+    {
+        dictionary.append((const char*)&_samples[iter->pos], iter->end - iter->pos);
+    }
+
+    if (dictionary.size() > _dict_size)
+    {
+        dictionary.erase(0, dictionary.size() - _dict_size);
+    }
+
+    return dictionary;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace net_middleware
+{
+    // builds a preset deflate dictionary out of sample payloads.
+    // segments whose k-mers show up in many samples win, greedily, a picked segment's k-mers
+    // stop counting so the dictionary doesn't repeat itself; the best segment goes last,
+    // where deflate reaches it with the shortest distances
+    class dictionary_trainer
+    {
+    public:
+        // @param dict_size bytes of the result, deflate never looks further back than 32K
+        // @param segment_len length of the pieces the dictionary is made of
+        // @param kmer_len shortest match that counts, deflate matches from 3 up
+        dictionary_trainer(size_t dict_size, size_t segment_len = 32, size_t kmer_len = 6);
+
+        void add_sample(const unsigned char* data, size_t len);
+
+        inline size_t sample_count() const { return _offsets.size(); }
+
+        inline size_t sample_bytes() const { return _samples.size(); }
+
+        // @return at most dict_size bytes, shorter if the samples run out of shared content
+        std::string train() const;
+
+    private:
+        uint32_t kmer_hash(const unsigned char* p) const;
+
+        // sum of the counts of the k-mers starting in [pos, pos + segment_len)
+        uint64_t segment_score(const std::vector<uint32_t>& counts, size_t pos, size_t end) const;
+
+    private:
+        size_t _dict_size;
+        size_t _segment_len;
+        size_t _kmer_len;
+
+        // every sample back to back, _offsets[i] is where sample i starts
+        std::vector<unsigned char> _samples;
+        std::vector<size_t> _offsets;
+    };
+}
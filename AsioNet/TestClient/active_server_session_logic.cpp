@@ -21,17 +21,17 @@ void net_middleware::active_server_session_logic::apply_session(std::weak_ptr<ba
     _session_holder = session_holder;
 }
 
-bool net_middleware::active_server_session_logic::unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block)
+bool net_middleware::active_server_session_logic::unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block)
 {
     // check mask
-    if (UNLIKELY(0 != net_middleware::proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len)))
+    if (UNLIKELY(0 != head.mask_of(buffer->buffer(), head.len)))
     {
         LOG("check mask failed, maybe it's hacked");
 
         return false;
     }
 
-    if (head->len == 0)
+    if (head.len == 0)
     {
         return false;
     }
@@ -42,14 +42,14 @@ bool net_middleware::active_server_session_logic::unwrap_received_data(once_buff
         return false;
     }
 
-    if (head->get_cmd() == (uint16_t)protocol_cmd::Commands_ConnectionConfirm)
+    if (head.get_cmd() == (uint16_t)protocol_cmd::Commands_ConnectionConfirm)
     {
         remote_session_info_confirm(buffer);
         return false;
     }
 
-    std::memcpy(ret_block->buffer(), buffer->buffer(), head->len);
-    ret_block->length = head->len;
+    std::memcpy(ret_block->buffer(), buffer->buffer(), head.len);
+    ret_block->length = head.len;
 
     return true;
 }
@@ -65,12 +65,17 @@ void net_middleware::active_server_session_logic::wrap_to_send_data(once_buffer_
         (uint16_t)net_middleware::protocol_cmd::Commands_AuthenticationAAA :
         (uint16_t)net_middleware::protocol_cmd::Commands_RoutingTransparent;
 
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, cmd, false, ++_seq);
+    wrap_as(buffer, cmd);
+}
+
+void net_middleware::active_server_session_logic::wrap_as(once_buffer_sptr& buffer, uint16_t cmd)
+{
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, cmd, false, ++_seq);
 
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), buffer->length);
-    head->mask = inverse_mask;
+    uint16_t inverse_mask = head.mask_of(buffer->buffer(), buffer->length);
+    head.mask = inverse_mask;
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(buffer->origin_buffer());
     buffer->offset -= PROTO_HEAD_SIZE;
     buffer->length += PROTO_HEAD_SIZE;
 
@@ -80,7 +85,7 @@ void net_middleware::active_server_session_logic::wrap_to_send_data(once_buffer_
     }
 }
 
-bool net_middleware::active_server_session_logic::try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head)
+bool net_middleware::active_server_session_logic::try_copy_to_storage(once_buffer_sptr data, const protocol_head& head)
 {
     // id(4) + cmd(2) + length(2) + data
 
@@ -99,7 +104,7 @@ bool net_middleware::active_server_session_logic::try_copy_to_storage(once_buffe
     _storage->tryWrite(uid, 4);
 
     unsigned char cmd[2];
-    write_uint16(cmd, head->get_cmd());
+    write_uint16(cmd, head.get_cmd());
     _storage->tryWrite(cmd, 2);
 
     unsigned char len[2];
@@ -117,7 +122,7 @@ void net_middleware::active_server_session_logic::kick_peer()
 
 void net_middleware::active_server_session_logic::send_verify_authentication()
 {
-    auto send_buffer = TEMP_BUFFER;
+    auto send_buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + 8 + _server_info.platform_.length());
     uint16_t len = 0;
     send_buffer->offset = PROTO_HEAD_SIZE;
 
@@ -139,6 +144,25 @@ void net_middleware::active_server_session_logic::send_verify_authentication()
     _session_holder.lock()->async_send(send_buffer);
 }
 
+void net_middleware::active_server_session_logic::send_command(protocol_cmd cmd, once_buffer_sptr buffer)
+{
+    if (UNLIKELY(_session_holder.expired()))
+    {
+        LOG("unexpected session expired");
+        return;
+    }
+
+    // the head takes the next seq, so it is written in the strand like wrap_to_send_data,
+    // async_send_multi then runs inline and keeps the order
+    auto session = _session_holder.lock();
+    auto self(shared_from_this());
+    session->strand_to_run().dispatch([this, self, session, cmd, buffer]() {
+        auto frame = buffer;
+        wrap_as(frame, (uint16_t)cmd);
+        session->async_send_multi(nullptr, frame);
+    });
+}
+
 void net_middleware::active_server_session_logic::set_server_info(const server_info& s_info)
 {
     _server_info = s_info;
@@ -20,18 +20,21 @@ namespace net_middleware
 
         virtual SessionType get_session_type() final { return SessionType::ACTIVE_GAMESVR; }
 
-        virtual bool unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block) final;
+        virtual bool unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block) final;
 
         virtual size_t prefix_size() final;
 
         virtual void wrap_to_send_data(once_buffer_sptr& buffer) final;
 
-        virtual bool try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head) final;
+        virtual bool try_copy_to_storage(once_buffer_sptr data, const protocol_head& head) final;
 
         virtual void kick_peer() final;
 
         void send_verify_authentication();
 
+        // buffer framed as cmd instead of Commands_RoutingTransparent, PROTO_HEAD_SIZE headroom before offset
+        void send_command(protocol_cmd cmd, once_buffer_sptr buffer);
+
         void set_server_info(const server_info& s_info);
 
         std::shared_ptr<active_server_session_logic> reset();
@@ -39,6 +42,9 @@ namespace net_middleware
         void share_storage(lockfree_buffer_sptr storage);
 
     private:
+        // must be called in strand, _seq moves on
+        void wrap_as(once_buffer_sptr& buffer, uint16_t cmd);
+
         void check_verify_res(once_buffer_sptr data);
 
         void remote_session_info_confirm(once_buffer_sptr data);
@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "active_server_session_mgr.h"
 #include "NetUtils.hpp"
 #include "proto_mask.hpp"
+#include "multicast_group.h"
 
 using namespace net_middleware;
 
@@ -58,7 +61,7 @@ void net_middleware::active_server_session_mgr::send(session_uid target_id, unsi
 {
     // ˴첽Ϊ뱣֤data_block
     // to guarantee life circle of data, use sptr instead of ptr
-    once_buffer_sptr tmp_buffer = TEMP_BUFFER;
+    once_buffer_sptr tmp_buffer = TEMP_BUFFER_OF(_session->get_logic()->prefix_size() + len);
     tmp_buffer->offset = _session->get_logic()->prefix_size();
     std::memcpy(tmp_buffer->buffer(), data_block, len);
     tmp_buffer->length = len;
@@ -78,7 +81,7 @@ void net_middleware::active_server_session_mgr::broadcast(const std::vector<sess
         return;
     }
 
-    auto buffer = TEMP_BUFFER;
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + 2 + targets.size() * sizeof(session_uid) + len);
     buffer->offset = PROTO_HEAD_SIZE + targets.size() * sizeof(session_uid) + 2;
     std::memcpy(buffer->buffer(), data_block, len);
     buffer->length = len;
@@ -90,8 +93,137 @@ void net_middleware::active_server_session_mgr::broadcast(const std::vector<sess
         write_uint32(buffer->origin_buffer(PROTO_HEAD_SIZE + 2 + i * sizeof(session_uid)), targets[i]);
     }
     buffer->offset = PROTO_HEAD_SIZE;
-    
-    _session->async_send(buffer);
+    buffer->length += 2 + targets.size() * sizeof(session_uid);
+
+    send_command(protocol_cmd::Commands_BroadCast, buffer);
+}
+
+void net_middleware::active_server_session_mgr::send_state(session_uid target_id, uint16_t channel, unsigned char* data_block, uint16_t len)
+{
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(session_uid) + sizeof(uint16_t) + len);
+    buffer->offset = PROTO_HEAD_SIZE;
+    write_uint32(buffer->buffer(), target_id);
+    write_uint16_le(buffer->buffer(sizeof(session_uid)), channel);
+    std::memcpy(buffer->buffer(sizeof(session_uid) + sizeof(uint16_t)), data_block, len);
+    buffer->length = sizeof(session_uid) + sizeof(uint16_t) + len;
+
+    send_command(protocol_cmd::Commands_RoutingState, buffer);
+}
+
+void net_middleware::active_server_session_mgr::join_group(uint32_t group_id, const std::vector<session_uid>& members)
+{
+    edit_group(protocol_cmd::Commands_GroupJoin, group_id, members);
+}
+
+void net_middleware::active_server_session_mgr::leave_group(uint32_t group_id, const std::vector<session_uid>& members)
+{
+    edit_group(protocol_cmd::Commands_GroupLeave, group_id, members);
+}
+
+void net_middleware::active_server_session_mgr::dismiss_group(uint32_t group_id)
+{
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(uint32_t));
+    buffer->offset = PROTO_HEAD_SIZE;
+    write_uint32(buffer->buffer(), group_id);
+    buffer->length = sizeof(uint32_t);
+
+    send_command(protocol_cmd::Commands_GroupDismiss, buffer);
+}
+
+void net_middleware::active_server_session_mgr::multicast(uint32_t group_id, unsigned char* data_block, uint16_t len)
+{
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(uint32_t) + len);
+    buffer->offset = PROTO_HEAD_SIZE;
+    write_uint32(buffer->buffer(), group_id);
+    std::memcpy(buffer->buffer(sizeof(uint32_t)), data_block, len);
+    buffer->length = sizeof(uint32_t) + len;
+
+    send_command(protocol_cmd::Commands_GroupCast, buffer);
+}
+
+void net_middleware::active_server_session_mgr::aoi_update(const std::vector<aoi_position>& positions)
+{
+    const size_t per_frame = PROTO_PAYLOAD_MAX / AOI_POSITION_SIZE;
+
+    for (size_t sent = 0; sent < positions.size();)
+    {
+        size_t count = std::min(positions.size() - sent, per_frame);
+
+        auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + count * AOI_POSITION_SIZE);
+        buffer->offset = PROTO_HEAD_SIZE;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const aoi_position& p = positions[sent + i];
+            write_uint32(buffer->buffer(i * AOI_POSITION_SIZE), p.uid);
+            write_uint32(buffer->buffer(i * AOI_POSITION_SIZE + 4), (uint32_t)p.x);
+            write_uint32(buffer->buffer(i * AOI_POSITION_SIZE + 8), (uint32_t)p.y);
+        }
+        buffer->length = count * AOI_POSITION_SIZE;
+
+        send_command(protocol_cmd::Commands_AoiUpdate, buffer);
+        sent += count;
+    }
+}
+
+void net_middleware::active_server_session_mgr::aoi_remove(const std::vector<session_uid>& clients)
+{
+    const size_t per_frame = PROTO_PAYLOAD_MAX / sizeof(session_uid);
+
+    for (size_t sent = 0; sent < clients.size();)
+    {
+        size_t count = std::min(clients.size() - sent, per_frame);
+
+        auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + count * sizeof(session_uid));
+        buffer->offset = PROTO_HEAD_SIZE;
+        for (size_t i = 0; i < count; ++i)
+        {
+            write_uint32(buffer->buffer(i * sizeof(session_uid)), clients[sent + i]);
+        }
+        buffer->length = count * sizeof(session_uid);
+
+        send_command(protocol_cmd::Commands_AoiRemove, buffer);
+        sent += count;
+    }
+}
+
+void net_middleware::active_server_session_mgr::aoi_cast(int32_t x, int32_t y, uint32_t radius, unsigned char* data_block, uint16_t len)
+{
+    auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + 12 + len);
+    buffer->offset = PROTO_HEAD_SIZE;
+    write_uint32(buffer->buffer(), (uint32_t)x);
+    write_uint32(buffer->buffer(4), (uint32_t)y);
+    write_uint32(buffer->buffer(8), radius);
+    std::memcpy(buffer->buffer(12), data_block, len);
+    buffer->length = 12 + len;
+
+    send_command(protocol_cmd::Commands_AoiCast, buffer);
+}
+
+void net_middleware::active_server_session_mgr::edit_group(protocol_cmd cmd, uint32_t group_id, const std::vector<session_uid>& members)
+{
+    size_t sent = 0;
+    do
+    {
+        size_t count = std::min(members.size() - sent, (size_t)MULTICAST_UIDS_PER_FRAME);
+
+        auto buffer = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(uint32_t) + count * sizeof(session_uid));
+        buffer->offset = PROTO_HEAD_SIZE;
+        write_uint32(buffer->buffer(), group_id);
+        for (size_t i = 0; i < count; ++i)
+        {
+            write_uint32(buffer->buffer(sizeof(uint32_t) + i * sizeof(session_uid)), members[sent + i]);
+        }
+        buffer->length = sizeof(uint32_t) + count * sizeof(session_uid);
+
+        send_command(cmd, buffer);
+        sent += count;
+    } while (sent < members.size());
+}
+
+void net_middleware::active_server_session_mgr::send_command(protocol_cmd cmd, once_buffer_sptr buffer)
+{
+    auto logic = session_logic_interface::session_cast<active_server_session_logic>(_session->get_logic());
+    logic->send_command(cmd, buffer);
 }
 
 bool net_middleware::active_server_session_mgr::pick_msg(session_uid* from_id, unsigned char* ret_cmd, unsigned char* ret_block, uint16_t* ret_len)
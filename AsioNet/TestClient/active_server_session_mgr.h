@@ -9,6 +9,7 @@
 #include "NetUtils.hpp"
 #include "JsonUtils.hpp"
 #include "active_server_session_logic.h"
+#include "aoi_grid.hpp"
 
 namespace net_middleware
 {
@@ -71,12 +72,38 @@ namespace net_middleware
 
         void broadcast(const std::vector<session_uid>& targets, unsigned char* data_block, uint16_t len);
 
+        // a snapshot that mostly repeats the last one on channel, the proxy may send the client a delta
+        void send_state(session_uid target_id, uint16_t channel, unsigned char* data_block, uint16_t len);
+
+        // proxy side groups, a cast frame then carries the group id instead of the targets
+        void join_group(uint32_t group_id, const std::vector<session_uid>& members);
+
+        void leave_group(uint32_t group_id, const std::vector<session_uid>& members);
+
+        void dismiss_group(uint32_t group_id);
+
+        void multicast(uint32_t group_id, unsigned char* data_block, uint16_t len);
+
+        // the proxy keeps an area of interest index of these, a cast then names a circle instead of the targets
+        void aoi_update(const std::vector<aoi_position>& positions);
+
+        void aoi_remove(const std::vector<session_uid>& clients);
+
+        // to every client within radius of (x, y)
+        void aoi_cast(int32_t x, int32_t y, uint32_t radius, unsigned char* data_block, uint16_t len);
+
         bool pick_msg(session_uid* from_id, unsigned char* ret_cmd, unsigned char* ret_block, uint16_t* ret_len);
 
         uint32_t get_session_remote_ip(session_uid s_uid);
 
         void set_session_remote_ip(session_uid s_uid, uint32_t ip);
 
+    private:
+        void send_command(protocol_cmd cmd, once_buffer_sptr buffer);
+
+        // group id(4) | uid(4) * n, split over as many frames as it takes
+        void edit_group(protocol_cmd cmd, uint32_t group_id, const std::vector<session_uid>& members);
+
     private:
         cluster_config _cluster_config;
 
@@ -6,7 +6,8 @@ using namespace net_middleware;
 using asio::ip::tcp;
 
 inner_pair_session::inner_pair_session():
-    _session_executor(new async_job_executor(1))
+    _session_executor(new async_job_executor(1)),
+    _head_already_read(false)
 {
     LOCK_FREE_BUFFER(_storage);
 }
@@ -79,7 +80,7 @@ void inner_pair_session::stop()
 
 void net_middleware::inner_pair_session::send(unsigned char* data, size_t length)
 {
-    once_buffer_sptr tmp_buffer = TEMP_BUFFER;
+    once_buffer_sptr tmp_buffer = TEMP_BUFFER_OF(_session->get_logic()->prefix_size() + length);
     tmp_buffer->offset = _session->get_logic()->prefix_size();
     std::memcpy(tmp_buffer->buffer(), data, length);
     tmp_buffer->length = length;
@@ -91,25 +92,27 @@ bool inner_pair_session::pick_msg(protocol_head* ret_head, unsigned char* ret_da
 {
     // length(2) + data
 
-    if (!_already_read_head)
+    if (!_head_already_read)
     {
         if (_storage->empty(PROTO_HEAD_SIZE))
         {
             return false;
         }
 
-        _already_read_head = HEAD_FROM_POOL;
-        _storage->tryRead(PROTO_HEAD_SIZE, (unsigned char*)_already_read_head.get());
+        unsigned char head_block[PROTO_HEAD_SIZE];
+        _storage->tryRead(PROTO_HEAD_SIZE, head_block);
+        _already_read_head = protocol_head::decode(head_block);
+        _head_already_read = true;
     }
 
-    if (!_storage->tryRead(_already_read_head->len, ret_data))
+    if (!_storage->tryRead(_already_read_head.len, ret_data))
     {
         return false;
     }
 
-    std::memcpy(ret_head, _already_read_head.get(), PROTO_HEAD_SIZE);
+    *ret_head = _already_read_head;
 
-    _already_read_head.reset();
+    _head_already_read = false;
 
     return false;
 }
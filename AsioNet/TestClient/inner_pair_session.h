@@ -65,6 +65,7 @@ namespace net_middleware
         done_action _connect_done;
 
         lockfree_buffer_sptr _storage;
-        protocol_head::head_sptr _already_read_head;
+        protocol_head _already_read_head;
+        bool _head_already_read;
     };
 }
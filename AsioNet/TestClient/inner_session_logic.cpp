@@ -21,25 +21,25 @@ void net_middleware::inner_session_logic::apply_session(std::weak_ptr<basic_asyn
     _session_holder = session_holder;
 }
 
-bool net_middleware::inner_session_logic::unwrap_received_data(once_buffer_sptr buffer, protocol_head::head_sptr head, once_buffer_sptr ret_block)
+bool net_middleware::inner_session_logic::unwrap_received_data(once_buffer_sptr buffer, const protocol_head& head, once_buffer_sptr ret_block)
 {
     // ignore seq
 
     // check mask
-    if (UNLIKELY(0 != net_middleware::proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), head->len)))
+    if (UNLIKELY(0 != head.mask_of(buffer->buffer(), head.len)))
     {
         LOG("check mask failed, maybe it's hacked");
 
         return false;
     }
 
-    if (head->len == 0)
+    if (head.len == 0)
     {
         return false;
     }
 
-    std::memcpy(ret_block->buffer(), buffer->buffer(), head->len);
-    ret_block->length = head->len;
+    std::memcpy(ret_block->buffer(), buffer->buffer(), head.len);
+    ret_block->length = head.len;
 
     return true;
 }
@@ -51,12 +51,12 @@ size_t net_middleware::inner_session_logic::prefix_size()
 
 void net_middleware::inner_session_logic::wrap_to_send_data(once_buffer_sptr& buffer)
 {
-    auto head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)protocol_cmd::Commands_RoutingTransparent, false, 0);
+    protocol_head head = protocol_head::get_a_head(FRAME_KEY, (uint16_t)buffer->length, 0, (uint16_t)protocol_cmd::Commands_RoutingTransparent, false, 0);
 
-    uint16_t inverse_mask = proto_mask::get_mask((unsigned char*)head.get(), PROTO_HEAD_SIZE, buffer->buffer(), buffer->length);
-    head->mask = inverse_mask;
+    uint16_t inverse_mask = head.mask_of(buffer->buffer(), buffer->length);
+    head.mask = inverse_mask;
 
-    std::memcpy(buffer->origin_buffer(), head.get(), PROTO_HEAD_SIZE);
+    head.encode(buffer->origin_buffer());
     buffer->offset -= PROTO_HEAD_SIZE;
     buffer->length += PROTO_HEAD_SIZE;
 
@@ -66,7 +66,7 @@ void net_middleware::inner_session_logic::wrap_to_send_data(once_buffer_sptr& bu
     }
 }
 
-bool net_middleware::inner_session_logic::try_copy_to_storage(once_buffer_sptr data, protocol_head::head_sptr head)
+bool net_middleware::inner_session_logic::try_copy_to_storage(once_buffer_sptr data, const protocol_head& head)
 {
     if (_storage->full(PROTO_HEAD_SIZE + data->length))
     {
@@ -74,7 +74,9 @@ bool net_middleware::inner_session_logic::try_copy_to_storage(once_buffer_sptr d
         return false;
     }
 
-    _storage->tryWrite((unsigned char*)head.get(), PROTO_HEAD_SIZE);
+    unsigned char head_block[PROTO_HEAD_SIZE];
+    head.encode(head_block);
+    _storage->tryWrite(head_block, PROTO_HEAD_SIZE);
 
     _storage->tryWrite(data->buffer(), data->length);
 
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// every operator new of the UnitTest process bumps this, benchmarks diff it around a loop
+extern std::atomic<size_t> g_alloc_count;
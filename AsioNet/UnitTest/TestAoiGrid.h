@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "aoi_grid.hpp"
+
+using namespace net_middleware;
+
+// every radius query must find exactly what a scan over all entities finds, across moves between
+// cells, erases, negative coordinates and radii wider than the world; test_time is the 10k moving
+// entities case, grid against the scan a game server does per event
+class TestAoiGrid :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 20000;
+    static constexpr size_t entities = 10000;
+    static constexpr int32_t world = 20000;
+    static constexpr int32_t cell_size = 1000;
+    static constexpr uint32_t radius = 1000;
+    static constexpr int32_t speed = 50;
+    static constexpr size_t ticks = 100;
+    static constexpr size_t events_per_tick = 1000;
+
+public:
+    virtual void test_memory() override
+    {
+        // cells and entities live in std containers
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+        aoi_grid<uint32_t> grid(100);
+        std::vector<aoi_position> reference;
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            session_uid uid = rng() % 500;
+            int32_t x = (int32_t)(rng() % 4000) - 2000;
+            int32_t y = (int32_t)(rng() % 4000) - 2000;
+
+            auto found = std::find_if(reference.begin(), reference.end(), [uid](const aoi_position& p) { return p.uid == uid; });
+            switch (rng() % 4)
+            {
+            case 0:
+                assert(grid.erase(uid) == (found != reference.end()));
+                if (found != reference.end())
+                    reference.erase(found);
+                break;
+            default:
+                grid.insert(uid, x, y, uid * 7);
+                if (found != reference.end())
+                {
+                    found->x = x;
+                    found->y = y;
+                }
+                else
+                {
+                    aoi_position p = { uid, x, y };
+                    reference.push_back(p);
+                }
+                break;
+            }
+
+            assert(grid.size() == reference.size());
+
+            uint32_t r = (i % 50 == 0) ? rng() % 10000 : rng() % 300;
+            int32_t qx = (int32_t)(rng() % 4000) - 2000;
+            int32_t qy = (int32_t)(rng() % 4000) - 2000;
+
+            std::vector<session_uid> actual;
+            grid.query(qx, qy, r, [&actual](session_uid id, uint32_t& value) {
+                assert(value == id * 7);
+                actual.push_back(id);
+            });
+
+            std::vector<session_uid> expect = scan(reference, qx, qy, r);
+            std::sort(actual.begin(), actual.end());
+            std::sort(expect.begin(), expect.end());
+            assert(actual == expect);
+        }
+    }
+
+    virtual void test_time() override
+    {
+        std::mt19937 rng(1);
+        std::vector<aoi_position> positions(entities);
+        for (size_t i = 0; i < entities; ++i)
+        {
+            positions[i].uid = (session_uid)i;
+            positions[i].x = (int32_t)(rng() % world);
+            positions[i].y = (int32_t)(rng() % world);
+        }
+
+        aoi_grid<uint32_t> grid(cell_size);
+        for (auto& p : positions)
+            grid.insert(p.uid, p.x, p.y, p.uid);
+
+        std::vector<aoi_position> events(events_per_tick);
+        double move_ms = 0, grid_ms = 0, scan_ms = 0;
+        size_t hits = 0, scanned = 0;
+
+        for (size_t t = 0; t < ticks; ++t)
+        {
+            for (auto& p : positions)
+            {
+                p.x = std::min(world - 1, std::max(0, p.x + (int32_t)(rng() % (2 * speed + 1)) - speed));
+                p.y = std::min(world - 1, std::max(0, p.y + (int32_t)(rng() % (2 * speed + 1)) - speed));
+            }
+
+            for (auto& e : events)
+                e = positions[rng() % entities];
+
+            auto start_t = std::chrono::high_resolution_clock::now();
+            for (auto& p : positions)
+                grid.move(p.uid, p.x, p.y);
+            auto end_t = std::chrono::high_resolution_clock::now();
+            move_ms += std::chrono::duration<double, std::milli>(end_t - start_t).count();
+
+            start_t = std::chrono::high_resolution_clock::now();
+            for (auto& e : events)
+                grid.query(e.x, e.y, radius, [&hits](session_uid, uint32_t&) { ++hits; });
+            end_t = std::chrono::high_resolution_clock::now();
+            grid_ms += std::chrono::duration<double, std::milli>(end_t - start_t).count();
+
+            start_t = std::chrono::high_resolution_clock::now();
+            for (auto& e : events)
+                scanned += scan(positions, e.x, e.y, radius).size();
+            end_t = std::chrono::high_resolution_clock::now();
+            scan_ms += std::chrono::duration<double, std::milli>(end_t - start_t).count();
+        }
+
+        assert(hits == scanned);
+
+        std::cout << entities << " entities, " << ticks << " ticks of " << events_per_tick << " events, radius " << radius << std::endl;
+        std::cout << "grid move " << move_ms / ticks << " ms/tick, query " << grid_ms / ticks << " ms/tick" << std::endl;
+        std::cout << "scan query " << scan_ms / ticks << " ms/tick" << std::endl;
+        std::cout << (double)hits / (ticks * events_per_tick) << " targets per event, "
+            << (double)hits * sizeof(session_uid) / ticks << " uid list bytes per tick left off the wire" << std::endl;
+    }
+
+private:
+    static std::vector<session_uid> scan(const std::vector<aoi_position>& positions, int32_t x, int32_t y, uint32_t r)
+    {
+        std::vector<session_uid> ret;
+        for (auto& p : positions)
+        {
+            int64_t dx = (int64_t)p.x - x;
+            int64_t dy = (int64_t)p.y - y;
+            if (dx * dx + dy * dy <= (int64_t)r * r)
+                ret.push_back(p.uid);
+        }
+        return ret;
+    }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "cipher.hpp"
+#include "NetUtils.hpp"
+
+using namespace net_middleware;
+
+// clients implement these suites from the specs, so the kernels must give the published vectors
+// (RFC 7539 2.3.2, FIPS-197 C.1) and the sse2/avx2 chacha20 must give exactly what the scalar block
+// gives, also where the counter runs out of word 12; every suite must decrypt what it encrypted
+class TestCipher :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 2000;
+    static constexpr size_t bench_bytes = 1024 * 1024 * 256;
+
+public:
+    virtual void test_memory() override
+    {
+        // keystream batches live inside the cipher objects
+    }
+
+    virtual void test_logic() override
+    {
+        check_chacha20_vector();
+        check_chacha20_kernels();
+        check_chacha20_wrap();
+        check_aes128_vector();
+        check_round_trips();
+    }
+
+    virtual void test_time() override
+    {
+        unsigned char key[CIPHER_KEY_LEN] = { 0 };
+        unsigned char rc4_key[RC4_KEY_LEN] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+        std::vector<unsigned char> data(64 * 1024, 0x5a);
+
+        CipherSuite suites[] = { CipherSuite::RC4, CipherSuite::CHACHA20, CipherSuite::AES_128_CTR };
+        const char* names[] = { "rc4", "chacha20", "aes128-ctr" };
+        for (int s = 0; s < 3; ++s)
+        {
+            if (!(cipher_factory::supported_suites() & CIPHER_SUITE_BIT(suites[s])))
+                continue;
+
+            auto cipher = cipher_factory::create(suites[s], CipherDirection::PROXY_TO_CLIENT, 1,
+                255, rc4_key, RC4_KEY_LEN, 7, rc4_context::Mode::STREAM, key);
+
+            auto start_t = std::chrono::high_resolution_clock::now();
+            for (size_t done = 0; done < bench_bytes; done += data.size())
+                cipher->crypt(data.data(), data.size());
+            auto end_t = std::chrono::high_resolution_clock::now();
+
+            double ms = std::chrono::duration<double, std::milli>(end_t - start_t).count();
+            std::cout << names[s] << ": " << bench_bytes / 1024 / 1024 / (ms / 1000) << " MB/s" << std::endl;
+        }
+    }
+
+private:
+    // key 00..1f, counter 1, nonce 00000009 0000004a 00000000
+    void check_chacha20_vector()
+    {
+        static const unsigned char expect[64] = {
+            0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+            0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+            0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+            0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+        };
+
+        uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+        for (int i = 0; i < 8; ++i)
+            state[4 + i] = (uint32_t)(i * 4) | (uint32_t)(i * 4 + 1) << 8 | (uint32_t)(i * 4 + 2) << 16 | (uint32_t)(i * 4 + 3) << 24;
+        state[12] = 1;
+        state[13] = 0x09000000;
+        state[14] = 0x4a000000;
+        state[15] = 0;
+
+        unsigned char block[64];
+        cipher_kernels::chacha20_block(state, block);
+        assert(std::memcmp(block, expect, sizeof(expect)) == 0);
+    }
+
+    // the vector kernels against 8 scalar blocks, counters close to the top of word 12 included
+    void check_chacha20_kernels()
+    {
+        std::mt19937 rng(20201017);
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            uint32_t state[16];
+            for (auto& word : state)
+                word = rng();
+            if (i % 4 == 0)
+                state[12] = 0xFFFFFFFFu - 7 - rng() % 8;
+
+            unsigned char expect[8 * 64];
+            uint32_t scalar_state[16];
+            std::memcpy(scalar_state, state, sizeof(state));
+            for (int b = 0; b < 8; ++b)
+            {
+                cipher_kernels::chacha20_block(scalar_state, expect + b * 64);
+                ++scalar_state[12];
+            }
+
+            unsigned char actual[8 * 64];
+            if (cipher_kernels::has_sse2())
+            {
+                uint32_t sse_state[16];
+                std::memcpy(sse_state, state, sizeof(state));
+                cipher_kernels::chacha20_blocks_sse2(sse_state, actual);
+                sse_state[12] += 4;
+                cipher_kernels::chacha20_blocks_sse2(sse_state, actual + 4 * 64);
+                assert(std::memcmp(actual, expect, sizeof(expect)) == 0);
+            }
+
+            if (cipher_kernels::has_avx2())
+            {
+                cipher_kernels::chacha20_blocks_avx2(state, actual);
+                assert(std::memcmp(actual, expect, sizeof(expect)) == 0);
+            }
+        }
+    }
+
+    // refill leaves a batch that wraps word 12 to the scalar block, which carries into word 14
+    void check_chacha20_wrap()
+    {
+        unsigned char key[CIPHER_KEY_LEN];
+        for (size_t i = 0; i < sizeof(key); ++i)
+            key[i] = (unsigned char)(i * 7 + 1);
+
+        const size_t blocks = 3 * CIPHER_STREAM_BATCH / 64;
+        uint64_t starts[] = { 0, 0xFFFFFFFFull - 20, 0xFFFFFFFFull - 3, 0xFFFFFFFFull, 0x1FFFFFFFFull - 9 };
+        for (uint64_t start : starts)
+        {
+            chacha20_cipher cipher(key, CipherDirection::PROXY_TO_CLIENT);
+            cipher.seek(start);
+            std::vector<unsigned char> actual(blocks * 64, 0);
+            cipher.crypt(actual.data(), actual.size());
+
+            uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+            for (int i = 0; i < 8; ++i)
+                state[4 + i] = read_uint32_le(key + i * 4);
+            state[13] = (uint32_t)CipherDirection::PROXY_TO_CLIENT;
+            state[15] = 0;
+
+            unsigned char expect[64];
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                uint64_t counter = start + b;
+                state[12] = (uint32_t)counter;
+                state[14] = (uint32_t)(counter >> 32);
+                cipher_kernels::chacha20_block(state, expect);
+                assert(std::memcmp(&actual[b * 64], expect, sizeof(expect)) == 0);
+            }
+        }
+    }
+
+    // one counter block is nonce(8) | counter(8), so the C.1 plaintext is encrypted as the first one
+    void check_aes128_vector()
+    {
+        if (!cipher_kernels::has_aes())
+        {
+            std::cout << "no aes-ni, FIPS-197 C.1 skipped" << std::endl;
+            return;
+        }
+
+        static const unsigned char key[16] = {
+            0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+        };
+        static const unsigned char nonce[8] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+        static const unsigned char expect[16] = {
+            0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+        };
+
+        unsigned char round_keys[11 * 16];
+        cipher_kernels::aes128_expand(key, round_keys);
+
+        unsigned char out[8 * 16];
+        cipher_kernels::aes128_ctr_blocks(round_keys, nonce, 0x8899aabbccddeeffull, out, 8);
+        assert(std::memcmp(out, expect, sizeof(expect)) == 0);
+    }
+
+    // both ends of a direction, messages of every size, the keystream carried on across them
+    void check_round_trips()
+    {
+        std::mt19937 rng(1);
+        unsigned char key[CIPHER_KEY_LEN];
+        for (auto& c : key)
+            c = (unsigned char)rng();
+        unsigned char rc4_key[RC4_KEY_LEN];
+        for (auto& c : rc4_key)
+            c = (unsigned char)(rng() % 255 + 1);
+
+        CipherSuite suites[] = { CipherSuite::RC4, CipherSuite::CHACHA20, CipherSuite::AES_128_CTR };
+        rc4_context::Mode modes[] = { rc4_context::Mode::RESET_PER_MESSAGE, rc4_context::Mode::STREAM };
+        for (CipherSuite suite : suites)
+        {
+            if (!(cipher_factory::supported_suites() & CIPHER_SUITE_BIT(suite)))
+                continue;
+
+            for (rc4_context::Mode mode : modes)
+            {
+                auto sender = cipher_factory::create(suite, CipherDirection::CLIENT_TO_PROXY, 1, 200, rc4_key, RC4_KEY_LEN, 13, mode, key);
+                auto receiver = cipher_factory::create(suite, CipherDirection::CLIENT_TO_PROXY, 0, 200, rc4_key, RC4_KEY_LEN, 13, mode, key);
+                auto other_way = cipher_factory::create(suite, CipherDirection::PROXY_TO_CLIENT, 1, 200, rc4_key, RC4_KEY_LEN, 13, mode, key);
+
+                for (size_t i = 0; i < rounds; ++i)
+                {
+                    size_t len = (i % 50 == 0) ? rng() % 65536 : rng() % 1500;
+                    std::vector<unsigned char> plain(len);
+                    for (auto& c : plain)
+                        c = (unsigned char)rng();
+
+                    std::vector<unsigned char> data(plain);
+                    sender->crypt(data.data(), data.size());
+                    assert(len < 16 || data != plain);
+
+                    // the other direction runs a keystream of its own
+                    std::vector<unsigned char> reverse(plain);
+                    other_way->crypt(reverse.data(), reverse.size());
+                    assert(len < 16 || suite == CipherSuite::RC4 || reverse != data);
+
+                    receiver->crypt(data.data(), data.size());
+                    assert(data == plain);
+                }
+            }
+        }
+    }
+};
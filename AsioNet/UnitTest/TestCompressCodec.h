@@ -0,0 +1,251 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "compression/zlib_context.hpp"
+#include "compression/lz_codec.h"
+#include "compression/xor_delta.h"
+
+using namespace net_middleware;
+
+// lz_codec and xor_delta must give back every byte on any input and never overrun a tight output buffer;
+// test_time weighs it against the deflate levels on a packet corpus, a capture of uint16 little
+// endian length prefixed payloads (the DictTrainer -f format) if there is one, synthetic otherwise
+class TestCompressCodec :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 100000;
+    static constexpr size_t bench_rounds = 5;
+
+    explicit TestCompressCodec(const std::string& corpus_path = "../../../../bench/packets.cap") :
+        _corpus_path(corpus_path)
+    {
+    }
+
+public:
+    virtual void test_memory() override
+    {
+        // the codec works in caller buffers and a stack table
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            size_t len = (i % 100 == 0) ? rng() % 65536 : rng() % 1024;
+            std::vector<unsigned char> data(len);
+
+            // random, two letters, short repeats, all zero
+            switch (rng() % 4)
+            {
+            case 0:
+                for (auto& c : data)
+                    c = (unsigned char)rng();
+                break;
+            case 1:
+                for (auto& c : data)
+                    c = "ab"[rng() % 2];
+                break;
+            case 2:
+                for (size_t j = 0; j < len; ++j)
+                    data[j] = (j > 8 && rng() % 4) ? data[j - 1 - rng() % 8] : (unsigned char)rng();
+                break;
+            default:
+                break;
+            }
+
+            if (len == 0)
+                continue;
+
+            std::vector<unsigned char> packed(LZ_FRAME_PREFIX + lz_codec::block_bound(len));
+            size_t packed_len = lz_codec::compress(data.data(), len, packed.data(), packed.size());
+            assert(packed_len > 0);
+
+            std::vector<unsigned char> back(lz_codec::frame_raw_length(packed.data(), packed_len));
+            assert(back.size() == len);
+            assert(lz_codec::decompress(packed.data(), packed_len, back.data()));
+            assert(0 == std::memcmp(back.data(), data.data(), len));
+
+            // one byte short must be refused, not overrun
+            assert(0 == lz_codec::compress(data.data(), len, packed.data(), packed_len - 1));
+
+            // corrupt frames may decode to garbage but never out of bounds
+            packed[LZ_FRAME_PREFIX + rng() % (packed_len - LZ_FRAME_PREFIX)] ^= (unsigned char)(1 + rng() % 255);
+            lz_codec::decompress(packed.data(), packed_len, back.data());
+        }
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            // a snapshot that mostly repeats its base, often at another length
+            size_t base_len = rng() % 600;
+            size_t len = (i % 4 == 0) ? rng() % 600 : base_len;
+            std::vector<unsigned char> base(base_len), data(len);
+            for (auto& c : base)
+                c = (unsigned char)(rng() % 4);
+            for (size_t j = 0; j < len; ++j)
+                data[j] = (j < base_len && rng() % 10) ? base[j] : (unsigned char)(rng() % 4);
+
+            std::vector<unsigned char> delta(xor_delta::bound(len));
+            size_t delta_len = xor_delta::encode(base.data(), base_len, data.data(), len, delta.data(), delta.size());
+            assert(delta_len > 0);
+
+            std::vector<unsigned char> back(xor_delta::target_length(delta.data(), delta_len) + 1);
+            assert(back.size() == len + 1);
+            assert(xor_delta::decode(base.data(), base_len, delta.data(), delta_len, back.data()));
+            assert(len == 0 || 0 == std::memcmp(back.data(), data.data(), len));
+
+            if (delta_len > XOR_DELTA_PREFIX)
+            {
+                assert(0 == xor_delta::encode(base.data(), base_len, data.data(), len, delta.data(), delta_len - 1));
+
+                delta[XOR_DELTA_PREFIX + rng() % (delta_len - XOR_DELTA_PREFIX)] ^= (unsigned char)(1 + rng() % 255);
+                xor_delta::decode(base.data(), base_len, delta.data(), delta_len, back.data());
+            }
+        }
+    }
+
+    virtual void test_time() override
+    {
+        std::vector<std::string> corpus;
+        if (!load_corpus(corpus))
+        {
+            std::cout << "no capture at " << _corpus_path << ", using synthetic packets" << std::endl;
+            make_corpus(corpus);
+        }
+
+        size_t total = 0;
+        for (auto& packet : corpus)
+            total += packet.size();
+
+        std::cout << corpus.size() << " packets, " << total << " bytes" << std::endl;
+
+        std::vector<unsigned char> out(LZ_FRAME_PREFIX + lz_codec::block_bound(65536));
+        std::vector<unsigned char> back(65536);
+
+        const int levels[] = { 1, 6, 9 };
+        for (int level : levels)
+        {
+            deflate_context deflater(CompressFormat::RAW_DEFLATE, level);
+            size_t packed = 0;
+
+            auto start_t = std::chrono::high_resolution_clock::now();
+            for (size_t r = 0; r < bench_rounds; ++r)
+            {
+                packed = 0;
+                for (auto& packet : corpus)
+                    packed += wire_size(packet, deflater.compress(bytes_of(packet), packet.size(), out.data(), packet.size() - 1));
+            }
+            auto end_t = std::chrono::high_resolution_clock::now();
+
+            report("deflate level " + std::to_string(level), packed, total, start_t, end_t);
+        }
+
+        size_t packed = 0;
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t r = 0; r < bench_rounds; ++r)
+        {
+            packed = 0;
+            for (auto& packet : corpus)
+                packed += wire_size(packet, lz_codec::compress(bytes_of(packet), packet.size(), out.data(), packet.size() - 1));
+        }
+        auto end_t = std::chrono::high_resolution_clock::now();
+        report("lz_codec", packed, total, start_t, end_t);
+
+        // decoding, what every client pays
+        std::vector<std::vector<unsigned char>> frames;
+        for (auto& packet : corpus)
+        {
+            size_t len = lz_codec::compress(bytes_of(packet), packet.size(), out.data(), out.size());
+            frames.push_back(std::vector<unsigned char>(out.begin(), out.begin() + len));
+        }
+
+        start_t = std::chrono::high_resolution_clock::now();
+        for (size_t r = 0; r < bench_rounds; ++r)
+        {
+            for (auto& frame : frames)
+                lz_codec::decompress(frame.data(), frame.size(), back.data());
+        }
+        end_t = std::chrono::high_resolution_clock::now();
+        report("lz_codec decode", total, total, start_t, end_t);
+    }
+
+private:
+    static const unsigned char* bytes_of(const std::string& s)
+    {
+        return reinterpret_cast<const unsigned char*>(s.data());
+    }
+
+    // what compress_to_send would put on the wire, the payload itself when compressing didn't pay
+    static size_t wire_size(const std::string& packet, size_t packed)
+    {
+        return packed == 0 ? packet.size() : packed;
+    }
+
+    template <typename Clock>
+    static void report(const std::string& name, size_t packed, size_t total, Clock start_t, Clock end_t)
+    {
+        double ms = std::chrono::duration<double, std::milli>(end_t - start_t).count();
+        std::cout << name << ": ratio " << (double)packed / total
+            << ", " << (size_t)(total * bench_rounds / ms / 1000) << " MB/s" << std::endl;
+    }
+
+    bool load_corpus(std::vector<std::string>& corpus)
+    {
+        std::ifstream file(_corpus_path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        for (size_t pos = 0; pos + 2 <= bytes.size();)
+        {
+            size_t len = (unsigned char)bytes[pos] | ((size_t)(unsigned char)bytes[pos + 1] << 8);
+            pos += 2;
+            if (pos + len > bytes.size())
+                break;
+
+            if (len > 1)
+                corpus.push_back(bytes.substr(pos, len));
+            pos += len;
+        }
+
+        return !corpus.empty();
+    }
+
+    // state updates with a few bulk snapshots in between
+    static void make_corpus(std::vector<std::string>& corpus)
+    {
+        std::mt19937 rng(1);
+        char line[256];
+        for (size_t i = 0; i < 20000; ++i)
+        {
+            int n = std::snprintf(line, sizeof(line),
+                "{\"cmd\":\"move\",\"entity\":%u,\"pos\":{\"x\":%u,\"y\":%u},\"dir\":%u,\"state\":\"running\",\"buffs\":[%u,%u]}",
+                (unsigned)(rng() % 9999), (unsigned)(rng() % 999), (unsigned)(rng() % 999),
+                (unsigned)(rng() % 360), (unsigned)(rng() % 50), (unsigned)(rng() % 50));
+
+            std::string packet(line, (size_t)n);
+            if (i % 10 == 0)
+            {
+                for (size_t k = 0; k < 6; ++k)
+                    packet += packet;
+            }
+
+            corpus.push_back(packet);
+        }
+    }
+
+private:
+    std::string _corpus_path;
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "parallel_core/ConcurrentHashMap.hpp"
+
+using namespace parallel_core;
+
+// every operation must agree with an unordered_map, readers must never see a value that was
+// already replaced and freed; test_time runs a 90% read mix at 1 to 64 threads against what
+// SafeHashMap did, one recursive_mutex around an unordered_map (its console log line left out)
+class TestConcurrentHashMap :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 200000;
+    static constexpr uint32_t keys = 100000;
+    static constexpr size_t ops_per_thread = 200000;
+    static constexpr size_t max_threads = 64;
+    static constexpr uint64_t alive = 0x5a5a5a5a5a5a5a5aull;
+
+    struct value
+    {
+        explicit value(uint32_t k) : canary(alive), key(k) {}
+        ~value() { canary = 0; }
+
+        uint64_t canary;
+        uint32_t key;
+    };
+    typedef std::shared_ptr<value> value_sptr;
+
+    // SafeHashMap's locking
+    class locked_map
+    {
+    public:
+        bool try_get(uint32_t k, value_sptr& ref_val)
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mut);
+            auto iter = _container.find(k);
+            if (iter == _container.end())
+                return false;
+            ref_val = iter->second;
+            return true;
+        }
+
+        void insert_or_set(uint32_t k, const value_sptr& v)
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mut);
+            _container[k] = v;
+        }
+
+        bool erase(uint32_t k)
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mut);
+            return _container.erase(k) > 0;
+        }
+
+    private:
+        std::recursive_mutex _mut;
+        std::unordered_map<uint32_t, value_sptr> _container;
+    };
+
+public:
+    virtual void test_memory() override
+    {
+        // nodes and bucket arrays go to EpochReclaimer when replaced
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+        ConcurrentHashMap<uint32_t, uint32_t> map(3);
+        std::unordered_map<uint32_t, uint32_t> reference;
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            uint32_t k = rng() % 5000;
+            uint32_t v = rng();
+            switch (rng() % 4)
+            {
+            case 0:
+                assert(map.insert(k, v) == (reference.count(k) == 0));
+                reference.insert(std::make_pair(k, v));
+                break;
+            case 1:
+                map.insert_or_set(k, v);
+                reference[k] = v;
+                break;
+            case 2:
+                assert(map.erase(k) == (reference.erase(k) > 0));
+                break;
+            default:
+            {
+                uint32_t got = 0;
+                auto iter = reference.find(k);
+                assert(map.try_get(k, got) == (iter != reference.end()));
+                assert(iter == reference.end() || got == iter->second);
+                break;
+            }
+            }
+            assert(map.size() == reference.size());
+        }
+
+        std::vector<uint32_t> batch;
+        for (uint32_t k = 0; k < 100; ++k)
+            batch.push_back(k);
+        std::vector<uint32_t> found;
+        size_t hits = 0;
+        for (uint32_t k : batch)
+            hits += reference.count(k);
+        assert(map.try_get_all(batch, found) == hits);
+
+        size_t visited = 0;
+        map.for_each([&visited, &reference](const uint32_t& k, const uint32_t& v) {
+            assert(reference.at(k) == v);
+            ++visited;
+        });
+        assert(visited == reference.size());
+
+        size_t odd = 0;
+        for (auto& pair : reference)
+            odd += pair.first % 2;
+        assert(map.erase_if([](const uint32_t& k, const uint32_t&) { return k % 2 == 1; }) == odd);
+        assert(map.size() == reference.size() - odd);
+
+        map.clear();
+        assert(map.empty() && !map.contains_key(2));
+    }
+
+    virtual void test_time() override
+    {
+        ConcurrentHashMap<uint32_t, value_sptr> sharded;
+        locked_map locked;
+        for (uint32_t k = 0; k < keys; ++k)
+        {
+            sharded.insert(k, std::make_shared<value>(k));
+            locked.insert_or_set(k, std::make_shared<value>(k));
+        }
+
+        // the first pass over either pays for cold caches
+        run(1, sharded);
+        run(1, locked);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double sharded_ms = run(threads, sharded);
+            double locked_ms = run(threads, locked);
+
+            double total = (double)threads * ops_per_thread / 1000;
+            std::cout << threads << " threads: sharded " << total / sharded_ms << " Mops/s, locked "
+                << total / locked_ms << " Mops/s" << std::endl;
+        }
+    }
+
+    virtual void test_threadsafe() override
+    {
+        ConcurrentHashMap<uint32_t, value_sptr> map;
+        for (uint32_t k = 0; k < keys; ++k)
+            map.insert(k, std::make_shared<value>(k));
+
+        run(4, map);
+
+        size_t visited = 0;
+        map.for_each([&visited](const uint32_t& k, const value_sptr& v) {
+            assert(v->canary == alive && v->key == k);
+            ++visited;
+        });
+        assert(visited == map.size());
+    }
+
+private:
+    // 90% reads, the rest replaces or drops and puts back a key
+    template <typename Map>
+    static double run(size_t threads, Map& map)
+    {
+        std::vector<std::thread> workers;
+
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&map, t]() {
+                std::mt19937 rng((unsigned)t);
+                for (size_t i = 0; i < ops_per_thread; ++i)
+                {
+                    uint32_t k = rng() % keys;
+                    uint32_t op = rng() % 20;
+                    if (op < 18)
+                    {
+                        value_sptr v;
+                        if (map.try_get(k, v))
+                            assert(v->canary == alive && v->key == k);
+                    }
+                    else if (op == 18)
+                    {
+                        map.insert_or_set(k, std::make_shared<value>(k));
+                    }
+                    else if (map.erase(k))
+                    {
+                        map.insert_or_set(k, std::make_shared<value>(k));
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        auto end_t = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end_t - start_t).count();
+    }
+};
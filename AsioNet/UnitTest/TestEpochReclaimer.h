@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "parallel_core/EpochReclaimer.h"
+
+using namespace parallel_core;
+
+// nothing retired may be destroyed while a thread pinned before the retire is still pinned, and
+// everything retired must be destroyed once nobody is pinned; test_threadsafe swaps a shared
+// pointer under readers that check what they loaded is still alive
+class TestEpochReclaimer :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 100000;
+    static constexpr size_t thread_num = 4;
+    static constexpr uint64_t alive = 0x5a5a5a5a5a5a5a5aull;
+
+    struct node
+    {
+        std::atomic<uint64_t> canary;
+        uint64_t value;
+    };
+
+public:
+    virtual void test_memory() override
+    {
+        // retired objects wait in one vector until collected
+    }
+
+    virtual void test_logic() override
+    {
+        EPOCH_RECLAIMER->collect();
+        EPOCH_RECLAIMER->collect();
+        assert(EPOCH_RECLAIMER->pending() == 0);
+
+        bool freed = false;
+        {
+            EpochGuard outer;
+            {
+                EpochGuard inner;
+            }
+
+            // still pinned by outer
+            EPOCH_RECLAIMER->retire([&freed]() { freed = true; });
+            for (size_t i = 0; i < 10; ++i)
+                EPOCH_RECLAIMER->collect();
+            assert(!freed);
+        }
+
+        EPOCH_RECLAIMER->collect();
+        EPOCH_RECLAIMER->collect();
+        assert(freed && EPOCH_RECLAIMER->pending() == 0);
+    }
+
+    virtual void test_time() override
+    {
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < rounds * 100; ++i)
+        {
+            EpochGuard guard;
+        }
+        auto end_t = std::chrono::high_resolution_clock::now();
+
+        std::cout << "pin and unpin: " << std::chrono::duration<double, std::nano>(end_t - start_t).count() / (rounds * 100) << " ns" << std::endl;
+    }
+
+    virtual void test_threadsafe() override
+    {
+        std::atomic<node*> shared(make_node(0));
+        std::atomic<bool> stop(false);
+
+        std::vector<std::thread> readers;
+        for (size_t t = 0; t < thread_num; ++t)
+        {
+            readers.emplace_back([&shared, &stop]() {
+                while (!stop.load())
+                {
+                    EpochGuard guard;
+                    node* n = shared.load(std::memory_order_acquire);
+                    assert(n->canary.load() == alive);
+                    std::this_thread::yield();
+                    assert(n->canary.load() == alive);
+                }
+            });
+        }
+
+        for (size_t i = 1; i <= rounds; ++i)
+        {
+            node* old = shared.exchange(make_node(i), std::memory_order_acq_rel);
+            EPOCH_RECLAIMER->retire([old]() {
+                old->canary.store(0);
+                delete old;
+            });
+        }
+
+        stop.store(true);
+        for (auto& reader : readers)
+            reader.join();
+
+        EPOCH_RECLAIMER->collect();
+        EPOCH_RECLAIMER->collect();
+        assert(EPOCH_RECLAIMER->pending() == 0);
+        delete shared.load();
+    }
+
+private:
+    static node* make_node(uint64_t value)
+    {
+        node* n = new node;
+        n->canary.store(alive);
+        n->value = value;
+        return n;
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "AllocCounter.h"
+#include "NetUtils.hpp"
+#include "protocol.hpp"
+
+using namespace net_middleware;
+
+// one forwarded message is replayed the way the cut-through path handles it:
+// parse the head, stage the outbound head in a tiny buffer, capture both into the handler that hops
+// to the target strand, queue them as segments and drop them once "written".
+// the strand hop itself runs inline, asio recycles its operation memory per thread on its own
+class TestPoolHandle :public UnitTestInterface
+{
+public:
+    static constexpr size_t capacity = 1024 * 1000;
+    static constexpr size_t warm_up = 1024;
+    static constexpr size_t queue_depth = SEND_GATHER_MAX;
+    static constexpr size_t thread_num = 4;
+public:
+    virtual void test_memory() override
+    {
+        // legacy shape: shared_ptr with a capturing deleter for every pooled object, pooled heads
+        size_t legacy = run_shared(capacity);
+        size_t handle = run_handle(capacity);
+
+        std::lock_guard<std::recursive_mutex> lck(_mut);
+        std::cout << "mallocs per forwarded message, shared_ptr: " << (double)legacy / capacity
+            << ", handle: " << (double)handle / capacity << std::endl;
+        assert(handle == 0);
+    }
+
+    virtual void test_logic() override
+    {
+        once_buffer_sptr first = TEMP_BUFFER_OF(SLAB_CLASS_1);
+        slab_buffer* raw = first.get();
+
+        once_buffer_sptr copy = first;
+        first = nullptr;
+        assert(copy.get() == raw);
+
+        // the last reference hands the buffer back to this thread's magazine
+        copy.reset();
+        once_buffer_sptr again = TEMP_BUFFER_OF(SLAB_CLASS_1);
+        assert(again.get() == raw);
+
+        parallel_core::AnyPoolHandle holder(again);
+        again.reset();
+        holder.reset();
+        assert(TEMP_BUFFER_OF(SLAB_CLASS_1).get() == raw);
+    }
+
+    virtual void test_time() override
+    {
+        // libstdc++ skips the shared_ptr atomics until the process has started a thread, the proxy always has
+        std::thread([]() {}).join();
+
+        auto timer = std::chrono::high_resolution_clock();
+
+        auto start_t = timer.now();
+        run_shared(capacity);
+        auto legacy_t = timer.now();
+        run_handle(capacity);
+        auto end_t = timer.now();
+
+        auto legacy = std::chrono::duration_cast<std::chrono::milliseconds>(legacy_t - start_t);
+        auto handle = std::chrono::duration_cast<std::chrono::milliseconds>(end_t - legacy_t);
+
+        std::lock_guard<std::recursive_mutex> lck(_mut);
+        std::cout << "time cost during forwarding 1,024,000 messages, shared_ptr: " << legacy.count()
+            << "ms, handle: " << handle.count() << "ms" << std::endl;
+    }
+
+    virtual void test_threadsafe() override
+    {
+        // buffers allocated on one thread and released on the next, as they cross strands
+        std::vector<once_buffer_sptr> handoff[thread_num];
+        std::mutex handoff_mut[thread_num];
+        std::thread ths[thread_num];
+
+        for (size_t i = 0; i < thread_num; ++i)
+        {
+            ths[i] = std::thread([&, i]() {
+                for (size_t n = 0; n < capacity / thread_num; ++n)
+                {
+                    once_buffer_sptr buffer = TEMP_BUFFER_OF(SLAB_CLASS_0);
+                    buffer->resize(4);
+                    write_uint32(buffer->buffer(), (uint32_t)n);
+
+                    std::vector<once_buffer_sptr> mine;
+                    {
+                        std::lock_guard<std::mutex> lck(handoff_mut[(i + 1) % thread_num]);
+                        handoff[(i + 1) % thread_num].push_back(buffer);
+                    }
+                    {
+                        std::lock_guard<std::mutex> lck(handoff_mut[i]);
+                        mine.swap(handoff[i]);
+                    }
+                }
+            });
+        }
+
+        for (size_t i = 0; i < thread_num; ++i)
+        {
+            ths[i].join();
+        }
+    }
+
+private:
+    // @return mallocs seen after warm-up
+    size_t run_handle(size_t count)
+    {
+        std::vector<parallel_core::AnyPoolHandle> send_queue(queue_depth * 2);
+        once_buffer_sptr recv_block = prepare_frame();
+
+        size_t allocs = 0;
+        for (size_t i = 0; i < count + warm_up; ++i)
+        {
+            if (i == warm_up)
+                allocs = g_alloc_count.load();
+
+            protocol_head head = protocol_head::decode(recv_block->buffer());
+
+            tiny_buffer_sptr head_block = TINY_BUFFER;
+            head.encode(head_block->buffer());
+            head_block->length = PROTO_HEAD_SIZE;
+
+            size_t slot = (i % queue_depth) * 2;
+            auto hop = [&send_queue, slot, head_block, recv_block]() {
+                send_queue[slot] = head_block;
+                send_queue[slot + 1] = recv_block;
+            };
+            hop();
+        }
+
+        return g_alloc_count.load() - allocs;
+    }
+
+    size_t run_shared(size_t count)
+    {
+        std::vector<std::shared_ptr<void>> send_queue(queue_depth * 2);
+        std::shared_ptr<slab_buffer> recv_block(prepare_frame().detach(), [](slab_buffer* p) {
+            once_buffer_sptr::adopt(p);
+        });
+
+        auto head_pool = parallel_core::ThreadSafeObjectPool<protocol_head>::instance();
+        auto tiny_pool = TINY_BUFFER_POOL;
+
+        size_t allocs = 0;
+        for (size_t i = 0; i < count + warm_up; ++i)
+        {
+            if (i == warm_up)
+                allocs = g_alloc_count.load();
+
+            std::shared_ptr<protocol_head> head = head_pool->get_shared();
+            std::memcpy(head.get(), recv_block->buffer(), PROTO_HEAD_SIZE);
+
+            auto head_block = tiny_pool->get_shared();
+            head_block->offset = 0;
+            std::memcpy(head_block->buffer(), head.get(), PROTO_HEAD_SIZE);
+            head_block->length = PROTO_HEAD_SIZE;
+
+            size_t slot = (i % queue_depth) * 2;
+            auto hop = [&send_queue, slot, head_block, recv_block]() {
+                send_queue[slot] = head_block;
+                send_queue[slot + 1] = recv_block;
+            };
+            hop();
+        }
+
+        return g_alloc_count.load() - allocs;
+    }
+
+    once_buffer_sptr prepare_frame()
+    {
+        unsigned char payload[256] = { 0 };
+
+        once_buffer_sptr block = TEMP_BUFFER_OF(PROTO_HEAD_SIZE + sizeof(payload));
+        uint16_t length = 0;
+        protocol_head::pack(block->buffer(), length, payload, sizeof(payload), (uint16_t)protocol_cmd::Commands_RoutingTransparent, 1);
+        block->length = length;
+
+        return block;
+    }
+
+private:
+    std::recursive_mutex _mut;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "proto_mask.hpp"
+#include "protocol.hpp"
+
+using namespace net_middleware;
+
+// CsNetwork computes the mask with the plain big endian loop, every dispatched kernel must give
+// bit-exactly what mask_off_32_scalar gives, on any length, alignment and carry-in
+class TestProtoMask :public UnitTestInterface
+{
+public:
+    static constexpr size_t max_len = 65536 + PROTO_HEAD_SIZE;
+    static constexpr size_t rounds = 200000;
+    static constexpr size_t bench_rounds = 20000;
+public:
+    virtual void test_memory() override
+    {
+        // nothing is allocated by the checksum
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+        std::vector<unsigned char> data(max_len + 64);
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            // long frames now and then, mostly lengths around the scalar/wide cut
+            size_t len = (i % 100 == 0) ? rng() % max_len : rng() % 1024;
+            size_t align = rng() % 64;
+            uint32_t acc = (i % 3 == 0) ? rng() % 0x1FFFF : rng() % 0x10000;
+
+            switch (rng() % 4)
+            {
+            case 0:
+                std::fill(data.begin(), data.end(), 0xFF);
+                break;
+            case 1:
+                std::fill(data.begin(), data.end(), 0);
+                break;
+            default:
+                for (size_t j = 0; j < len; ++j)
+                    data[align + j] = (unsigned char)rng();
+                break;
+            }
+
+            uint32_t expect = proto_mask::mask_off_32_scalar(&data[align], len, acc);
+            uint32_t actual = proto_mask::mask_off_32(&data[align], len, acc);
+            assert(expect == actual);
+
+            if (len >= PROTO_HEAD_SIZE)
+                check_remask(&data[align], len, rng);
+        }
+    }
+
+    virtual void test_time() override
+    {
+        std::vector<unsigned char> data(max_len);
+        std::mt19937 rng(1);
+        for (auto& c : data)
+            c = (unsigned char)rng();
+
+        auto timer = std::chrono::high_resolution_clock();
+        uint32_t sink = 0;
+
+        auto start_t = timer.now();
+        for (size_t i = 0; i < bench_rounds; ++i)
+            sink += proto_mask::mask_off_32_scalar(data.data(), data.size(), (uint32_t)i);
+        auto scalar_t = timer.now();
+        for (size_t i = 0; i < bench_rounds; ++i)
+            sink += proto_mask::mask_off_32(data.data(), data.size(), (uint32_t)i);
+        auto end_t = timer.now();
+
+        auto scalar = std::chrono::duration_cast<std::chrono::milliseconds>(scalar_t - start_t);
+        auto wide = std::chrono::duration_cast<std::chrono::milliseconds>(end_t - scalar_t);
+
+        std::cout << "time cost masking 20,000 64K frames, scalar: " << scalar.count()
+            << "ms, dispatched: " << wide.count() << "ms (" << sink << ")" << std::endl;
+    }
+
+private:
+    // a head rewritten in place must get the same mask as a full pass over head and payload
+    void check_remask(unsigned char* frame, size_t len, std::mt19937& rng)
+    {
+        unsigned char* payload = frame + PROTO_HEAD_SIZE;
+        size_t payload_len = len - PROTO_HEAD_SIZE;
+
+        protocol_head sealed = protocol_head::get_a_head(FRAME_KEY, (uint16_t)payload_len, 0, (uint16_t)(rng() & 0x7FFF), (rng() & 1) != 0, rng());
+        sealed.mask = sealed.mask_of(payload, payload_len);
+
+        protocol_head resealed = protocol_head::get_a_head(FRAME_KEY, (uint16_t)payload_len, 0, (uint16_t)(rng() & 0x7FFF), (rng() & 1) != 0, rng());
+        uint16_t incremental = resealed.remask(sealed);
+        uint16_t full = resealed.mask_of(payload, payload_len);
+        assert(incremental == full);
+
+        // and the receiver still sees an intact frame
+        resealed.mask = incremental;
+        assert(0 == resealed.mask_of(payload, payload_len));
+    }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "rc4.hpp"
+
+using namespace net_middleware;
+
+// old clients decrypt with rc4::rc4_crypt as it is, so rc4_context must give its keystream byte for
+// byte: crypt in either mode, and crypt_multi over lane counts that leave crypt_one a remainder
+class TestRc4 :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 5000;
+    static constexpr size_t max_lanes = 21;
+    static constexpr size_t bench_lanes = 64;
+    static constexpr size_t bench_len = 1024;
+    static constexpr size_t bench_rounds = 2000;
+
+    struct keyed
+    {
+        int mod;
+        unsigned char key[10];
+        int subtract;
+        int E;
+    };
+
+public:
+    virtual void test_memory() override
+    {
+        // contexts are plain members, nothing is allocated
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            keyed k = random_key(rng);
+
+            // reset mode restarts on every message, like a fresh rc4_crypt call
+            rc4_context context;
+            context.init(k.mod, k.key, sizeof(k.key), k.subtract, k.E, rc4_context::Mode::RESET_PER_MESSAGE);
+            for (int m = 0; m < 3; ++m)
+            {
+                std::vector<unsigned char> plain = random_bytes(rng, rng() % 2000);
+                std::vector<unsigned char> expect(plain);
+                legacy(k, expect);
+
+                std::vector<unsigned char> actual(plain);
+                context.crypt(actual.data(), actual.size());
+                assert(actual == expect);
+            }
+
+            // stream mode carries on, the messages joined must match one rc4_crypt call
+            rc4_context stream;
+            stream.init(k.mod, k.key, sizeof(k.key), k.subtract, k.E, rc4_context::Mode::STREAM);
+            std::vector<unsigned char> joined;
+            std::vector<unsigned char> crypted;
+            for (int m = 0; m < 3; ++m)
+            {
+                std::vector<unsigned char> plain = random_bytes(rng, rng() % 700);
+                joined.insert(joined.end(), plain.begin(), plain.end());
+                stream.crypt(plain.data(), plain.size());
+                crypted.insert(crypted.end(), plain.begin(), plain.end());
+            }
+            legacy(k, joined);
+            assert(crypted == joined);
+        }
+
+        // 1..max_lanes lanes: crypt_eight for whole groups of 8, crypt_one for the rest
+        for (size_t count = 1; count <= max_lanes; ++count)
+        {
+            for (size_t r = 0; r < 20; ++r)
+            {
+                size_t len = rng() % 1500;
+                std::vector<keyed> keys(count);
+                std::vector<rc4_context> contexts(count);
+                std::vector<std::vector<unsigned char>> datas(count);
+                std::vector<std::vector<unsigned char>> expects(count);
+                std::vector<const rc4_context*> context_ptrs(count);
+                std::vector<unsigned char*> data_ptrs(count);
+                for (size_t l = 0; l < count; ++l)
+                {
+                    keys[l] = random_key(rng);
+                    contexts[l].init(keys[l].mod, keys[l].key, sizeof(keys[l].key), keys[l].subtract, keys[l].E, rc4_context::Mode::RESET_PER_MESSAGE);
+                    datas[l] = random_bytes(rng, len);
+                    expects[l] = datas[l];
+                    legacy(keys[l], expects[l]);
+                    context_ptrs[l] = &contexts[l];
+                    data_ptrs[l] = datas[l].data();
+                }
+
+                rc4_context::crypt_multi(context_ptrs.data(), data_ptrs.data(), count, len);
+                for (size_t l = 0; l < count; ++l)
+                    assert(datas[l] == expects[l]);
+            }
+        }
+    }
+
+    virtual void test_time() override
+    {
+        std::mt19937 rng(1);
+        std::vector<keyed> keys(bench_lanes);
+        std::vector<rc4_context> contexts(bench_lanes);
+        std::vector<std::vector<unsigned char>> datas(bench_lanes);
+        std::vector<const rc4_context*> context_ptrs(bench_lanes);
+        std::vector<unsigned char*> data_ptrs(bench_lanes);
+        for (size_t l = 0; l < bench_lanes; ++l)
+        {
+            keys[l] = random_key(rng);
+            contexts[l].init(keys[l].mod, keys[l].key, sizeof(keys[l].key), keys[l].subtract, keys[l].E, rc4_context::Mode::RESET_PER_MESSAGE);
+            datas[l] = random_bytes(rng, bench_len);
+            context_ptrs[l] = &contexts[l];
+            data_ptrs[l] = datas[l].data();
+        }
+
+        auto timer = std::chrono::high_resolution_clock();
+
+        auto start_t = timer.now();
+        for (size_t i = 0; i < bench_rounds; ++i)
+            for (size_t l = 0; l < bench_lanes; ++l)
+                legacy(keys[l], datas[l]);
+        auto legacy_t = timer.now();
+        for (size_t i = 0; i < bench_rounds; ++i)
+            for (size_t l = 0; l < bench_lanes; ++l)
+                contexts[l].crypt(data_ptrs[l], bench_len);
+        auto crypt_t = timer.now();
+        for (size_t i = 0; i < bench_rounds; ++i)
+            rc4_context::crypt_multi(context_ptrs.data(), data_ptrs.data(), bench_lanes, bench_len);
+        auto end_t = timer.now();
+
+        std::cout << "time cost crypting 2,000 x 64 1K messages, rc4_crypt: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(legacy_t - start_t).count() << "ms, crypt: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(crypt_t - legacy_t).count() << "ms, crypt_multi: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end_t - crypt_t).count() << "ms" << std::endl;
+    }
+
+private:
+    static keyed random_key(std::mt19937& rng)
+    {
+        keyed k;
+        k.mod = (int)(rng() % 255) + 1;
+        for (auto& c : k.key)
+            c = (unsigned char)(rng() % 255 + 1);
+        k.subtract = (int)(rng() % 256);
+        k.E = (int)(rng() % 2);
+        return k;
+    }
+
+    static std::vector<unsigned char> random_bytes(std::mt19937& rng, size_t len)
+    {
+        std::vector<unsigned char> bytes(len);
+        for (auto& c : bytes)
+            c = (unsigned char)rng();
+        return bytes;
+    }
+
+    static void legacy(keyed& k, std::vector<unsigned char>& data)
+    {
+        rc4::rc4_crypt(k.mod, k.key, (int)sizeof(k.key), data.data(), data.size(), k.subtract, k.E);
+    }
+};
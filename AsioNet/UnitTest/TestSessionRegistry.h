@@ -0,0 +1,267 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "session_registry.hpp"
+#include "parallel_core/EpochReclaimer.h"
+
+using namespace net_middleware;
+
+// a uid must find its own session in its own role only, and never again once erased, however often
+// its slot is reused; an erased session is let go once nobody pinned before the erase is left;
+// test_threadsafe looks up while another thread churns the slots, test_time is lookups against a
+// recursive_mutex guarded unordered_map, what the proxy's maps used to be
+class TestSessionRegistry :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 200000;
+    static constexpr size_t sessions = 10000;
+    static constexpr size_t lookups = 2000000;
+    static constexpr size_t max_threads = 8;
+
+    // uid is only known once registered, readers may already find it
+    struct fake_session
+    {
+        std::atomic<session_uid> uid;
+    };
+    typedef std::shared_ptr<fake_session> fake_sptr;
+
+public:
+    virtual void test_memory() override
+    {
+        // slots come in segments of SESSION_SEGMENT_SLOTS and stay for the registry's lifetime,
+        // the sessions in them go right after a mass disconnect
+        session_registry<fake_session> registry;
+        std::vector<std::weak_ptr<fake_session>> watched;
+        std::vector<session_uid> uids;
+        for (size_t i = 0; i < sessions; ++i)
+        {
+            auto s = std::make_shared<fake_session>();
+            uids.push_back(s->uid = registry.add(s, session_role::CLIENT));
+            watched.push_back(s);
+        }
+
+        {
+            // a lookup in flight keeps what it may still be copying
+            parallel_core::EpochGuard guard;
+            for (session_uid uid : uids)
+                assert(registry.erase(uid));
+            assert(registry.size() == 0);
+
+            EPOCH_RECLAIMER->collect();
+            EPOCH_RECLAIMER->collect();
+            for (auto& w : watched)
+                assert(!w.expired());
+        }
+
+        EPOCH_RECLAIMER->collect();
+        EPOCH_RECLAIMER->collect();
+        for (auto& w : watched)
+            assert(w.expired());
+
+        // freed slots are taken before new ones
+        auto s = std::make_shared<fake_session>();
+        session_uid uid = registry.add(s, session_role::CLIENT);
+        assert((uid & (SESSION_SLOTS_MAX - 1)) < sessions);
+    }
+
+    virtual void test_logic() override
+    {
+        std::mt19937 rng(20201017);
+        session_registry<fake_session> registry;
+        std::unordered_map<session_uid, session_role> live;
+        std::vector<session_uid> gone;
+
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            switch (rng() % 4)
+            {
+            case 0:
+            case 1:
+            {
+                auto s = std::make_shared<fake_session>();
+                session_uid uid = registry.add(s, session_role::UNMANAGED);
+                assert(uid != 0 && live.count(uid) == 0);
+                s->uid = uid;
+                live[uid] = session_role::UNMANAGED;
+                break;
+            }
+            case 2:
+                if (!live.empty())
+                {
+                    auto iter = live.begin();
+                    std::advance(iter, rng() % std::min<size_t>(live.size(), 16));
+                    session_role to = rng() % 2 ? session_role::CLIENT : session_role::SERVER;
+                    bool changed = registry.change_role(iter->first, session_role::UNMANAGED, to);
+                    assert(changed == (iter->second == session_role::UNMANAGED));
+                    if (changed)
+                        iter->second = to;
+                }
+                break;
+            default:
+                if (!live.empty())
+                {
+                    auto iter = live.begin();
+                    std::advance(iter, rng() % std::min<size_t>(live.size(), 16));
+                    assert(registry.erase(iter->first));
+                    assert(!registry.erase(iter->first));
+                    gone.push_back(iter->first);
+                    live.erase(iter);
+                }
+                break;
+            }
+
+            assert(registry.size() == live.size());
+
+            if (!live.empty())
+            {
+                auto iter = live.begin();
+                std::advance(iter, rng() % std::min<size_t>(live.size(), 16));
+                fake_sptr found;
+                assert(registry.try_get(iter->first, iter->second, found) && found->uid == iter->first);
+                session_role other = iter->second == session_role::CLIENT ? session_role::SERVER : session_role::CLIENT;
+                assert(!registry.try_get(iter->first, other, found));
+            }
+
+            // an erased uid stays dead even after its slot went to someone else
+            if (!gone.empty())
+            {
+                session_uid stale = gone[rng() % gone.size()];
+                fake_sptr found;
+                assert(live.count(stale) > 0 || !registry.try_get(stale, session_role::UNMANAGED, found));
+            }
+        }
+
+        size_t clients = 0;
+        registry.for_each(session_role::CLIENT, [&clients, &live](const fake_sptr& s) {
+            assert(live[s->uid] == session_role::CLIENT);
+            ++clients;
+        });
+
+        size_t expect = 0;
+        for (auto& pair : live)
+            expect += pair.second == session_role::CLIENT;
+        assert(clients == expect);
+
+        size_t odd = 0;
+        for (auto& pair : live)
+            odd += pair.first % 2;
+        assert(registry.erase_if([](const fake_sptr& s, session_role) { return s->uid % 2 == 1; }) == odd);
+        assert(registry.size() == live.size() - odd);
+    }
+
+    virtual void test_threadsafe() override
+    {
+        session_registry<fake_session> registry;
+        std::vector<std::atomic<session_uid>> uids(sessions);
+        for (auto& uid : uids)
+        {
+            auto s = std::make_shared<fake_session>();
+            uid = s->uid = registry.add(s, session_role::CLIENT);
+        }
+
+        // a reader may see a uid live or dead, never another session behind it
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> readers;
+        for (size_t t = 0; t < 4; ++t)
+        {
+            readers.emplace_back([&registry, &uids, &stop, t]() {
+                std::mt19937 rng((unsigned)t);
+                while (!stop.load())
+                {
+                    session_uid uid = uids[rng() % uids.size()].load();
+                    fake_sptr found;
+                    if (registry.try_get(uid, session_role::CLIENT, found))
+                        assert(found->uid == uid);
+                }
+            });
+        }
+
+        std::mt19937 rng(1);
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            size_t k = rng() % sessions;
+            registry.erase(uids[k]);
+            auto s = std::make_shared<fake_session>();
+            uids[k] = s->uid = registry.add(s, session_role::CLIENT);
+        }
+
+        stop.store(true);
+        for (auto& reader : readers)
+            reader.join();
+
+        assert(registry.size() == sessions);
+    }
+
+    virtual void test_time() override
+    {
+        session_registry<fake_session> registry;
+        std::unordered_map<session_uid, fake_sptr> map;
+        std::recursive_mutex map_mut;
+
+        std::vector<session_uid> uids(sessions);
+        for (auto& uid : uids)
+        {
+            auto s = std::make_shared<fake_session>();
+            uid = s->uid = registry.add(s, session_role::CLIENT);
+            map[uid] = s;
+        }
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double registry_ms = run(threads, [&registry, &uids](std::mt19937& rng) {
+                fake_sptr found;
+                return registry.try_get(uids[rng() % uids.size()], session_role::CLIENT, found);
+            });
+
+            double map_ms = run(threads, [&map, &map_mut, &uids](std::mt19937& rng) {
+                session_uid uid = uids[rng() % uids.size()];
+                fake_sptr found;
+                std::lock_guard<std::recursive_mutex> lock(map_mut);
+                auto iter = map.find(uid);
+                if (iter == map.end())
+                    return false;
+                found = iter->second;
+                return true;
+            });
+
+            std::cout << threads << " threads, " << lookups << " lookups each: registry " << registry_ms
+                << " ms, locked map " << map_ms << " ms" << std::endl;
+        }
+    }
+
+private:
+    template <typename Lookup>
+    static double run(size_t threads, Lookup lookup)
+    {
+        std::atomic<size_t> hits(0);
+        std::vector<std::thread> workers;
+
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&hits, &lookup, t]() {
+                std::mt19937 rng((unsigned)t);
+                size_t n = 0;
+                for (size_t i = 0; i < lookups; ++i)
+                    n += lookup(rng);
+                hits += n;
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        auto end_t = std::chrono::high_resolution_clock::now();
+
+        assert(hits.load() == threads * lookups);
+        return std::chrono::duration<double, std::milli>(end_t - start_t).count();
+    }
+};
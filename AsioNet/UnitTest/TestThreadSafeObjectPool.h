@@ -0,0 +1,352 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <assert.h>
+
+#include "UnitTestInterface.h"
+#include "AllocCounter.h"
+#include "parallel_core/ThreadSafeObjectPool.h"
+
+using namespace parallel_core;
+
+// what a thread releases comes back to it, a release on another thread reaches the owner through its
+// remote list, a slot left by an exited thread is taken over with its cache, and overflow travels
+// through the depot one batch at a time; test_time runs 1 to 64 threads, the proxy runs
+// session_thread_num of them, against one lock around one free list
+class TestThreadSafeObjectPool :public UnitTestInterface
+{
+public:
+    static constexpr size_t rounds = 100000;
+    static constexpr size_t ops_per_thread = 200000;
+    static constexpr size_t max_threads = 64;
+    static constexpr size_t thread_num = 4;
+    static constexpr size_t burst = 48;
+    static constexpr size_t handoff_batch = 256;
+    static constexpr uint64_t alive = 0x5a5a5a5a5a5a5a5aull;
+
+    struct item
+    {
+        item() : canary(alive) { taken.store(false); }
+        ~item() { canary = 0; }
+
+        uint64_t canary;
+        // set while handed out, a second get of the same object finds it set
+        std::atomic<bool> taken;
+    };
+    typedef ThreadSafeObjectPool<item> pool_type;
+    typedef std::tuple<int, item*> held_item;
+
+    // the same lock every thread goes through without magazines
+    class locked_pool
+    {
+    public:
+        ~locked_pool()
+        {
+            for (item* one : _free)
+                delete one;
+        }
+
+        held_item get()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mut);
+                if (!_free.empty())
+                {
+                    item* one = _free.back();
+                    _free.pop_back();
+                    return std::make_tuple(0, one);
+                }
+            }
+            return std::make_tuple(0, new item);
+        }
+
+        void release(item* element, int)
+        {
+            std::lock_guard<std::mutex> lock(_mut);
+            _free.push_back(element);
+        }
+
+    private:
+        std::mutex _mut;
+        std::vector<item*> _free;
+    };
+
+    // every thread of a handoff round waits here before the next step
+    class spin_barrier
+    {
+    public:
+        explicit spin_barrier(size_t count) :
+            _count(count)
+        {
+            _waiting.store(0);
+            _generation.store(0);
+        }
+
+        void wait()
+        {
+            size_t generation = _generation.load(std::memory_order_acquire);
+            if (_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == _count)
+            {
+                _waiting.store(0, std::memory_order_relaxed);
+                _generation.fetch_add(1, std::memory_order_release);
+                return;
+            }
+
+            while (_generation.load(std::memory_order_acquire) == generation)
+                std::this_thread::yield();
+        }
+
+    private:
+        size_t _count;
+        std::atomic<size_t> _waiting;
+        std::atomic<size_t> _generation;
+    };
+
+public:
+    virtual void test_memory() override
+    {
+        pool_type pool;
+        std::vector<held_item> held(POOL_MAGAZINE_SIZE * 4);
+
+        // a burst past the magazine flushes batches to the depot and the next one refills from them
+        cycle(pool, held);
+        size_t allocs = g_alloc_count.load();
+        for (size_t i = 0; i < rounds / 100; ++i)
+            cycle(pool, held);
+        allocs = g_alloc_count.load() - allocs;
+
+        std::cout << "mallocs per get once warm: " << (double)allocs / (rounds / 100 * held.size()) << std::endl;
+        assert(allocs == 0);
+    }
+
+    virtual void test_logic() override
+    {
+        check_remote_release();
+        check_slot_reuse();
+        check_depot_batches();
+    }
+
+    virtual void test_time() override
+    {
+        pool_type pool;
+        locked_pool locked;
+
+        // the first pass over either pays for allocating the objects
+        run_local(1, pool);
+        run_local(1, locked);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double local_ms = run_local(threads, pool);
+            double locked_local_ms = run_local(threads, locked);
+            double handoff_ms = run_handoff(threads, pool);
+            double locked_handoff_ms = run_handoff(threads, locked);
+
+            double total = (double)threads * ops_per_thread / 1000;
+            std::cout << threads << " threads, same thread: pool " << total / local_ms << " Mops/s, locked "
+                << total / locked_local_ms << " Mops/s; next thread: pool " << total / handoff_ms
+                << " Mops/s, locked " << total / locked_handoff_ms << " Mops/s" << std::endl;
+        }
+    }
+
+    virtual void test_threadsafe() override
+    {
+        pool_type pool;
+        run_local(thread_num, pool);
+        run_handoff(thread_num, pool);
+        run_local(thread_num, pool);
+    }
+
+private:
+    // released on another thread, the object waits on the owner's remote list until the magazine runs dry
+    void check_remote_release()
+    {
+        pool_type pool;
+        held_item kept = pool.get();
+        held_item sent = pool.get();
+        int slot = std::get<0>(sent);
+        assert(slot >= 0 && slot == get_current_thread_slot() && std::get<0>(kept) == slot);
+
+        std::thread([&pool, &sent]() {
+            assert(get_current_thread_slot() != std::get<0>(sent));
+            pool.release(std::get<1>(sent), std::get<0>(sent));
+        }).join();
+        pool.release(std::get<1>(kept), slot);
+
+        held_item first = pool.get();
+        held_item second = pool.get();
+        assert(std::get<1>(first) == std::get<1>(kept));
+        assert(std::get<1>(second) == std::get<1>(sent));
+
+        pool.release(std::get<1>(first), slot);
+        pool.release(std::get<1>(second), slot);
+    }
+
+    // the slot of an exited thread goes to the next thread, together with the cache it left
+    void check_slot_reuse()
+    {
+        pool_type pool;
+        int first_slot = -1;
+        item* cached = NULL;
+        item* orphan = NULL;
+
+        std::thread([&]() {
+            first_slot = get_current_thread_slot();
+            cached = std::get<1>(pool.get());
+            orphan = std::get<1>(pool.get());
+            pool.release(cached, first_slot);
+        }).join();
+        assert(first_slot >= 0 && first_slot != get_current_thread_slot());
+
+        // nobody holds the slot now, its remote list still takes the release
+        pool.release(orphan, first_slot);
+
+        std::thread([&]() {
+            int slot = get_current_thread_slot();
+            assert(slot == first_slot);
+
+            held_item first = pool.get();
+            held_item second = pool.get();
+            assert(std::get<0>(first) == slot && std::get<1>(first) == cached);
+            assert(std::get<0>(second) == slot && std::get<1>(second) == orphan);
+
+            pool.release(std::get<1>(first), slot);
+            pool.release(std::get<1>(second), slot);
+        }).join();
+    }
+
+    // a full magazine hands its oldest POOL_BATCH_SIZE to the depot as one chain, and an empty
+    // magazine on another thread takes that whole chain back before it allocates
+    void check_depot_batches()
+    {
+        pool_type pool;
+        int slot = get_current_thread_slot();
+
+        std::vector<item*> items;
+        for (size_t i = 0; i < POOL_MAGAZINE_SIZE + 1; ++i)
+            items.push_back(std::get<1>(pool.get()));
+        for (item* one : items)
+            pool.release(one, slot);
+
+        std::set<item*> flushed(items.begin(), items.begin() + POOL_BATCH_SIZE);
+        std::set<item*> released(items.begin(), items.end());
+
+        std::thread([&]() {
+            int other = get_current_thread_slot();
+            assert(other >= 0 && other != slot);
+
+            std::vector<item*> refilled;
+            for (size_t i = 0; i < POOL_BATCH_SIZE; ++i)
+                refilled.push_back(std::get<1>(pool.get()));
+            assert(std::set<item*>(refilled.begin(), refilled.end()) == flushed);
+
+            // the depot is empty again and the rest stayed in the other magazine
+            item* fresh = std::get<1>(pool.get());
+            assert(released.count(fresh) == 0);
+            refilled.push_back(fresh);
+
+            for (item* one : refilled)
+                pool.release(one, other);
+        }).join();
+    }
+
+    static void cycle(pool_type& pool, std::vector<held_item>& held)
+    {
+        for (auto& one : held)
+            one = pool.get();
+        for (auto& one : held)
+            pool.release(std::get<1>(one), std::get<0>(one));
+    }
+
+    static void take(const held_item& one)
+    {
+        assert(std::get<1>(one)->canary == alive);
+        assert(!std::get<1>(one)->taken.exchange(true));
+        (void)one;
+    }
+
+    static void give_back(const held_item& one)
+    {
+        assert(std::get<1>(one)->taken.exchange(false));
+        (void)one;
+    }
+
+    // every thread takes a burst and gives it back, the magazine serves all of it
+    template <typename Pool>
+    static double run_local(size_t threads, Pool& pool)
+    {
+        std::vector<std::thread> workers;
+
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&pool]() {
+                held_item held[burst];
+                for (size_t i = 0; i < ops_per_thread; i += burst)
+                {
+                    for (auto& one : held)
+                    {
+                        one = pool.get();
+                        take(one);
+                    }
+                    for (auto& one : held)
+                    {
+                        give_back(one);
+                        pool.release(std::get<1>(one), std::get<0>(one));
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        auto end_t = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end_t - start_t).count();
+    }
+
+    // every thread takes a batch and the next thread in the ring gives it back, like buffers crossing strands
+    template <typename Pool>
+    static double run_handoff(size_t threads, Pool& pool)
+    {
+        std::vector<std::vector<held_item>> outboxes(threads, std::vector<held_item>(handoff_batch));
+        spin_barrier barrier(threads);
+        std::vector<std::thread> workers;
+
+        auto start_t = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&pool, &outboxes, &barrier, threads, t]() {
+                std::vector<held_item>& mine = outboxes[t];
+                std::vector<held_item>& previous = outboxes[(t + threads - 1) % threads];
+                for (size_t i = 0; i < ops_per_thread; i += handoff_batch)
+                {
+                    for (auto& one : mine)
+                    {
+                        one = pool.get();
+                        take(one);
+                    }
+                    barrier.wait();
+
+                    for (auto& one : previous)
+                    {
+                        give_back(one);
+                        pool.release(std::get<1>(one), std::get<0>(one));
+                    }
+                    barrier.wait();
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        auto end_t = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end_t - start_t).count();
+    }
+};
@@ -1,4 +1,14 @@
 #include "TestRandom.h"
+#include "TestPoolHandle.h"
+#include "TestThreadSafeObjectPool.h"
+#include "TestProtoMask.h"
+#include "TestCipher.h"
+#include "TestRc4.h"
+#include "TestCompressCodec.h"
+#include "TestAoiGrid.h"
+#include "TestSessionRegistry.h"
+#include "TestEpochReclaimer.h"
+#include "TestConcurrentHashMap.h"
 
 #include <vector>
 #include <set>
@@ -11,6 +21,52 @@ int main()
     tr.test_time();*/
     // tr.test_threadsafe();
 
+    // TestPoolHandle tph;
+    // tph.test_logic();
+    // tph.test_memory();
+    // tph.test_time();
+
+    // TestThreadSafeObjectPool ttp;
+    // ttp.test_logic();
+    // ttp.test_memory();
+    // ttp.test_threadsafe();
+    // ttp.test_time();
+
+    // TestProtoMask tpm;
+    // tpm.test_logic();
+    // tpm.test_time();
+
+    // TestCipher tc;
+    // tc.test_logic();
+    // tc.test_time();
+
+    // TestRc4 trc;
+    // trc.test_logic();
+    // trc.test_time();
+
+    // TestCompressCodec tcc;
+    // tcc.test_logic();
+    // tcc.test_time();
+
+    // TestAoiGrid tag;
+    // tag.test_logic();
+    // tag.test_time();
+
+    // TestSessionRegistry tsr;
+    // tsr.test_logic();
+    // tsr.test_threadsafe();
+    // tsr.test_time();
+
+    // TestEpochReclaimer ter;
+    // ter.test_logic();
+    // ter.test_threadsafe();
+    // ter.test_time();
+
+    // TestConcurrentHashMap tchm;
+    // tchm.test_logic();
+    // tchm.test_threadsafe();
+    // tchm.test_time();
+
     system("pause");
     return 0;
 }
\ No newline at end of file